@@ -0,0 +1,32 @@
+#include <stdlib.h>  // for realloc(), calloc(), exit()
+#include <stdio.h>   // for fprintf()
+#include <string.h>  // for strlen(), memcpy()
+
+#include "dsh.h"
+
+/*
+ * Allocations that do not come back empty. The shell has nothing
+ * better to do without memory than say so and exit, so callers need
+ * not check.
+ */
+
+static void *dsh_alloc_check(void *ptr) {
+    if (!ptr) {
+        fprintf(stderr, "dsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    return ptr;
+}
+
+void *dsh_xrealloc(void *ptr, size_t size) {
+    return dsh_alloc_check(realloc(ptr, size));
+}
+
+void *dsh_xcalloc(size_t count, size_t size) {
+    return dsh_alloc_check(calloc(count, size));
+}
+
+char *dsh_xstrdup(const char *s) {
+    size_t len = strlen(s) + 1;
+    return memcpy(dsh_xrealloc(NULL, len), s, len);
+}
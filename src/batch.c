@@ -0,0 +1,264 @@
+#include <sys/types.h>     // for pid_t
+#include <sys/resource.h>  // for struct rusage
+#include <sys/wait.h>      // for wait4(), WIFEXITED, WEXITSTATUS, WTERMSIG
+#include <fcntl.h>         // for open(), fcntl(), O_CLOEXEC, F_DUPFD_CLOEXEC
+#include <unistd.h>        // for sysconf(), dup2(), close(), STDIN_FILENO
+#include <errno.h>         // for errno, EINTR
+#include <stdlib.h>        // for malloc(), free(), strtol()
+#include <stdio.h>         // for fopen(), fprintf()
+#include <string.h>        // for strcmp(), strlen(), memcpy()
+
+#include "dsh.h"
+
+/*
+ * Batch mode: `dsh --batch [-j N] [-o LOG] [FILE]`
+ *
+ * Every line of FILE (or stdin) is an independent command. Lines are
+ * read as they are needed, so the list can be any length, and up to N
+ * of them (default: one per online CPU) run at the same time through
+ * dsh_spawn(). Builtins, functions, assignments and lists (`a | b`,
+ * `a ; b`, `( ... )`) run in the shell through dsh_dispatch() or
+ * dsh_execute(), in order with the lines around them, and `exit` stops
+ * reading. Every command gets /dev/null for stdin: the list itself is
+ * moved off fd 0 first, so no command can eat the lines after it, and
+ * commands running side by side have no terminal to fight over. When a
+ * command finishes, one line goes to LOG (default stdout):
+ *
+ *     seq  status  wall_us  user_us  sys_us  maxrss_kb  command
+ *
+ * tab separated, in completion order; seq is the line's position among
+ * the commands. status is the exit code, 128+N for signal N, or 127 if
+ * the command could not be started; for what ran in the shell it is $?
+ * afterwards, and the usage columns are 0. dsh exits 1 if any command
+ * failed.
+ */
+
+struct dsh_batch_slot {
+    pid_t pid;                     // 0 when the slot is free
+    unsigned long seq;
+    unsigned long long start_ns;
+    char *cmd;                     // the command, for the log
+};
+
+// The tokens have replaced the separators with NULs; join them back for the log
+static char *dsh_batch_join(char **args) {
+    size_t len = 0, pos = 0;
+    char *cmd;
+    int it;
+
+    for (it = 0; args[it] != NULL; it++) {
+        len += strlen(args[it]) + 1;
+    }
+    cmd = malloc(len);
+    if (!cmd) {
+        fprintf(stderr, "dsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (it = 0; args[it] != NULL; it++) {
+        size_t n = strlen(args[it]);
+        memcpy(cmd + pos, args[it], n);
+        pos += n;
+        cmd[pos++] = args[it + 1] ? ' ' : '\0';
+    }
+    return cmd;
+}
+
+static void dsh_batch_log(FILE *log, unsigned long seq, int status, unsigned long long wall_ns,
+                          const struct rusage *ru, const char *cmd) {
+    fprintf(log, "%lu\t%d\t%llu\t%ld\t%ld\t%ld\t%s\n", seq, status, wall_ns / 1000,
+            ru ? ru->ru_utime.tv_sec * 1000000L + ru->ru_utime.tv_usec : 0L,
+            ru ? ru->ru_stime.tv_sec * 1000000L + ru->ru_stime.tv_usec : 0L,
+            ru ? ru->ru_maxrss : 0L, cmd);
+}
+
+// Whether the line has `|`, `;`, `(`, `)`, `{` or `}` as a word, as dsh_execute() checks
+static int dsh_batch_is_list(char **words) {
+    int it;
+
+    for (it = 0; words[it] != NULL; it++) {
+        if (words[it][0] != '\0' && words[it][1] == '\0' && strchr("|;(){}", words[it][0])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Waits for any one child and logs it. Returns 1 if that freed a slot,
+ * 0 if the child was not one of ours, -1 if there was nothing to wait for.
+ */
+static int dsh_batch_reap(struct dsh_batch_slot *slots, long jobs, FILE *log, int *failed) {
+    struct rusage ru;
+    int status, code;
+    pid_t pid;
+    long it;
+
+    do {
+        pid = wait4(-1, &status, 0, &ru);
+    } while (pid < 0 && errno == EINTR);
+    if (pid < 0) {
+        return -1;
+    }
+
+    for (it = 0; it < jobs; it++) {
+        if (slots[it].pid == pid) {
+            break;
+        }
+    }
+    if (it == jobs) {
+        return 0;
+    }
+
+    code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (code != 0) {
+        *failed = 1;
+    }
+    dsh_batch_log(log, slots[it].seq, code, dsh_now_ns() - slots[it].start_ns, &ru, slots[it].cmd);
+    free(slots[it].cmd);
+    slots[it].pid = 0;
+    return 1;
+}
+
+int dsh_batch_main(int argc, char **argv) {
+    struct dsh_batch_slot *slots;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *log_path = NULL;
+    FILE *log = stdout;
+    unsigned long seq = 0;
+    long running = 0;
+    int argi = 1;
+    int failed = 0, eof = 0;
+
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] != '\0') {
+        if (strcmp(argv[argi], "-j") == 0 && argi + 1 < argc) {
+            char *end;
+            jobs = strtol(argv[argi + 1], &end, 10);
+            if (*end != '\0' || jobs < 1) {
+                fprintf(stderr, "dsh: --batch: -j expects a positive number\n");
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+            log_path = argv[argi + 1];
+        } else {
+            fprintf(stderr, "usage: dsh --batch [-j N] [-o LOG] [FILE]\n");
+            return EXIT_FAILURE;
+        }
+        argi += 2;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+
+    if (argi < argc && strcmp(argv[argi], "-") != 0) {
+        int fd = open(argv[argi], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            perror("dsh");
+            return EXIT_FAILURE;
+        }
+        dsh_io_open(&dsh_input, fd);
+    }
+    // Children read /dev/null; the list moves to a descriptor they do not inherit
+    if (dsh_input.fd == STDIN_FILENO) {
+        int fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+        if (fd < 0) {
+            perror("dsh");
+            return EXIT_FAILURE;
+        }
+        dsh_io_open(&dsh_input, fd);
+    }
+    {
+        int null = open("/dev/null", O_RDONLY);
+        if (null < 0 || dup2(null, STDIN_FILENO) < 0) {
+            perror("dsh: /dev/null");
+            return EXIT_FAILURE;
+        }
+        if (null != STDIN_FILENO) {
+            close(null);
+        }
+    }
+    if (log_path) {
+        log = fopen(log_path, "we");
+        if (!log) {
+            perror("dsh");
+            return EXIT_FAILURE;
+        }
+    }
+
+    slots = calloc(jobs, sizeof(*slots));
+    if (!slots) {
+        fprintf(stderr, "dsh: allocation error\n");
+        return EXIT_FAILURE;
+    }
+
+    while (!eof || running > 0) {
+        // Keep every slot busy while there is input left
+        while (!eof && running < jobs) {
+            char *line = dsh_read_line();
+            char **words, **args;
+            struct dsh_expand_mark mark;
+            long it;
+            int list;
+
+            if (line == NULL) {
+                eof = 1;
+                break;
+            }
+            words = dsh_split_line(line);
+            dsh_expand_mark(&mark);
+            // A list expands each of its commands as it runs them
+            list = dsh_batch_is_list(words);
+            args = list ? words : dsh_expand(words);
+            if (args[0] != NULL) {
+                unsigned long long start = dsh_now_ns();
+                char *cmd = dsh_batch_join(args);
+                pid_t pid;
+
+                seq++;
+                if (list || dsh_is_builtin(args[0]) || dsh_func_find(args[0]) || strchr(args[0], '=')) {
+                    // `exit` ends the batch early, like it ends a script
+                    dsh_status = 0;
+                    eof = (list ? dsh_execute(args) : dsh_dispatch(args)) == 0;
+                    if (dsh_status != 0) {
+                        failed = 1;
+                    }
+                    dsh_batch_log(log, seq, dsh_status, dsh_now_ns() - start, NULL, cmd);
+                    free(cmd);
+                } else if ((pid = dsh_spawn(args)) < 0) {
+                    failed = 1;
+                    dsh_batch_log(log, seq, 127, dsh_now_ns() - start, NULL, cmd);
+                    free(cmd);
+                } else {
+                    it = 0;
+                    while (slots[it].pid != 0) {
+                        it++;  // running < jobs, so there is a free slot
+                    }
+                    slots[it].pid = pid;
+                    slots[it].seq = seq;
+                    slots[it].start_ns = start;
+                    slots[it].cmd = cmd;
+                    running++;
+                }
+            }
+            dsh_expand_release(&mark);
+            free(line);
+            free(words);
+        }
+
+        if (running > 0) {
+            int reaped = dsh_batch_reap(slots, jobs, log, &failed);
+            if (reaped < 0) {
+                perror("dsh: --batch");
+                break;
+            }
+            running -= reaped;
+        }
+    }
+
+    free(slots);
+    if (log != stdout) {
+        fclose(log);
+    } else {
+        fflush(stdout);
+    }
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
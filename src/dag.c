@@ -0,0 +1,470 @@
+#include <sys/types.h>  // for pid_t
+#include <sys/stat.h>   // for stat(), struct stat
+#include <sys/wait.h>   // for waitpid(), WIFEXITED, WEXITSTATUS
+#include <unistd.h>     // for sysconf()
+#include <stdlib.h>     // for free(), strtol()
+#include <stdio.h>      // for fopen(), getline(), fprintf()
+#include <string.h>     // for strcmp(), strcspn(), memset()
+
+#include "dsh.h"
+
+/*
+ * dag: run a make-like graph of tasks, several at a time.
+ *
+ *     dag [-j N] FILE [TASK...]
+ *
+ * FILE declares tasks, one keyword per line:
+ *
+ *     task build after fetch gen     # a task and the tasks it depends on
+ *         in  src/main.c             # files the task reads
+ *         out dsh                    # files the task writes
+ *         run gcc -o dsh src/main.c  # commands, run in order
+ *
+ * A task becomes ready once everything it comes "after" has finished.
+ * Ready tasks are handed out to at most N job slots (default: one per
+ * online CPU). A task whose outputs all exist and are newer than its
+ * inputs (and than the outputs of its dependencies) is skipped, make-style.
+ * If TASKs are named, only they and what they depend on are run.
+ */
+
+#define DSH_DAG_LIST_BUFSIZE 8  // Starting size for the small lists below
+
+enum {
+    DSH_TASK_WAITING,   // some dependencies have not finished yet
+    DSH_TASK_READY,     // sitting in the ready queue
+    DSH_TASK_RUNNING,   // one of its commands is running
+    DSH_TASK_DONE,      // ran (or was up to date) successfully
+    DSH_TASK_FAILED
+};
+
+// A growable list of strings or ints; tasks have a handful of each.
+struct dsh_dag_list {
+    void **items;
+    int len;
+    int cap;
+};
+
+struct dsh_dag_task {
+    char *name;
+    struct dsh_dag_list deps;        // names, as written after "after"
+    struct dsh_dag_list dependents;  // indices of tasks that come after us
+    struct dsh_dag_list inputs;
+    struct dsh_dag_list outputs;
+    struct dsh_dag_list cmds;        // each one a NULL-terminated argv
+    int pending;   // dependencies that have not finished
+    int needed;    // part of what the user asked for
+    int state;
+    int next_cmd;  // index of the command to run next
+    pid_t pid;     // pid of the running command, if any
+};
+
+struct dsh_dag {
+    struct dsh_dag_task *tasks;
+    int ntasks;
+    int cap;
+    struct dsh_dag_list lines;  // line buffers the argvs point into
+};
+
+static void dsh_dag_push(struct dsh_dag_list *list, void *item) {
+    if (list->len >= list->cap) {
+        list->cap = list->cap ? list->cap * 2 : DSH_DAG_LIST_BUFSIZE;
+        list->items = dsh_xrealloc(list->items, list->cap * sizeof(void *));
+    }
+    list->items[list->len++] = item;
+}
+
+static int dsh_dag_find(struct dsh_dag *dag, const char *name) {
+    int it;
+    for (it = 0; it < dag->ntasks; it++) {
+        if (strcmp(dag->tasks[it].name, name) == 0) {
+            return it;
+        }
+    }
+    return -1;
+}
+
+static void dsh_dag_free(struct dsh_dag *dag) {
+    int it;
+    for (it = 0; it < dag->ntasks; it++) {
+        struct dsh_dag_task *task = &dag->tasks[it];
+        int c;
+        for (c = 0; c < task->cmds.len; c++) {
+            free(task->cmds.items[c]);  // the argv array; strings live in lines
+        }
+        free(task->deps.items);
+        free(task->dependents.items);
+        free(task->inputs.items);
+        free(task->outputs.items);
+        free(task->cmds.items);
+    }
+    for (it = 0; it < dag->lines.len; it++) {
+        free(dag->lines.items[it]);
+    }
+    free(dag->lines.items);
+    free(dag->tasks);
+}
+
+/*
+ * Reads FILE into dag. Every line is tokenized with dsh_split_line(),
+ * so a task file is split exactly the way the prompt splits commands.
+ * Returns 0 on success, -1 (after printing why) on a malformed file.
+ */
+static int dsh_dag_parse(struct dsh_dag *dag, const char *path) {
+    FILE *fp = fopen(path, "r");
+    char *line = NULL;
+    size_t linecap = 0;
+    int lineno = 0;
+    int ok = 0;
+
+    if (!fp) {
+        perror("dsh: dag");
+        return -1;
+    }
+
+    while (getline(&line, &linecap, fp) != -1) {
+        struct dsh_dag_task *task = dag->ntasks ? &dag->tasks[dag->ntasks - 1] : NULL;
+        char **tokens;
+        int it;
+
+        lineno++;
+        // Comments run to the end of the line
+        line[strcspn(line, "#")] = '\0';
+
+        // The tokens point into the line, so the line has to stay around
+        tokens = dsh_split_line(line);
+        if (tokens[0] == NULL) {
+            free(tokens);
+            continue;
+        }
+        dsh_dag_push(&dag->lines, line);
+        line = NULL;
+        linecap = 0;
+
+        if (strcmp(tokens[0], "task") == 0) {
+            if (tokens[1] == NULL) {
+                fprintf(stderr, "dsh: dag: %s:%d: task needs a name\n", path, lineno);
+                ok = -1;
+            } else if (dsh_dag_find(dag, tokens[1]) >= 0) {
+                fprintf(stderr, "dsh: dag: %s:%d: task \"%s\" declared twice\n", path, lineno, tokens[1]);
+                ok = -1;
+            } else {
+                if (dag->ntasks >= dag->cap) {
+                    dag->cap = dag->cap ? dag->cap * 2 : DSH_DAG_LIST_BUFSIZE;
+                    dag->tasks = dsh_xrealloc(dag->tasks, dag->cap * sizeof(struct dsh_dag_task));
+                }
+                task = &dag->tasks[dag->ntasks++];
+                memset(task, 0, sizeof(*task));
+                task->name = tokens[1];
+                it = 2;
+                if (tokens[it] != NULL && strcmp(tokens[it], "after") == 0) {
+                    it++;
+                }
+                for (; tokens[it] != NULL; it++) {
+                    dsh_dag_push(&task->deps, tokens[it]);
+                }
+            }
+            free(tokens);
+        } else if (task == NULL) {
+            fprintf(stderr, "dsh: dag: %s:%d: \"%s\" outside of a task\n", path, lineno, tokens[0]);
+            free(tokens);
+            ok = -1;
+        } else if (strcmp(tokens[0], "in") == 0 || strcmp(tokens[0], "out") == 0) {
+            struct dsh_dag_list *files = tokens[0][0] == 'i' ? &task->inputs : &task->outputs;
+            for (it = 1; tokens[it] != NULL; it++) {
+                dsh_dag_push(files, tokens[it]);
+            }
+            free(tokens);
+        } else if (strcmp(tokens[0], "run") == 0 && tokens[1] != NULL) {
+            // Keep the token array itself, minus the "run" keyword
+            for (it = 0; tokens[it] != NULL; it++) {
+                tokens[it] = tokens[it + 1];
+            }
+            dsh_dag_push(&task->cmds, tokens);
+        } else {
+            fprintf(stderr, "dsh: dag: %s:%d: unknown keyword \"%s\"\n", path, lineno, tokens[0]);
+            free(tokens);
+            ok = -1;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+    return ok;
+}
+
+/*
+ * Marks a task the user asked for, and everything that has to run
+ * before it, as needed.
+ */
+static int dsh_dag_need(struct dsh_dag *dag, int idx) {
+    struct dsh_dag_task *task = &dag->tasks[idx];
+    int it;
+
+    if (task->needed) {
+        return 0;
+    }
+    task->needed = 1;
+
+    for (it = 0; it < task->deps.len; it++) {
+        int dep = dsh_dag_find(dag, task->deps.items[it]);
+        if (dep < 0) {
+            fprintf(stderr, "dsh: dag: task \"%s\" depends on unknown task \"%s\"\n",
+                    task->name, (char *) task->deps.items[it]);
+            return -1;
+        }
+        if (dsh_dag_need(dag, dep) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Links every needed task to the tasks that depend on it and counts
+ * how many dependencies each one is still waiting for.
+ */
+static void dsh_dag_link(struct dsh_dag *dag) {
+    int it, d;
+    for (it = 0; it < dag->ntasks; it++) {
+        struct dsh_dag_task *task = &dag->tasks[it];
+        if (!task->needed) {
+            continue;
+        }
+        for (d = 0; d < task->deps.len; d++) {
+            int dep = dsh_dag_find(dag, task->deps.items[d]);
+            dsh_dag_push(&dag->tasks[dep].dependents, (void *) (long) it);
+            task->pending++;
+        }
+    }
+}
+
+static int dsh_dag_newer(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec > b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+/*
+ * A task is up to date when it declares outputs, all of them exist, and
+ * the oldest of them is at least as new as every input. The outputs of
+ * the tasks it comes after count as inputs, so rebuilding a dependency
+ * rebuilds whatever uses it.
+ */
+static int dsh_dag_up_to_date(struct dsh_dag *dag, struct dsh_dag_task *task) {
+    struct timespec oldest_out = { 0, 0 }, newest_in = { 0, 0 };
+    struct stat st;
+    int it, d;
+
+    if (task->outputs.len == 0) {
+        return 0;
+    }
+    for (it = 0; it < task->outputs.len; it++) {
+        if (stat(task->outputs.items[it], &st) != 0) {
+            return 0;
+        }
+        if (it == 0 || dsh_dag_newer(&oldest_out, &st.st_mtim)) {
+            oldest_out = st.st_mtim;
+        }
+    }
+
+    for (it = 0; it < task->inputs.len; it++) {
+        if (stat(task->inputs.items[it], &st) != 0) {
+            return 0;  // a missing input: let the command complain about it
+        }
+        if (dsh_dag_newer(&st.st_mtim, &newest_in)) {
+            newest_in = st.st_mtim;
+        }
+    }
+    for (d = 0; d < task->deps.len; d++) {
+        struct dsh_dag_task *dep = &dag->tasks[dsh_dag_find(dag, task->deps.items[d])];
+        for (it = 0; it < dep->outputs.len; it++) {
+            if (stat(dep->outputs.items[it], &st) == 0 && dsh_dag_newer(&st.st_mtim, &newest_in)) {
+                newest_in = st.st_mtim;
+            }
+        }
+    }
+
+    return !dsh_dag_newer(&newest_in, &oldest_out);
+}
+
+/*
+ * The scheduler. Ready tasks wait in a FIFO queue; whenever a job slot
+ * is free the next one is started (or skipped if it is up to date), and
+ * whenever a child exits its task either moves on to its next command
+ * or finishes and releases the tasks that were waiting on it.
+ * After a failure no new tasks are started, but running ones are
+ * waited for so no children are left behind.
+ */
+static int dsh_dag_run(struct dsh_dag *dag, int jobs) {
+    int *queue = dsh_xrealloc(NULL, (dag->ntasks + 1) * sizeof(int));
+    int head = 0, tail = 0;
+    int running = 0, remaining = 0, failed = 0;
+    int it;
+
+    for (it = 0; it < dag->ntasks; it++) {
+        struct dsh_dag_task *task = &dag->tasks[it];
+        if (!task->needed) {
+            continue;
+        }
+        remaining++;
+        if (task->pending == 0) {
+            task->state = DSH_TASK_READY;
+            queue[tail++] = it;
+        }
+    }
+
+    while (remaining > 0) {
+        pid_t pid;
+        int status;
+
+        // Fill the free job slots from the ready queue
+        while (!failed && running < jobs && head < tail) {
+            struct dsh_dag_task *task = &dag->tasks[queue[head++]];
+
+            if (task->cmds.len == 0 || dsh_dag_up_to_date(dag, task)) {
+                task->next_cmd = task->cmds.len;
+            } else {
+                fprintf(stderr, "dag: %s\n", task->name);
+                task->pid = dsh_spawn(task->cmds.items[0]);
+                task->next_cmd = 1;
+                if (task->pid < 0) {
+                    task->state = DSH_TASK_FAILED;
+                    failed = 1;
+                    remaining--;
+                    continue;
+                }
+                task->state = DSH_TASK_RUNNING;
+                running++;
+                continue;
+            }
+
+            // Nothing to run: the task finishes on the spot
+            task->state = DSH_TASK_DONE;
+            remaining--;
+            for (it = 0; it < task->dependents.len; it++) {
+                struct dsh_dag_task *next = &dag->tasks[(long) task->dependents.items[it]];
+                if (--next->pending == 0) {
+                    next->state = DSH_TASK_READY;
+                    queue[tail++] = (long) task->dependents.items[it];
+                }
+            }
+        }
+
+        if (running == 0) {
+            if (remaining == 0) {
+                break;
+            }
+            if (!failed && head == tail) {
+                fprintf(stderr, "dsh: dag: dependency cycle among the remaining tasks\n");
+                failed = 1;
+            }
+            if (failed) {
+                break;
+            }
+            continue;
+        }
+
+        pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            perror("dsh: dag");
+            failed = 1;
+            break;
+        }
+
+        for (it = 0; it < dag->ntasks; it++) {
+            struct dsh_dag_task *task = &dag->tasks[it];
+            int d;
+
+            if (task->state != DSH_TASK_RUNNING || task->pid != pid) {
+                continue;
+            }
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "dsh: dag: task \"%s\" failed\n", task->name);
+                task->state = DSH_TASK_FAILED;
+                failed = 1;
+                running--;
+                remaining--;
+            } else if (!failed && task->next_cmd < task->cmds.len) {
+                // Same slot, next command of the same task
+                task->pid = dsh_spawn(task->cmds.items[task->next_cmd++]);
+                if (task->pid < 0) {
+                    task->state = DSH_TASK_FAILED;
+                    failed = 1;
+                    running--;
+                    remaining--;
+                }
+            } else {
+                task->state = failed ? DSH_TASK_FAILED : DSH_TASK_DONE;
+                running--;
+                remaining--;
+                for (d = 0; d < task->dependents.len; d++) {
+                    struct dsh_dag_task *next = &dag->tasks[(long) task->dependents.items[d]];
+                    if (--next->pending == 0) {
+                        next->state = DSH_TASK_READY;
+                        queue[tail++] = (long) task->dependents.items[d];
+                    }
+                }
+            }
+            break;
+        }
+    }
+
+    free(queue);
+    return failed ? -1 : 0;
+}
+
+int dsh_dag(char **args) {
+    struct dsh_dag dag = { 0 };
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int argi = 1;
+    int it;
+
+    if (args[argi] != NULL && strncmp(args[argi], "-j", 2) == 0) {
+        const char *count = args[argi][2] ? args[argi] + 2 : args[++argi];
+        char *end;
+
+        jobs = count ? strtol(count, &end, 10) : 0;
+        if (!count || *end != '\0' || jobs < 1) {
+            fprintf(stderr, "dsh: dag: -j expects a positive number\n");
+            dsh_status = 1;
+            return 1;
+        }
+        argi++;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (args[argi] == NULL) {
+        fprintf(stderr, "dsh: usage: dag [-j N] FILE [TASK...]\n");
+        dsh_status = 1;
+        return 1;
+    }
+
+    dsh_status = 1;  // until the tasks asked for have all run
+    if (dsh_dag_parse(&dag, args[argi]) == 0) {
+        int ok = 0;
+
+        if (args[argi + 1] == NULL) {
+            for (it = 0; it < dag.ntasks && ok == 0; it++) {
+                ok = dsh_dag_need(&dag, it);
+            }
+        }
+        for (it = argi + 1; args[it] != NULL && ok == 0; it++) {
+            int idx = dsh_dag_find(&dag, args[it]);
+            if (idx < 0) {
+                fprintf(stderr, "dsh: dag: no task named \"%s\"\n", args[it]);
+                ok = -1;
+            } else {
+                ok = dsh_dag_need(&dag, idx);
+            }
+        }
+
+        if (ok == 0) {
+            dsh_dag_link(&dag);
+            if (dsh_dag_run(&dag, (int) jobs) == 0) {
+                dsh_status = 0;
+            }
+        }
+    }
+
+    dsh_dag_free(&dag);
+    return 1;
+}
@@ -0,0 +1,759 @@
+#define _GNU_SOURCE    // for O_PATH
+#include <sys/stat.h>  // for mkdir(), stat()
+#include <fcntl.h>     // for open(), O_PATH, O_DIRECTORY, O_CLOEXEC
+#include <unistd.h>    // for chdir(), fchdir(), getcwd(), getpid(), unlink(), close()
+#include <errno.h>     // for errno, ENOENT, EEXIST
+#include <time.h>      // for time()
+#include <stdlib.h>    // for free(), getenv(), strtod()
+#include <stdio.h>     // for fopen(), getline(), fprintf(), printf()
+#include <string.h>    // for strcmp(), strlen(), strchr(), strrchr()
+#include <ctype.h>     // for tolower()
+
+#include "dsh.h"
+
+/*
+ * cd, pushd, popd and dirs.
+ *
+ * `cd DIR` tries, in order:
+ *   1. DIR itself.
+ *   2. DIR under each $CDPATH entry (relative names only). Where a name
+ *      was found is remembered for as long as $CDPATH stays the same,
+ *      so the next `cd` to it is a single dsh_chdir().
+ *   3. A frecency jump: `cd proj` or `cd src dsh` goes to the most
+ *      frecent directory visited before whose path contains the words
+ *      in order, the last one in its final component (like zoxide).
+ * When 2 or 3 picked the directory, it is printed.
+ *
+ * Every successful change of directory bumps that directory's rank in
+ * a small database ($DSH_DIRS_DB, or $XDG_DATA_HOME/dsh/dirs, or
+ * ~/.local/share/dsh/dirs: "rank<TAB>last visit<TAB>path" lines). It is
+ * read on first use, updated in memory, and written back (to a temp file
+ * that is renamed over the old one) every DSH_DIRS_SAVE_EVERY visits
+ * and when the shell exits. Nothing is stat()ed to keep it fresh: an
+ * entry whose directory is gone is dropped when dsh_chdir() to it fails.
+ */
+
+#define DSH_DIRS_PATH_MAX 4096
+#define DSH_DIRS_BUFSIZE 64        // starting size of the database and stack
+#define DSH_DIRS_MAX_RANK 10000.0  // total rank before everything is aged
+#define DSH_DIRS_SAVE_EVERY 16     // visits between writes to disk
+#define DSH_DIRS_MAX_WORDS 16
+
+struct dsh_dir_entry {
+    char *path;
+    double rank;
+    long last;  // seconds since the epoch
+};
+
+static struct dsh_dir_entry *dsh_dirs_db;
+static size_t dsh_dirs_db_len;
+static size_t dsh_dirs_db_cap;
+static int dsh_dirs_loaded;
+static int dsh_dirs_unsaved;  // visits since the last write
+
+static char **dsh_dirstack;   // pushd's stack; the top is the last element
+static size_t dsh_dirstack_len;
+static size_t dsh_dirstack_cap;
+
+// $CDPATH hits, valid while $CDPATH equals dsh_cdpath_seen
+struct dsh_cdpath_hit {
+    char *name;
+    char *path;
+};
+static struct dsh_cdpath_hit *dsh_cdpath_hits;
+static size_t dsh_cdpath_len;
+static char *dsh_cdpath_seen;
+
+
+static char *dsh_pwd_path;     // the logical current directory, NULL until known
+static char *dsh_oldpwd_path;  // where the last cd came from
+
+// Whether path names the same directory as "." (same device and inode)
+static int dsh_pwd_is_dot(const char *path) {
+    struct stat at_path, at_dot;
+
+    return stat(path, &at_path) == 0 && stat(".", &at_dot) == 0 &&
+           at_path.st_dev == at_dot.st_dev && at_path.st_ino == at_dot.st_ino;
+}
+
+static void dsh_pwd_physical(void) {
+    char cwd[DSH_DIRS_PATH_MAX];
+
+    free(dsh_pwd_path);
+    dsh_pwd_path = NULL;
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        dsh_pwd_path = dsh_xstrdup(cwd);
+        dsh_var_export("PWD", cwd);
+    }
+}
+
+/*
+ * The current directory. The first call takes $PWD if it really names
+ * "." (so a path through a symlink survives from the parent shell),
+ * else asks getcwd(); later calls just return what cd left behind.
+ * NULL if the directory cannot be named at all.
+ */
+const char *dsh_pwd(void) {
+    if (dsh_pwd_path == NULL) {
+        const char *env = getenv("PWD");
+
+        if (env && env[0] == '/' && dsh_pwd_is_dot(env)) {
+            dsh_pwd_path = dsh_xstrdup(env);
+        } else {
+            dsh_pwd_physical();
+        }
+    }
+    return dsh_pwd_path;
+}
+
+/*
+ * Writes base/path into out with "." and ".." resolved as text, the way
+ * `cd -L` does. Returns 0, or -1 if it does not fit.
+ */
+static int dsh_pwd_join(const char *base, const char *path, char *out, size_t size) {
+    size_t len = 0;
+    const char *p;
+
+    if (path[0] != '/') {
+        len = strlen(base);
+        if (len >= size) {
+            return -1;
+        }
+        memcpy(out, base, len);
+        if (len == 1) {
+            len = 0;  // base is "/"
+        }
+    }
+
+    p = path;
+    while (*p) {
+        size_t n;
+
+        while (*p == '/') {
+            p++;
+        }
+        n = strcspn(p, "/");
+        if (n == 0 || (n == 1 && p[0] == '.')) {
+            // empty or "."
+        } else if (n == 2 && p[0] == '.' && p[1] == '.') {
+            while (len > 0 && out[--len] != '/') {
+                ;
+            }
+        } else {
+            if (len + 1 + n >= size) {
+                return -1;
+            }
+            out[len++] = '/';
+            memcpy(out + len, p, n);
+            len += n;
+        }
+        p += n;
+    }
+
+    if (len == 0) {
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    return 0;
+}
+
+/*
+ * Subshells run inside the shell (subshell.c) and must leave the
+ * directories as they found them. The state is saved into the innermost
+ * frame only when dsh_chdir() first changes it there, which is also the
+ * only place it changes (pushd and popd move the stack after their
+ * dsh_chdir() has succeeded), so a subshell that never cd's costs
+ * nothing here. "." is kept as a descriptor rather than a name: a
+ * directory that is renamed meanwhile is still found.
+ */
+static struct dsh_dirs_frame *dsh_dirs_frame;
+
+static char *dsh_dirs_strdup_null(const char *s) {
+    return s ? dsh_xstrdup(s) : NULL;
+}
+
+static void dsh_dirs_hold(void) {
+    struct dsh_dirs_frame *frame = dsh_dirs_frame;
+    size_t it;
+
+    if (frame == NULL || frame->saved) {
+        return;
+    }
+    frame->saved = 1;
+    frame->cwd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    frame->pwd = dsh_dirs_strdup_null(dsh_pwd_path);
+    frame->oldpwd = dsh_dirs_strdup_null(dsh_oldpwd_path);
+    frame->env_pwd = dsh_dirs_strdup_null(getenv("PWD"));
+    frame->env_oldpwd = dsh_dirs_strdup_null(getenv("OLDPWD"));
+    frame->stack = NULL;
+    frame->stack_len = dsh_dirstack_len;
+    if (dsh_dirstack_len > 0) {
+        frame->stack = dsh_xrealloc(NULL, dsh_dirstack_len * sizeof(char *));
+        for (it = 0; it < dsh_dirstack_len; it++) {
+            frame->stack[it] = dsh_xstrdup(dsh_dirstack[it]);
+        }
+    }
+}
+
+void dsh_dirs_enter(struct dsh_dirs_frame *frame) {
+    frame->outer = dsh_dirs_frame;
+    frame->saved = 0;
+    dsh_dirs_frame = frame;
+}
+
+void dsh_dirs_leave(struct dsh_dirs_frame *frame) {
+    size_t it;
+
+    dsh_dirs_frame = frame->outer;
+    if (!frame->saved) {
+        return;
+    }
+    if ((frame->cwd >= 0 ? fchdir(frame->cwd) : frame->pwd ? chdir(frame->pwd) : -1) != 0) {
+        perror("dsh: cannot go back to the directory before the subshell");
+    }
+    if (frame->cwd >= 0) {
+        close(frame->cwd);
+    }
+    free(dsh_pwd_path);
+    free(dsh_oldpwd_path);
+    dsh_pwd_path = frame->pwd;
+    dsh_oldpwd_path = frame->oldpwd;
+    dsh_var_export("PWD", frame->env_pwd);
+    dsh_var_export("OLDPWD", frame->env_oldpwd);
+    free(frame->env_pwd);
+    free(frame->env_oldpwd);
+
+    for (it = 0; it < dsh_dirstack_len; it++) {
+        free(dsh_dirstack[it]);
+    }
+    free(dsh_dirstack);
+    dsh_dirstack = frame->stack;
+    dsh_dirstack_len = dsh_dirstack_cap = frame->stack_len;
+}
+
+/*
+ * chdir() that keeps the logical directory, $PWD and $OLDPWD up to
+ * date. The textual path is tried first; if the kernel disagrees with
+ * it (a ".." out of a symlink to a place that does not exist), the
+ * argument is used as given and the path comes from getcwd().
+ */
+int dsh_chdir(const char *path) {
+    char logical[DSH_DIRS_PATH_MAX];
+    const char *base = dsh_pwd();
+    char *old;
+
+    dsh_dirs_hold();
+    old = dsh_pwd_path;
+    if ((path[0] == '/' || base) && dsh_pwd_join(base ? base : "/", path, logical, sizeof(logical)) == 0 &&
+        chdir(logical) == 0) {
+        dsh_pwd_path = dsh_xstrdup(logical);
+    } else if (chdir(path) == 0) {
+        dsh_pwd_path = NULL;  // still owned by old
+        dsh_pwd_physical();
+    } else {
+        return -1;
+    }
+
+    free(dsh_oldpwd_path);
+    dsh_oldpwd_path = old;
+    if (old) {
+        dsh_var_export("OLDPWD", old);
+    }
+    dsh_var_export("PWD", dsh_pwd_path);
+    return 0;
+}
+
+/*
+ * pwd [-L|-P]: the logical directory after checking it still is ".",
+ * or with -P the physical one from the kernel.
+ */
+int dsh_pwd_builtin(char **args) {
+    char cwd[DSH_DIRS_PATH_MAX];
+
+    if (args[1] != NULL && strcmp(args[1], "-P") == 0) {
+        if (getcwd(cwd, sizeof(cwd)) == NULL) {
+            perror("dsh: pwd");
+            dsh_status = 1;
+            return 1;
+        }
+        printf("%s\n", cwd);
+        return 1;
+    } else if (args[1] != NULL && strcmp(args[1], "-L") != 0) {
+        fprintf(stderr, "dsh: usage: pwd [-L|-P]\n");
+        dsh_status = 1;
+        return 1;
+    }
+
+    if (dsh_pwd() == NULL || !dsh_pwd_is_dot(dsh_pwd_path)) {
+        dsh_pwd_physical();
+    }
+    if (dsh_pwd_path == NULL) {
+        perror("dsh: pwd");
+        dsh_status = 1;
+        return 1;
+    }
+    printf("%s\n", dsh_pwd_path);
+    return 1;
+}
+
+static int dsh_dirs_db_path(char *buf, size_t size) {
+    const char *path = getenv("DSH_DIRS_DB");
+    const char *base;
+
+    if (path && *path) {
+        return snprintf(buf, size, "%s", path) < (int) size ? 0 : -1;
+    }
+    if ((base = getenv("XDG_DATA_HOME")) && *base) {
+        return snprintf(buf, size, "%s/dsh/dirs", base) < (int) size ? 0 : -1;
+    }
+    if ((base = getenv("HOME")) && *base) {
+        return snprintf(buf, size, "%s/.local/share/dsh/dirs", base) < (int) size ? 0 : -1;
+    }
+    return -1;
+}
+
+static void dsh_dirs_add(const char *path, double rank, long last) {
+    if (dsh_dirs_db_len >= dsh_dirs_db_cap) {
+        dsh_dirs_db_cap = dsh_dirs_db_cap ? dsh_dirs_db_cap * 2 : DSH_DIRS_BUFSIZE;
+        dsh_dirs_db = dsh_xrealloc(dsh_dirs_db, dsh_dirs_db_cap * sizeof(*dsh_dirs_db));
+    }
+    dsh_dirs_db[dsh_dirs_db_len].path = dsh_xstrdup(path);
+    dsh_dirs_db[dsh_dirs_db_len].rank = rank;
+    dsh_dirs_db[dsh_dirs_db_len].last = last;
+    dsh_dirs_db_len++;
+}
+
+static void dsh_dirs_remove(size_t idx) {
+    free(dsh_dirs_db[idx].path);
+    dsh_dirs_db[idx] = dsh_dirs_db[--dsh_dirs_db_len];
+}
+
+void dsh_dirs_save(void) {
+    char path[DSH_DIRS_PATH_MAX], tmp[DSH_DIRS_PATH_MAX + 32];
+    char *slash;
+    FILE *fp;
+    size_t it;
+
+    if (!dsh_dirs_loaded || dsh_dirs_unsaved == 0 || dsh_dirs_db_path(path, sizeof(path)) != 0) {
+        return;
+    }
+
+    // Make sure the directory exists, one level is enough for the defaults
+    slash = strrchr(path, '/');
+    if (slash && slash != path) {
+        *slash = '\0';
+        if (mkdir(path, 0700) != 0 && errno == ENOENT) {
+            char *parent = strrchr(path, '/');
+            if (parent && parent != path) {
+                *parent = '\0';
+                mkdir(path, 0700);
+                *parent = '/';
+            }
+            mkdir(path, 0700);
+        }
+        *slash = '/';
+    }
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%ld", path, (long) getpid());
+    fp = fopen(tmp, "w");
+    if (!fp) {
+        return;
+    }
+    for (it = 0; it < dsh_dirs_db_len; it++) {
+        fprintf(fp, "%.3f\t%ld\t%s\n", dsh_dirs_db[it].rank, dsh_dirs_db[it].last, dsh_dirs_db[it].path);
+    }
+    if (fclose(fp) == 0 && rename(tmp, path) == 0) {
+        dsh_dirs_unsaved = 0;
+    } else {
+        unlink(tmp);
+    }
+}
+
+static void dsh_dirs_load(void) {
+    char path[DSH_DIRS_PATH_MAX];
+    char *line = NULL;
+    size_t linecap = 0;
+    ssize_t len;
+    FILE *fp;
+
+    if (dsh_dirs_loaded) {
+        return;
+    }
+    dsh_dirs_loaded = 1;
+    atexit(dsh_dirs_save);
+
+    if (dsh_dirs_db_path(path, sizeof(path)) != 0 || !(fp = fopen(path, "r"))) {
+        return;
+    }
+    while ((len = getline(&line, &linecap, fp)) > 0) {
+        char *rank_end, *last_end;
+        double rank;
+        long last;
+
+        if (line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        rank = strtod(line, &rank_end);
+        if (*rank_end != '\t') {
+            continue;
+        }
+        last = strtol(rank_end + 1, &last_end, 10);
+        if (*last_end != '\t' || last_end[1] != '/') {
+            continue;
+        }
+        dsh_dirs_add(last_end + 1, rank, last);
+    }
+    free(line);
+    fclose(fp);
+}
+
+/*
+ * Records a visit to the current directory. Once the ranks add up to
+ * more than DSH_DIRS_MAX_RANK they are all scaled down, and directories
+ * that fall under 1 are forgotten, so old habits fade.
+ */
+static void dsh_dirs_visit(void) {
+    const char *cwd = dsh_pwd();
+    double total = 0;
+    long now = time(NULL);
+    size_t it;
+
+    if (cwd == NULL) {
+        return;
+    }
+    dsh_dirs_load();
+
+    for (it = 0; it < dsh_dirs_db_len; it++) {
+        if (strcmp(dsh_dirs_db[it].path, cwd) == 0) {
+            break;
+        }
+    }
+    if (it == dsh_dirs_db_len) {
+        dsh_dirs_add(cwd, 0, now);
+    }
+    dsh_dirs_db[it].rank += 1;
+    dsh_dirs_db[it].last = now;
+
+    for (it = 0; it < dsh_dirs_db_len; it++) {
+        total += dsh_dirs_db[it].rank;
+    }
+    if (total > DSH_DIRS_MAX_RANK) {
+        it = 0;
+        while (it < dsh_dirs_db_len) {
+            dsh_dirs_db[it].rank *= 0.9;
+            if (dsh_dirs_db[it].rank < 1) {
+                dsh_dirs_remove(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    if (++dsh_dirs_unsaved >= DSH_DIRS_SAVE_EVERY) {
+        dsh_dirs_save();
+    }
+}
+
+// Rank weighted by how recently the directory was visited
+static double dsh_dirs_score(const struct dsh_dir_entry *entry, long now) {
+    long age = now - entry->last;
+
+    if (age < 3600) {
+        return entry->rank * 4;
+    }
+    if (age < 86400) {
+        return entry->rank * 2;
+    }
+    if (age < 604800) {
+        return entry->rank / 2;
+    }
+    return entry->rank / 4;
+}
+
+// Case-insensitive strstr
+static const char *dsh_dirs_find(const char *haystack, const char *needle) {
+    size_t n = strlen(needle);
+
+    for (; *haystack; haystack++) {
+        size_t it;
+        for (it = 0; it < n && haystack[it]; it++) {
+            if (tolower((unsigned char) haystack[it]) != tolower((unsigned char) needle[it])) {
+                break;
+            }
+        }
+        if (it == n) {
+            return haystack;
+        }
+    }
+    return NULL;
+}
+
+static int dsh_dirs_matches(const char *path, char **words, int nwords) {
+    const char *last_component = strrchr(path, '/');
+    const char *p = path;
+    int it;
+
+    for (it = 0; it < nwords; it++) {
+        p = dsh_dirs_find(p, words[it]);
+        if (p == NULL) {
+            return 0;
+        }
+        if (it == nwords - 1 && p < last_component) {
+            // The last word has to be in the last component; try a later match
+            const char *later = dsh_dirs_find(last_component, words[it]);
+            if (later == NULL) {
+                return 0;
+            }
+            p = later;
+        }
+        p += strlen(words[it]);
+    }
+    return 1;
+}
+
+/*
+ * Jumps to the best match, best first, dropping the ones that turn out
+ * to be gone. Returns 0 on success.
+ */
+static int dsh_dirs_jump(char **words, int nwords) {
+    const char *cwd = dsh_pwd();
+    long now = time(NULL);
+
+    dsh_dirs_load();
+    if (cwd == NULL) {
+        cwd = "";
+    }
+
+    while (1) {
+        double best_score = -1;
+        size_t best = 0, it;
+
+        for (it = 0; it < dsh_dirs_db_len; it++) {
+            double score;
+            if (strcmp(dsh_dirs_db[it].path, cwd) == 0 || !dsh_dirs_matches(dsh_dirs_db[it].path, words, nwords)) {
+                continue;
+            }
+            score = dsh_dirs_score(&dsh_dirs_db[it], now);
+            if (score > best_score) {
+                best_score = score;
+                best = it;
+            }
+        }
+        if (best_score < 0) {
+            return -1;
+        }
+        if (dsh_chdir(dsh_dirs_db[best].path) == 0) {
+            printf("%s\n", dsh_dirs_db[best].path);
+            return 0;
+        }
+        dsh_dirs_remove(best);
+        dsh_dirs_unsaved++;
+    }
+}
+
+static int dsh_cdpath_try(const char *name) {
+    const char *cdpath = dsh_var_lookup("CDPATH");
+    char path[DSH_DIRS_PATH_MAX];
+    const char *entry;
+    size_t it;
+
+    if (!cdpath || !*cdpath || name[0] == '/' || strncmp(name, "./", 2) == 0 ||
+        strncmp(name, "../", 3) == 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+        return -1;
+    }
+
+    // A different $CDPATH makes every remembered hit stale
+    if (!dsh_cdpath_seen || strcmp(dsh_cdpath_seen, cdpath) != 0) {
+        for (it = 0; it < dsh_cdpath_len; it++) {
+            free(dsh_cdpath_hits[it].name);
+            free(dsh_cdpath_hits[it].path);
+        }
+        dsh_cdpath_len = 0;
+        free(dsh_cdpath_seen);
+        dsh_cdpath_seen = dsh_xstrdup(cdpath);
+    }
+
+    for (it = 0; it < dsh_cdpath_len; it++) {
+        if (strcmp(dsh_cdpath_hits[it].name, name) == 0) {
+            if (dsh_chdir(dsh_cdpath_hits[it].path) == 0) {
+                printf("%s\n", dsh_cdpath_hits[it].path);
+                return 0;
+            }
+            // Gone since: forget it and search again
+            free(dsh_cdpath_hits[it].name);
+            free(dsh_cdpath_hits[it].path);
+            dsh_cdpath_hits[it] = dsh_cdpath_hits[--dsh_cdpath_len];
+            break;
+        }
+    }
+
+    for (entry = cdpath; entry; entry = strchr(entry, ':') ? strchr(entry, ':') + 1 : NULL) {
+        size_t len = strcspn(entry, ":");
+
+        // An empty entry means the current directory, which cd already tried
+        if (len == 0 || len + strlen(name) + 2 > sizeof(path)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%.*s/%s", (int) len, entry, name);
+        if (dsh_chdir(path) == 0) {
+            dsh_cdpath_hits = dsh_xrealloc(dsh_cdpath_hits, (dsh_cdpath_len + 1) * sizeof(*dsh_cdpath_hits));
+            dsh_cdpath_hits[dsh_cdpath_len].name = dsh_xstrdup(name);
+            dsh_cdpath_hits[dsh_cdpath_len].path = dsh_xstrdup(path);
+            dsh_cdpath_len++;
+            printf("%s\n", path);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * The search cd does: the words as a directory, then $CDPATH, then
+ * the frecency database. Returns 0 after a successful change.
+ */
+static int dsh_cd_search(char **words) {
+    int nwords = 0;
+    int err;
+
+    while (words[nwords] != NULL && nwords < DSH_DIRS_MAX_WORDS) {
+        nwords++;
+    }
+
+    if (nwords == 1) {
+        if (dsh_chdir(words[0]) == 0) {
+            dsh_dirs_visit();
+            return 0;
+        }
+        err = errno;
+        if (err == ENOENT && (dsh_cdpath_try(words[0]) == 0 || dsh_dirs_jump(words, 1) == 0)) {
+            dsh_dirs_visit();
+            return 0;
+        }
+        fprintf(stderr, "dsh: cd: %s: %s\n", words[0], strerror(err));
+        return -1;
+    }
+
+    if (dsh_dirs_jump(words, nwords) == 0) {
+        dsh_dirs_visit();
+        return 0;
+    }
+    fprintf(stderr, "dsh: cd: no directory matches");
+    for (err = 0; err < nwords; err++) {
+        fprintf(stderr, " %s", words[err]);
+    }
+    fprintf(stderr, "\n");
+    return -1;
+}
+
+int dsh_cd(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "dsh: expected argument to \"cd\"\n");
+        dsh_status = 1;
+        return 1;
+    }
+    if (strcmp(args[1], "-") == 0 && args[2] == NULL) {
+        char *target;
+
+        if (dsh_oldpwd_path == NULL) {
+            fprintf(stderr, "dsh: cd: OLDPWD not set\n");
+            dsh_status = 1;
+            return 1;
+        }
+        // dsh_chdir() frees the old OLDPWD string
+        target = dsh_xstrdup(dsh_oldpwd_path);
+        if (dsh_chdir(target) != 0) {
+            fprintf(stderr, "dsh: cd: %s: %s\n", target, strerror(errno));
+            dsh_status = 1;
+        } else {
+            printf("%s\n", dsh_pwd());
+            dsh_dirs_visit();
+        }
+        free(target);
+        return 1;
+    }
+    if (dsh_cd_search(args + 1) != 0) {
+        dsh_status = 1;
+    }
+    return 1;
+}
+
+int dsh_dirs(char **args) {
+    const char *cwd = dsh_pwd();
+    size_t it;
+
+    (void) args;
+    printf("%s", cwd ? cwd : "?");
+    for (it = dsh_dirstack_len; it > 0; it--) {
+        printf(" %s", dsh_dirstack[it - 1]);
+    }
+    printf("\n");
+    return 1;
+}
+
+/*
+ * pushd DIR: cd like `cd DIR`, remembering where we were.
+ * pushd: swap the current directory with the top of the stack.
+ */
+int dsh_pushd(char **args) {
+    char *cwd;
+
+    if (dsh_pwd() == NULL) {
+        perror("dsh: pushd");
+        dsh_status = 1;
+        return 1;
+    }
+    // A successful cd replaces the string dsh_pwd() returned
+    cwd = dsh_xstrdup(dsh_pwd());
+
+    if (args[1] == NULL) {
+        char *top;
+
+        if (dsh_dirstack_len == 0) {
+            fprintf(stderr, "dsh: pushd: no other directory\n");
+            dsh_status = 1;
+            return 1;
+        }
+        top = dsh_dirstack[dsh_dirstack_len - 1];
+        if (dsh_chdir(top) != 0) {
+            fprintf(stderr, "dsh: pushd: %s: %s\n", top, strerror(errno));
+            free(cwd);
+            dsh_status = 1;
+            return 1;
+        }
+        dsh_dirs_visit();
+        free(top);
+        dsh_dirstack[dsh_dirstack_len - 1] = cwd;
+    } else {
+        if (dsh_cd_search(args + 1) != 0) {
+            free(cwd);
+            dsh_status = 1;
+            return 1;
+        }
+        if (dsh_dirstack_len >= dsh_dirstack_cap) {
+            dsh_dirstack_cap = dsh_dirstack_cap ? dsh_dirstack_cap * 2 : DSH_DIRS_BUFSIZE;
+            dsh_dirstack = dsh_xrealloc(dsh_dirstack, dsh_dirstack_cap * sizeof(char *));
+        }
+        dsh_dirstack[dsh_dirstack_len++] = cwd;
+    }
+    return dsh_dirs(args);
+}
+
+int dsh_popd(char **args) {
+    char *top;
+
+    if (dsh_dirstack_len == 0) {
+        fprintf(stderr, "dsh: popd: directory stack empty\n");
+        dsh_status = 1;
+        return 1;
+    }
+    top = dsh_dirstack[dsh_dirstack_len - 1];
+    if (dsh_chdir(top) != 0) {
+        fprintf(stderr, "dsh: popd: %s: %s\n", top, strerror(errno));
+        dsh_status = 1;
+        return 1;
+    }
+    dsh_dirs_visit();
+    free(top);
+    dsh_dirstack_len--;
+    return dsh_dirs(args);
+}
@@ -0,0 +1,273 @@
+#ifndef DSH_H
+#define DSH_H
+
+#include <sys/types.h>  // for pid_t
+#include <signal.h>     // for sig_atomic_t
+#include <spawn.h>      // for posix_spawn_file_actions_t
+#include <stdio.h>      // for FILE
+
+/*
+ * Shared declarations for the pieces of dhruva shell that live in
+ * separate files. main.c owns the loop, the tokenizer and the builtin
+ * table; the bigger builtins get a file of their own and are declared here.
+ */
+
+// alloc.c: realloc(), calloc() and strdup() that exit on failure
+void *dsh_xrealloc(void *ptr, size_t size);
+void *dsh_xcalloc(size_t count, size_t size);
+char *dsh_xstrdup(const char *s);
+
+// io.c: buffered reads, through io_uring when built with DSH_IO_URING
+#define DSH_IO_BUFSIZE 65536  // one read; read-ahead uses two of these
+
+struct dsh_io_source {
+    int fd;
+    char *buf;              // 2 * DSH_IO_BUFSIZE, allocated on the first fill
+    size_t pos;             // unread bytes are buf[pos .. len)
+    size_t len;
+    int eof;
+    int half;               // which half of buf pos is in
+    int readahead;          // reads go through the ring
+    off_t offset;           // file offset of the next chunk
+    int queued[2];          // a ring read into this half is outstanding...
+    int done[2];            // ... and has completed with results[]
+    ssize_t results[2];
+    off_t offsets[2];
+};
+
+void dsh_io_open(struct dsh_io_source *src, int fd);
+void dsh_io_close(struct dsh_io_source *src);
+ssize_t dsh_io_fill(struct dsh_io_source *src);
+int dsh_io_copy(struct dsh_io_source *src, int fd);
+ssize_t dsh_io_write_all(int fd, const void *buf, size_t size);
+
+// text.c: cat, head, tail and wc as in-shell streaming operators
+struct dsh_stream {
+    // Takes len bytes; returns 0 for more, 1 once it wants no more input, -1 on error
+    int (*write)(struct dsh_stream *stream, const char *buf, size_t len);
+    // End of input: finishes, flushes into next and frees the stream; -1 on error
+    int (*close)(struct dsh_stream *stream);
+    struct dsh_stream *next;  // where the output goes
+    size_t unused;            // after write() returns 1: how much of that buffer it left
+};
+
+struct dsh_stream *dsh_stream_fd(int fd);
+int dsh_stream_feed(struct dsh_stream *stream, int fd, const char *name);
+struct dsh_stream *dsh_cat_stream(struct dsh_stream *next);
+struct dsh_stream *dsh_head_stream(long lines, struct dsh_stream *next);
+struct dsh_stream *dsh_tail_stream(long lines, int from_start, struct dsh_stream *next);
+struct dsh_stream *dsh_wc_stream(int which, struct dsh_stream *next);
+size_t dsh_text_count(const char *buf, size_t len, char c);
+int dsh_cat(char **args);
+int dsh_head(char **args);
+int dsh_tail(char **args);
+int dsh_wc(char **args);
+struct dsh_stream *dsh_text_stage(char **args, char ***operands, struct dsh_stream *next);
+
+// grep.c: grep with a literal / lazy-DFA matcher, also a streaming operator
+struct dsh_grep;
+struct dsh_grep *dsh_grep_compile(char **args, char ***operands);
+void dsh_grep_free(struct dsh_grep *grep);
+struct dsh_stream *dsh_grep_stream(struct dsh_grep *grep, const char *label, struct dsh_stream *next);
+int dsh_grep(char **args);
+struct dsh_stream *dsh_grep_stage(char **args, char ***operands, struct dsh_stream *next);
+
+// walk.c: a parallel find on a work-stealing pool of threads
+int dsh_walk(char **args);
+
+// sort.c: sort and uniq, and `sort | uniq -c` as one hash aggregate
+struct dsh_stream *dsh_sort_count_stream(struct dsh_stream *next);
+int dsh_sort(char **args);
+int dsh_uniq(char **args);
+struct dsh_stream *dsh_sort_stage(char **args, char ***operands, struct dsh_stream *next);
+struct dsh_stream *dsh_sort_count_stage(char **sort, char **uniq, char ***operands, struct dsh_stream *next);
+
+// pipeline.c: `a | b | c`, in-process when every stage is a stream builtin
+int dsh_pipeline(char **args);
+
+// subshell.c: `a ; b` lists, `( ... )` subshells run in the shell itself,
+// `{ ... }` groups and functions
+struct dsh_func;
+
+int dsh_list(char **args);
+int dsh_list_check(char **args);  // 0, or -1 having said what is wrong
+int dsh_func_call(struct dsh_func *func, char **args);
+
+// vars.c: shell variables and functions, in scopes kept as undo logs
+enum {
+    DSH_SCOPE_FUNCTION,
+    DSH_SCOPE_SUBSHELL
+};
+
+struct dsh_func {
+    size_t refs;   // its name, saved definitions and calls running it
+    int len;
+    char **words;  // the body, NULL-terminated
+};
+
+const char *dsh_var_get(const char *name);
+void dsh_var_set(const char *name, const char *value);
+void dsh_var_export(const char *name, const char *value);
+const char *dsh_var_lookup(const char *name);  // the variable, or else the environment
+int dsh_var_assign(char **args);
+int dsh_local(char **args);
+int dsh_unset(char **args);
+int dsh_export(char **args);
+int dsh_shift(char **args);
+int dsh_func_define(const char *name, char **words, int len);
+struct dsh_func *dsh_func_find(const char *name);
+struct dsh_func *dsh_func_of(int id);
+void dsh_func_release(struct dsh_func *func);
+int dsh_scope_push(int kind, char **argv);
+void dsh_scope_pop(void);
+char **dsh_scope_args(int *argc);
+
+// intern.c: small, stable ids for names; the builtins' are their index in builtin_str
+int dsh_intern(const char *name);
+int dsh_intern_find(const char *name);
+const char *dsh_intern_name(int id);
+
+// ring.c: a stream whose next runs on a thread of its own, joined by a lock-free ring
+struct dsh_stream *dsh_ring_stream(struct dsh_stream *next);
+
+// options.c: `set -o`, the shell's options
+enum {
+    DSH_OPT_PIPETHREADS,  // fused pipeline stages on threads of their own (-1: if there are CPUs to spare)
+    DSH_OPT_PIPESIZE,     // bytes in each pipe between programs (-1: learned per pipeline, 0: the kernel's)
+    DSH_NUM_OPTIONS
+};
+
+extern long dsh_options[DSH_NUM_OPTIONS];
+int dsh_set(char **args);
+
+// Core (main.c)
+extern struct dsh_io_source dsh_input;  // where commands come from; fd 0 unless a script was given
+char *dsh_read_line(void);
+char **dsh_split_line(char *line);
+extern char *builtin_str[];
+int dsh_num_builtins(void);
+int dsh_execute(char **args);
+int dsh_dispatch(char **args);
+int dsh_is_builtin(const char *name);
+int dsh_launch(char **args);
+extern int dsh_status;  // exit status of the last command, for $?
+pid_t dsh_spawn(char **args);
+pid_t dsh_spawn_with(char **args, const posix_spawn_file_actions_t *actions);
+
+// batch.c: `dsh --batch`, many independent commands at once
+int dsh_batch_main(int argc, char **argv);
+
+// dirs.c: cd with $CDPATH and frecency jumps, the directory stack, and
+// the logical current directory
+const char *dsh_pwd(void);
+int dsh_chdir(const char *path);
+int dsh_pwd_builtin(char **args);
+int dsh_cd(char **args);
+int dsh_pushd(char **args);
+int dsh_popd(char **args);
+int dsh_dirs(char **args);
+void dsh_dirs_save(void);
+
+// What a subshell puts back when it ends: saved on its first change of directory
+struct dsh_dirs_frame {
+    struct dsh_dirs_frame *outer;
+    int saved;                 // the fields below hold the state from before that change
+    int cwd;                   // "." then, or -1 if it could not be opened
+    char *pwd, *oldpwd;        // the logical paths
+    char *env_pwd, *env_oldpwd;
+    char **stack;              // a copy of pushd's stack
+    size_t stack_len;
+};
+
+void dsh_dirs_enter(struct dsh_dirs_frame *frame);
+void dsh_dirs_leave(struct dsh_dirs_frame *frame);
+
+// dag.c: make-like task graph runner
+int dsh_dag(char **args);
+
+// memo.c: cached replay of deterministic commands
+int dsh_memo(char **args);
+
+// stats.c: always-on counters behind the dshstat builtin
+enum {
+    DSH_PHASE_READ,
+    DSH_PHASE_PARSE,
+    DSH_PHASE_EXECUTE,
+    DSH_NUM_PHASES
+};
+
+#define DSH_HIST_BUCKETS 64  // one per power of two nanoseconds
+
+struct dsh_hist {
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long buckets[DSH_HIST_BUCKETS];
+};
+
+struct dsh_stats {
+    unsigned long long commands;        // non-empty commands dispatched
+    unsigned long long builtins;        // ... of which were builtins
+    unsigned long long forks;           // children started
+    unsigned long long fork_failures;   // EAGAIN/ENOMEM from posix_spawnp
+    unsigned long long exec_not_found;  // ENOENT from posix_spawnp
+    unsigned long long exec_failures;   // any other exec error
+    unsigned long long lines_read;
+    unsigned long long bytes_read;
+    unsigned long long allocations;     // malloc()s in the read/parse path
+    unsigned long long read_growths;    // realloc()s in dsh_read_line
+    unsigned long long io_reads;        // chunks read by io.c
+    unsigned long long io_enters;       // io_uring_enter() calls
+    unsigned long long split_growths;   // realloc()s in dsh_split_line
+    unsigned long long memo_hits;
+    unsigned long long memo_misses;
+    unsigned long long pipelines;       // `a | b` commands
+    unsigned long long pipelines_fused; // ... run as one chain of streams in the shell
+    unsigned long long subshells;       // `( ... )` run in the shell, without a fork
+    unsigned long long globs;           // patterns that matched file names
+    struct dsh_hist phases[DSH_NUM_PHASES];
+};
+
+extern struct dsh_stats dsh_stats;  // main thread only: the increments are not atomic
+
+unsigned long long dsh_now_ns(void);
+void dsh_stats_record(int phase, unsigned long long ns);
+int dsh_dshstat(char **args);
+
+// timing.c: per-command wall times and the clock variables
+void dsh_timing_init(void);
+void dsh_timing_record(const char *name, unsigned long long ns);
+const char *dsh_timing_var(const char *name, char *buf, size_t size);
+int dsh_timings(char **args);
+int dsh_time(char **args);
+
+// expand.c: $VARIABLE expansion
+struct dsh_expand_mark {
+    void *chunk;
+    size_t used;
+};
+
+char **dsh_expand(char **args);
+void dsh_expand_mark(struct dsh_expand_mark *mark);
+void dsh_expand_release(const struct dsh_expand_mark *mark);
+void *dsh_expand_alloc(size_t size);
+const char *dsh_expand_lookup(const char *name, char *buf, size_t size);
+
+// profile.c: `dsh --profile FILE` sampling profiler
+enum {
+    DSH_PROF_READ,
+    DSH_PROF_PARSE,
+    DSH_PROF_BUILTIN,
+    DSH_PROF_SPAWN,
+    DSH_PROF_WAIT,
+    DSH_PROF_NUM_PHASES
+};
+
+extern volatile sig_atomic_t dsh_prof_phase;  // what the shell is doing right now
+extern int dsh_prof_active;
+
+int dsh_prof_start(const char *path);
+void dsh_prof_set_script(const char *name);
+void dsh_prof_enter(long line, const char *cmd);
+void dsh_prof_finish(void);
+
+#endif
@@ -0,0 +1,449 @@
+#include <glob.h>    // for glob(), globfree()
+#include <stdlib.h>  // for malloc(), free(), getenv(), strtol()
+#include <stdio.h>   // for fprintf(), snprintf()
+#include <string.h>  // for strchr(), strspn(), strlen(), strcmp(), memcpy(), memchr()
+
+#include "dsh.h"
+
+/*
+ * Word expansion.
+ *
+ * $NAME and ${NAME} anywhere in a word are replaced by the variable's
+ * value: one of the clock variables from timing.c, a shell variable
+ * (vars.c), or else the environment. $1 ... $9 and ${10} ... are the
+ * positional parameters, $# their count, $0 the shell and $? the exit
+ * status of the last command (dsh_status); "$@" (or "$*") as a whole
+ * word becomes one word per parameter, and inside a word they are
+ * joined with spaces. An unset variable expands to nothing, and a word
+ * that expands to nothing at all is dropped, as in other shells.
+ *
+ * Then a word with * ? or [ in it is a pattern: it becomes the file
+ * names it matches, sorted, or stays as it is when nothing matches
+ * (glob(3)). The NAME=VALUE words an assignment starts with are not
+ * patterns. dsh has no quotes, so there is no field splitting either:
+ * a value with spaces in it stays one word.
+ *
+ * A backslash makes the character after it literal, so `grep a\*b`
+ * looks for "a*b" whatever files there are, and `\$HOME` is not
+ * expanded; the backslash itself is dropped, and `\\` is one. It
+ * quotes nothing else: spaces and | ; ( ) still split words. The
+ * backslashes of a value are not escapes to take out, as in other
+ * shells, though glob(3) reads them as escapes in a pattern.
+ *
+ * A command is expanded just before it runs (dsh_execute), so
+ * `x=1; echo $x` sees the assignment. The words of a ( ... ) or
+ * { ... } inside it are left alone: they are expanded when their own
+ * commands run.
+ *
+ * Expanded words and arrays are carved out of an arena used like a
+ * stack. dsh_execute marks it before expanding a command and releases
+ * it back to the mark when the command is done, so a function's
+ * commands expand on top of the words of the call, which stay put for
+ * as long as it runs, and a command costs no malloc() per word.
+ *
+ * Words are not copied unless they change: a word with none of $ * ? [ \
+ * stays a pointer into the line it was read from, however long, and one
+ * that expands is written once, straight into the arena. When no word
+ * of a command has any, its array of words is used as it is, and the
+ * tokenizer's table lets dsh_execute find that out without calling
+ * here at all.
+ */
+
+#define DSH_EXPAND_CHUNK 4096   // arena chunk size, bigger words get their own
+#define DSH_EXPAND_NAME_MAX 256
+
+struct dsh_expand_chunk {
+    struct dsh_expand_chunk *prev;
+    size_t used;
+    size_t cap;
+    char data[];
+};
+
+static struct dsh_expand_chunk *dsh_expand_top;    // the chunk being carved up
+static struct dsh_expand_chunk *dsh_expand_spare;  // one given back, kept for the next command
+
+void dsh_expand_mark(struct dsh_expand_mark *mark) {
+    mark->chunk = dsh_expand_top;
+    mark->used = dsh_expand_top ? dsh_expand_top->used : 0;
+}
+
+// Gives back everything allocated since mark
+void dsh_expand_release(const struct dsh_expand_mark *mark) {
+    while (dsh_expand_top != mark->chunk) {
+        struct dsh_expand_chunk *chunk = dsh_expand_top;
+
+        dsh_expand_top = chunk->prev;
+        if (dsh_expand_spare == NULL && chunk->cap == DSH_EXPAND_CHUNK) {
+            dsh_expand_spare = chunk;
+        } else {
+            free(chunk);
+        }
+    }
+    if (dsh_expand_top) {
+        dsh_expand_top->used = mark->used;
+    }
+}
+
+// A chunk of at least size bytes on top of the arena
+static struct dsh_expand_chunk *dsh_expand_push(size_t size) {
+    struct dsh_expand_chunk *chunk;
+    size_t cap = size > DSH_EXPAND_CHUNK ? size : DSH_EXPAND_CHUNK;
+
+    cap = (cap + sizeof(char *) - 1) & ~(sizeof(char *) - 1);
+    if (dsh_expand_spare && cap == DSH_EXPAND_CHUNK) {
+        chunk = dsh_expand_spare;
+        dsh_expand_spare = NULL;
+    } else {
+        chunk = malloc(sizeof(*chunk) + cap);
+        if (!chunk) {
+            fprintf(stderr, "dsh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        chunk->cap = cap;
+        dsh_stats.allocations++;
+    }
+    chunk->used = 0;
+    chunk->prev = dsh_expand_top;
+    dsh_expand_top = chunk;
+    return chunk;
+}
+
+// Pointer-aligned, so arrays of words can come from here too
+void *dsh_expand_alloc(size_t size) {
+    struct dsh_expand_chunk *chunk = dsh_expand_top;
+
+    size = (size + sizeof(char *) - 1) & ~(sizeof(char *) - 1);
+    if (!chunk || chunk->cap - chunk->used < size) {
+        chunk = dsh_expand_push(size);
+    }
+    chunk->used += size;
+    return chunk->data + chunk->used - size;
+}
+
+/*
+ * The word being expanded is put together in place, in the free space
+ * at the top of the arena, and only taken (dsh_expand_take) once it is
+ * whole: no scratch buffer, and one copy of every byte. A word that
+ * outgrows the chunk moves to a new one.
+ */
+static void dsh_expand_append(size_t *len, const char *s, size_t n) {
+    struct dsh_expand_chunk *chunk = dsh_expand_top;
+
+    if (!chunk || chunk->cap - chunk->used < *len + n + 1) {
+        struct dsh_expand_chunk *old = chunk;
+
+        chunk = dsh_expand_push((*len + n + 1) * 2);
+        if (*len > 0) {
+            memcpy(chunk->data, old->data + old->used, *len);
+        }
+    }
+    memcpy(chunk->data + chunk->used + *len, s, n);
+    *len += n;
+}
+
+static char *dsh_expand_take(size_t len) {
+    struct dsh_expand_chunk *chunk = dsh_expand_top;
+    char *word = chunk->data + chunk->used;
+
+    word[len] = '\0';
+    chunk->used += (len + sizeof(char *)) & ~(sizeof(char *) - 1);
+    return word;
+}
+
+const char *dsh_expand_lookup(const char *name, char *buf, size_t size) {
+    const char *value = dsh_timing_var(name, buf, size);
+
+    if (value == NULL) {
+        value = dsh_var_get(name);
+    }
+    if (value == NULL) {
+        value = getenv(name);
+    }
+    return value;
+}
+
+static int dsh_expand_name_char(char c, int first) {
+    return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (!first && c >= '0' && c <= '9');
+}
+
+/*
+ * Appends a variable's value to a word with escapes of its own, which
+ * are still to be taken out: its backslashes are doubled to survive that.
+ */
+static void dsh_expand_append_escaped(size_t *len, const char *value, size_t n) {
+    const char *slash;
+
+    while ((slash = memchr(value, '\\', n)) != NULL) {
+        dsh_expand_append(len, value, slash - value + 1);
+        dsh_expand_append(len, "\\", 1);
+        n -= slash - value + 1;
+        value = slash + 1;
+    }
+    dsh_expand_append(len, value, n);
+}
+
+// Appends what name (n bytes, NUL-terminated) stands for
+static void dsh_expand_value(size_t *len, const char *name, size_t n, int escaping) {
+    char value_buf[64];
+    const char *value = NULL;
+    char **params;
+    int argc, it;
+
+    params = dsh_scope_args(&argc);
+    if (name[0] >= '0' && name[0] <= '9' && strspn(name, "0123456789") == n) {
+        long index = strtol(name, NULL, 10);
+        value = index == 0 ? "dsh" : index <= argc ? params[index - 1] : NULL;
+    } else if (n == 1 && name[0] == '#') {
+        snprintf(value_buf, sizeof(value_buf), "%d", argc);
+        value = value_buf;
+    } else if (n == 1 && name[0] == '?') {
+        snprintf(value_buf, sizeof(value_buf), "%d", dsh_status);
+        value = value_buf;
+    } else if (n == 1 && (name[0] == '@' || name[0] == '*')) {
+        for (it = 0; it < argc; it++) {
+            if (it > 0) {
+                dsh_expand_append(len, " ", 1);
+            }
+            if (escaping) {
+                dsh_expand_append_escaped(len, params[it], strlen(params[it]));
+            } else {
+                dsh_expand_append(len, params[it], strlen(params[it]));
+            }
+        }
+    } else {
+        value = dsh_expand_lookup(name, value_buf, sizeof(value_buf));
+    }
+    if (value && escaping) {
+        dsh_expand_append_escaped(len, value, strlen(value));
+    } else if (value) {
+        dsh_expand_append(len, value, strlen(value));
+    }
+}
+
+/*
+ * Expands one word, which has a '$' in it. Returns NULL when it
+ * expanded to nothing, or else the expanded word in the arena. Escapes
+ * are copied as they are, for dsh_expand() to take out; escaping says
+ * there are any.
+ */
+static char *dsh_expand_word(const char *word, int escaping) {
+    char name[DSH_EXPAND_NAME_MAX];
+    const char *p = word;
+    size_t len = 0;
+
+    while (*p) {
+        const char *dollar = p, *start, *end;
+        size_t n;
+
+        if (!escaping) {
+            while (*dollar && *dollar != '$') {
+                dollar++;
+            }
+        } else {
+            // A '$' after a backslash is not one
+            while (*dollar && *dollar != '$') {
+                dollar += dollar[0] == '\\' && dollar[1] != '\0' ? 2 : 1;
+            }
+        }
+        if (dollar > p) {
+            dsh_expand_append(&len, p, dollar - p);
+        }
+        if (*dollar == '\0') {
+            break;
+        }
+
+        start = dollar + 1;
+        if (*start == '{') {
+            start++;
+            end = strchr(start, '}');
+            if (end == NULL) {
+                // No closing brace: keep the rest as it was
+                dsh_expand_append(&len, dollar, strlen(dollar));
+                break;
+            }
+            p = end + 1;
+        } else {
+            end = start;
+            if ((*end >= '0' && *end <= '9') || *end == '#' || *end == '?' || *end == '@' || *end == '*') {
+                end++;  // $1, $#, $?, $@: one character
+            } else {
+                while (dsh_expand_name_char(*end, end == start)) {
+                    end++;
+                }
+            }
+            p = end;
+        }
+
+        n = end - start;
+        if (n == 0 || n >= sizeof(name)) {
+            // "$" on its own, "${}": not a variable, keep it
+            dsh_expand_append(&len, dollar, p - dollar);
+            continue;
+        }
+        memcpy(name, start, n);
+        name[n] = '\0';
+        dsh_expand_value(&len, name, n, escaping);
+    }
+    return len == 0 ? NULL : dsh_expand_take(len);
+}
+
+// "$@" or "$*" as a whole word: one word per positional parameter
+static int dsh_expand_is_all(const char *word) {
+    return strcmp(word, "$@") == 0 || strcmp(word, "${@}") == 0 ||
+           strcmp(word, "$*") == 0 || strcmp(word, "${*}") == 0;
+}
+
+enum {
+    DSH_EXPAND_VARS = 1,   // a '$'
+    DSH_EXPAND_GLOB = 2,   // a * ? or [
+    DSH_EXPAND_ESCAPE = 4  // a '\'
+};
+
+static const unsigned char dsh_expand_class[256] = {
+    ['$'] = DSH_EXPAND_VARS,
+    ['*'] = DSH_EXPAND_GLOB, ['?'] = DSH_EXPAND_GLOB, ['['] = DSH_EXPAND_GLOB,
+    ['\\'] = DSH_EXPAND_ESCAPE
+};
+
+// What word needs; words are short, and one loop beats calls to strchr()
+static int dsh_expand_needs(const char *word) {
+    int needs = 0;
+
+    for (; *word; word++) {
+        needs |= dsh_expand_class[(unsigned char) *word];
+    }
+    return needs;
+}
+
+// dsh_expand_needs() for a word with a backslash: what each one escapes needs nothing
+static int dsh_expand_needs_escaped(const char *word) {
+    int needs = 0;
+
+    for (; *word; word++) {
+        needs |= dsh_expand_class[(unsigned char) *word];
+        word += *word == '\\' && word[1] != '\0';
+    }
+    return needs;
+}
+
+// word without its escapes, in the arena: the line it points into may be a function's body
+static char *dsh_expand_unescape(const char *word) {
+    char *out = dsh_expand_alloc(strlen(word) + 1), *p = out;
+
+    for (; *word; word++) {
+        if (*word == '\\' && word[1] != '\0') {
+            word++;
+        }
+        *p++ = *word;
+    }
+    *p = '\0';
+    return out;
+}
+
+// NAME=VALUE
+static int dsh_expand_is_assignment(const char *word) {
+    const char *p = word;
+
+    while (dsh_expand_name_char(*p, p == word)) {
+        p++;
+    }
+    return p > word && *p == '=';
+}
+
+// Makes out, of *size words with the first to filled in, more words longer
+static char **dsh_expand_grow(char **out, int to, int *size, int more) {
+    char **bigger;
+
+    *size += more;
+    bigger = dsh_expand_alloc(*size * sizeof(char *));
+    memcpy(bigger, out, to * sizeof(char *));
+    return bigger;
+}
+
+/*
+ * Puts the file names pattern matches into out after the first *to
+ * words, or the pattern itself when none do. out has room for the one
+ * word; for more, it moves, and the new one is returned.
+ */
+static char **dsh_expand_glob(char **out, int *to, int *size, char *pattern, int escaping) {
+    glob_t matches;
+    size_t it;
+
+    if (glob(pattern, 0, NULL, &matches) != 0) {
+        // No match (or no memory, or nothing readable): the word is left as it is, escapes taken out
+        out[(*to)++] = escaping ? dsh_expand_unescape(pattern) : pattern;
+        return out;
+    }
+    dsh_stats.globs++;
+    if (matches.gl_pathc > 1) {
+        out = dsh_expand_grow(out, *to, size, matches.gl_pathc - 1);
+    }
+    for (it = 0; it < matches.gl_pathc; it++) {
+        size_t len = strlen(matches.gl_pathv[it]) + 1;
+        out[(*to)++] = memcpy(dsh_expand_alloc(len), matches.gl_pathv[it], len);
+    }
+    globfree(&matches);
+    return out;
+}
+
+/*
+ * Expands the words of a command, dropping the empty ones. Returns args
+ * itself when there is nothing to expand, or else a new array in the
+ * arena, valid until it is released. Words with nothing to expand go
+ * into the array as they are, still pointing into the line.
+ */
+char **dsh_expand(char **args) {
+    char **out, **params;
+    int argc, from, to = 0, depth = 0, size, assigning = 1;
+
+    for (from = 0; args[from] != NULL; from++) {
+        if (dsh_expand_needs(args[from])) {
+            break;
+        }
+    }
+    if (args[from] == NULL) {
+        return args;
+    }
+
+    // One word each, one per parameter for "$@", and the NULL; patterns grow it as they match
+    params = dsh_scope_args(&argc);
+    for (size = 1, from = 0; args[from] != NULL; from++) {
+        size += args[from][0] == '$' && dsh_expand_is_all(args[from]) ? argc : 1;
+    }
+    out = dsh_expand_alloc(size * sizeof(char *));
+    for (from = 0; args[from] != NULL; from++) {
+        char *word = args[from];
+        int needs;
+
+        assigning = assigning && dsh_expand_is_assignment(word);
+        if (word[0] != '\0' && word[1] == '\0' && strchr("({)}", word[0])) {
+            depth += word[0] == '(' || word[0] == '{' ? 1 : -1;
+            out[to++] = word;
+            continue;
+        }
+        needs = depth > 0 ? 0 : dsh_expand_needs(word);
+        if (needs & DSH_EXPAND_ESCAPE) {
+            needs = dsh_expand_needs_escaped(word);
+        }
+        if (needs & DSH_EXPAND_VARS) {
+            if (word[0] == '$' && dsh_expand_is_all(word)) {
+                memcpy(out + to, params, argc * sizeof(char *));
+                to += argc;
+                continue;
+            }
+            if ((word = dsh_expand_word(word, needs & DSH_EXPAND_ESCAPE)) == NULL) {
+                continue;
+            }
+            // A value may bring a pattern with it, but not escapes to take out
+            needs = needs & DSH_EXPAND_ESCAPE ? dsh_expand_needs_escaped(word) : dsh_expand_needs(word) & DSH_EXPAND_GLOB;
+        }
+        if ((needs & DSH_EXPAND_GLOB) && !assigning) {
+            // glob(3) reads the escapes too
+            out = dsh_expand_glob(out, &to, &size, word, needs & DSH_EXPAND_ESCAPE);
+        } else {
+            out[to++] = needs & DSH_EXPAND_ESCAPE ? dsh_expand_unescape(word) : word;
+        }
+    }
+    out[to] = NULL;
+    return out;
+}
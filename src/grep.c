@@ -0,0 +1,1177 @@
+#define _GNU_SOURCE            // for memmem(), memrchr()
+#include <sys/types.h>         // for ssize_t
+#include <fcntl.h>             // for open()
+#include <unistd.h>            // for close()
+#include <errno.h>             // for errno
+#include <ctype.h>             // for tolower(), toupper(), isalpha(), ...
+#include <stdlib.h>            // for free()
+#include <stdio.h>             // for fprintf(), snprintf()
+#include <string.h>            // for memchr(), memmem(), memrchr(), strcmp()
+
+#include "dsh.h"
+
+/*
+ * grep, run inside the shell.
+ *
+ *     grep [-FEGivcnlqx] [-e PATTERN]... [PATTERN] [FILE...]
+ *
+ * Matching works on whole buffers, not line by line: the matcher finds
+ * the next matching line in what it was given, and everything between
+ * two matches is skipped without being looked at again (or, with -v,
+ * passed on as one block). How the next match is found depends on the
+ * pattern:
+ *
+ *     one literal          memmem(), which glibc vectorizes
+ *     several literals     the earliest next hit of each, every hit
+ *                          remembered until it is passed, so each
+ *                          literal is scanned for once per buffer
+ *     a regular expression the longest literal every match must
+ *                          contain (if any) finds candidate lines,
+ *                          and a lazily built DFA checks them
+ *
+ * The regex subset is POSIX basic (default) or extended (-E) syntax
+ * without back-references or intervals: . [] [^] [:class:] * + ? | ()
+ * ^ $, with \+ \? \| \( \) in basic syntax as in GNU grep. It is
+ * compiled to a Thompson NFA; DFA states (sets of NFA states) and their
+ * transitions are made the first time a line needs them and cached.
+ *
+ * Anything else (other options, \{n,m\}, \1, ...) runs the external
+ * grep, which also takes care of reporting bad patterns.
+ */
+
+#define DSH_GREP_MAX_PATTERNS 64
+#define DSH_GREP_MAX_STATES 1024   // cached DFA states before the cache is dropped
+#define DSH_GREP_EOL 256           // the pseudo-byte fed at the end of a line
+#define DSH_GREP_ROW (DSH_GREP_EOL + 1)  // transitions per DFA state
+#define DSH_GREP_DENSE 16          // candidates in a row that skip little before the DFA runs alone
+#define DSH_GREP_SKIP 256          // what a candidate has to skip not to count as one of those
+
+/* ---- regular expressions ---- */
+
+enum {
+    DSH_RE_EMPTY,
+    DSH_RE_SET,     // one byte out of set
+    DSH_RE_BOL,     // ^
+    DSH_RE_EOL,     // $
+    DSH_RE_CAT,
+    DSH_RE_ALT,
+    DSH_RE_STAR,
+    DSH_RE_PLUS,
+    DSH_RE_QUEST
+};
+
+struct dsh_re_node {
+    int type;
+    int left, right;
+    unsigned char set[32];  // DSH_RE_SET: bit c set if byte c matches
+};
+
+enum {
+    DSH_RE_OP_SET,
+    DSH_RE_OP_SPLIT,  // continue at both x and y
+    DSH_RE_OP_JMP,
+    DSH_RE_OP_BOL,
+    DSH_RE_OP_EOL,
+    DSH_RE_OP_MATCH
+};
+
+struct dsh_re_inst {
+    int op;
+    int x, y;
+    const unsigned char *set;
+};
+
+struct dsh_re_state {
+    int *pcs;       // sorted NFA program counters: SET, EOL and MATCH only
+    int npcs;
+    int match;      // MATCH is among them
+};
+
+struct dsh_re {
+    struct dsh_re_node *nodes;
+    int nnodes, capnodes;
+    struct dsh_re_inst *prog;
+    int nprog;
+    struct dsh_re_state *states;
+    int nstates, capstates;
+    /*
+     * DSH_GREP_ROW transitions per state, each the row of the next state
+     * (state * DSH_GREP_ROW) << 2 | 2 if it is dead | 1 if it matches;
+     * -1 until it is made. Rows, not state numbers, so that following
+     * one costs no multiply.
+     */
+    int *table;
+    int start;      // the state at the start of a line
+    // scratch for building states
+    int *mark;
+    int *list;
+    int gen;
+};
+
+struct dsh_re_parser {
+    struct dsh_re *re;
+    const char *p;
+    int extended;
+    int icase;
+    int error;
+};
+
+static int dsh_re_node(struct dsh_re *re, int type, int left, int right) {
+    struct dsh_re_node *node;
+
+    if (re->nnodes == re->capnodes) {
+        re->capnodes = re->capnodes ? re->capnodes * 2 : 64;
+        re->nodes = dsh_xrealloc(re->nodes, re->capnodes * sizeof(*re->nodes));
+    }
+    node = &re->nodes[re->nnodes];
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->left = left;
+    node->right = right;
+    return re->nnodes++;
+}
+
+static void dsh_re_set_add(struct dsh_re_parser *ps, unsigned char *set, int c) {
+    set[c >> 3] |= 1 << (c & 7);
+    if (ps->icase && isalpha(c)) {
+        int other = islower(c) ? toupper(c) : tolower(c);
+        set[other >> 3] |= 1 << (other & 7);
+    }
+}
+
+static int dsh_re_char(struct dsh_re_parser *ps, int c) {
+    int node = dsh_re_node(ps->re, DSH_RE_SET, -1, -1);
+    dsh_re_set_add(ps, ps->re->nodes[node].set, c);
+    return node;
+}
+
+// [:name:] inside a bracket; returns 0 if name is not a class we know
+static int dsh_re_class(struct dsh_re_parser *ps, unsigned char *set, const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        int (*test)(int);
+    } classes[] = {
+        { "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum }, { "space", isspace },
+        { "upper", isupper }, { "lower", islower }, { "punct", ispunct }, { "xdigit", isxdigit },
+        { "blank", isblank }, { "cntrl", iscntrl }, { "print", isprint }, { "graph", isgraph }
+    };
+    size_t it;
+    int c;
+
+    for (it = 0; it < sizeof(classes) / sizeof(classes[0]); it++) {
+        if (strlen(classes[it].name) == len && memcmp(classes[it].name, name, len) == 0) {
+            for (c = 0; c < 256; c++) {
+                if (classes[it].test(c)) {
+                    dsh_re_set_add(ps, set, c);
+                }
+            }
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// After the '['
+static int dsh_re_bracket(struct dsh_re_parser *ps) {
+    int node = dsh_re_node(ps->re, DSH_RE_SET, -1, -1);
+    unsigned char set[32];
+    int negate = 0, first = 1, it;
+
+    memset(set, 0, sizeof(set));
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+    while (*ps->p && (*ps->p != ']' || first)) {
+        int lo = (unsigned char) *ps->p++;
+
+        first = 0;
+        if (lo == '[' && *ps->p == ':') {
+            const char *end = strstr(ps->p + 1, ":]");
+            if (end == NULL || !dsh_re_class(ps, set, ps->p + 1, end - ps->p - 1)) {
+                ps->error = 1;
+                return node;
+            }
+            ps->p = end + 2;
+            continue;
+        }
+        if (lo == '[' && (*ps->p == '.' || *ps->p == '=')) {
+            ps->error = 1;  // collating elements: leave them to grep
+            return node;
+        }
+        if (*ps->p == '-' && ps->p[1] && ps->p[1] != ']') {
+            int hi = (unsigned char) ps->p[1];
+            ps->p += 2;
+            for (; lo <= hi; lo++) {
+                dsh_re_set_add(ps, set, lo);
+            }
+        } else {
+            dsh_re_set_add(ps, set, lo);
+        }
+    }
+    if (*ps->p != ']') {
+        ps->error = 1;
+        return node;
+    }
+    ps->p++;
+
+    if (negate) {
+        for (it = 0; it < 32; it++) {
+            set[it] = ~set[it];
+        }
+        set['\n' >> 3] &= ~(1 << ('\n' & 7));
+    }
+    memcpy(ps->re->nodes[node].set, set, sizeof(set));
+    return node;
+}
+
+static int dsh_re_alt(struct dsh_re_parser *ps);
+
+// Is the parser looking at an operator? BRE spells the GNU extras with a backslash
+static int dsh_re_at(struct dsh_re_parser *ps, char op) {
+    if (ps->extended) {
+        return *ps->p == op;
+    }
+    return ps->p[0] == '\\' && ps->p[1] == op;
+}
+
+static void dsh_re_skip(struct dsh_re_parser *ps) {
+    ps->p += ps->extended ? 1 : 2;
+}
+
+static int dsh_re_atom(struct dsh_re_parser *ps, int at_start) {
+    int c = (unsigned char) *ps->p;
+    int node;
+
+    if (dsh_re_at(ps, '(')) {
+        dsh_re_skip(ps);
+        node = dsh_re_alt(ps);
+        if (!dsh_re_at(ps, ')')) {
+            ps->error = 1;
+            return node;
+        }
+        dsh_re_skip(ps);
+        return node;
+    }
+    if (ps->extended && (c == '{' || c == '*' || c == '+' || c == '?') && at_start) {
+        ps->error = 1;  // nothing to repeat; let grep decide what that means
+        return -1;
+    }
+    ps->p++;
+    switch (c) {
+    case '.':
+        node = dsh_re_node(ps->re, DSH_RE_SET, -1, -1);
+        memset(ps->re->nodes[node].set, 0xff, 32);
+        ps->re->nodes[node].set['\n' >> 3] &= ~(1 << ('\n' & 7));
+        return node;
+    case '[':
+        return dsh_re_bracket(ps);
+    case '^':
+        // Basic syntax anchors only where a branch starts; elsewhere it is a character
+        if (!ps->extended && !at_start) {
+            return dsh_re_char(ps, c);
+        }
+        return dsh_re_node(ps->re, DSH_RE_BOL, -1, -1);
+    case '$':
+        // ... and only where one ends
+        if (!ps->extended && *ps->p && !dsh_re_at(ps, ')') && !dsh_re_at(ps, '|')) {
+            return dsh_re_char(ps, c);
+        }
+        return dsh_re_node(ps->re, DSH_RE_EOL, -1, -1);
+    case '\\':
+        c = (unsigned char) *ps->p++;
+        if (c == '\0' || (c >= '1' && c <= '9') || c == '{' || c == '<' || c == '>' || c == 'b' ||
+            c == 'B' || c == 'w' || c == 'W' || c == 's' || c == 'S' || c == '`' || c == '\'') {
+            ps->error = 1;  // back-references, intervals, GNU word escapes
+            return -1;
+        }
+        return dsh_re_char(ps, c);
+    case '{':
+        if (ps->extended) {
+            ps->error = 1;  // an interval
+            return -1;
+        }
+        return dsh_re_char(ps, c);
+    default:
+        return dsh_re_char(ps, c);
+    }
+}
+
+static int dsh_re_repeat(struct dsh_re_parser *ps, int at_start) {
+    // In basic syntax a leading '*' is an ordinary character
+    int node;
+
+    if (!ps->extended && *ps->p == '*') {
+        ps->p++;
+        return dsh_re_char(ps, '*');
+    }
+    node = dsh_re_atom(ps, at_start);
+    while (!ps->error) {
+        if (*ps->p == '*') {
+            ps->p++;
+            node = dsh_re_node(ps->re, DSH_RE_STAR, node, -1);
+        } else if (dsh_re_at(ps, '+')) {
+            dsh_re_skip(ps);
+            node = dsh_re_node(ps->re, DSH_RE_PLUS, node, -1);
+        } else if (dsh_re_at(ps, '?')) {
+            dsh_re_skip(ps);
+            node = dsh_re_node(ps->re, DSH_RE_QUEST, node, -1);
+        } else if (ps->extended ? *ps->p == '{' : (ps->p[0] == '\\' && ps->p[1] == '{')) {
+            ps->error = 1;
+        } else {
+            break;
+        }
+    }
+    return node;
+}
+
+static int dsh_re_concat(struct dsh_re_parser *ps) {
+    int node = dsh_re_node(ps->re, DSH_RE_EMPTY, -1, -1);
+
+    while (*ps->p && !ps->error && !dsh_re_at(ps, '|') && !dsh_re_at(ps, ')')) {
+        int next = dsh_re_repeat(ps, ps->re->nodes[node].type == DSH_RE_EMPTY);
+        node = ps->re->nodes[node].type == DSH_RE_EMPTY ? next : dsh_re_node(ps->re, DSH_RE_CAT, node, next);
+    }
+    return node;
+}
+
+static int dsh_re_alt(struct dsh_re_parser *ps) {
+    int node = dsh_re_concat(ps);
+
+    while (!ps->error && dsh_re_at(ps, '|')) {
+        dsh_re_skip(ps);
+        node = dsh_re_node(ps->re, DSH_RE_ALT, node, dsh_re_concat(ps));
+    }
+    return node;
+}
+
+static int dsh_re_emit(struct dsh_re *re, int op, int x, int y, const unsigned char *set) {
+    re->prog = dsh_xrealloc(re->prog, (re->nprog + 1) * sizeof(*re->prog));
+    re->prog[re->nprog].op = op;
+    re->prog[re->nprog].x = x;
+    re->prog[re->nprog].y = y;
+    re->prog[re->nprog].set = set;
+    return re->nprog++;
+}
+
+static void dsh_re_compile_node(struct dsh_re *re, int n) {
+    struct dsh_re_node *node = &re->nodes[n];
+    int split, jmp;
+
+    switch (node->type) {
+    case DSH_RE_EMPTY:
+        break;
+    case DSH_RE_SET:
+        dsh_re_emit(re, DSH_RE_OP_SET, 0, 0, node->set);
+        break;
+    case DSH_RE_BOL:
+        dsh_re_emit(re, DSH_RE_OP_BOL, 0, 0, NULL);
+        break;
+    case DSH_RE_EOL:
+        dsh_re_emit(re, DSH_RE_OP_EOL, 0, 0, NULL);
+        break;
+    case DSH_RE_CAT:
+        dsh_re_compile_node(re, node->left);
+        dsh_re_compile_node(re, re->nodes[n].right);
+        break;
+    case DSH_RE_ALT:
+        split = dsh_re_emit(re, DSH_RE_OP_SPLIT, 0, 0, NULL);
+        re->prog[split].x = re->nprog;
+        dsh_re_compile_node(re, re->nodes[n].left);
+        jmp = dsh_re_emit(re, DSH_RE_OP_JMP, 0, 0, NULL);
+        re->prog[split].y = re->nprog;
+        dsh_re_compile_node(re, re->nodes[n].right);
+        re->prog[jmp].x = re->nprog;
+        break;
+    case DSH_RE_STAR:
+        split = dsh_re_emit(re, DSH_RE_OP_SPLIT, 0, 0, NULL);
+        re->prog[split].x = re->nprog;
+        dsh_re_compile_node(re, re->nodes[n].left);
+        dsh_re_emit(re, DSH_RE_OP_JMP, split, 0, NULL);
+        re->prog[split].y = re->nprog;
+        break;
+    case DSH_RE_PLUS:
+        jmp = re->nprog;
+        dsh_re_compile_node(re, re->nodes[n].left);
+        dsh_re_emit(re, DSH_RE_OP_SPLIT, jmp, re->nprog + 1, NULL);
+        break;
+    case DSH_RE_QUEST:
+        split = dsh_re_emit(re, DSH_RE_OP_SPLIT, 0, 0, NULL);
+        re->prog[split].x = re->nprog;
+        dsh_re_compile_node(re, re->nodes[n].left);
+        re->prog[split].y = re->nprog;
+        break;
+    }
+}
+
+/*
+ * Adds pc and everything reachable from it without reading a byte.
+ * ^ can only be passed at the start of a line, and $ only while taking
+ * the end of one (so `a$$` passes both).
+ */
+static void dsh_re_closure(struct dsh_re *re, int pc, int bol, int eol, int *count) {
+    while (re->mark[pc] != re->gen) {
+        struct dsh_re_inst *inst = &re->prog[pc];
+
+        re->mark[pc] = re->gen;
+        switch (inst->op) {
+        case DSH_RE_OP_JMP:
+            pc = inst->x;
+            break;
+        case DSH_RE_OP_SPLIT:
+            dsh_re_closure(re, inst->x, bol, eol, count);
+            pc = inst->y;
+            break;
+        case DSH_RE_OP_BOL:
+            if (!bol) {
+                return;
+            }
+            pc++;
+            break;
+        case DSH_RE_OP_EOL:
+            if (!eol) {
+                re->list[(*count)++] = pc;
+                return;
+            }
+            pc++;
+            break;
+        default:
+            re->list[(*count)++] = pc;
+            return;
+        }
+    }
+}
+
+static int dsh_re_int_cmp(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
+
+// The cached state for list[0..count), made if it is new
+static int dsh_re_state(struct dsh_re *re, int count) {
+    struct dsh_re_state *state;
+    int it;
+
+    qsort(re->list, count, sizeof(int), dsh_re_int_cmp);
+    for (it = 0; it < re->nstates; it++) {
+        if (re->states[it].npcs == count && memcmp(re->states[it].pcs, re->list, count * sizeof(int)) == 0) {
+            return it;
+        }
+    }
+
+    if (re->nstates == re->capstates) {
+        re->capstates = re->capstates ? re->capstates * 2 : 16;
+        re->states = dsh_xrealloc(re->states, re->capstates * sizeof(*re->states));
+        re->table = dsh_xrealloc(re->table, re->capstates * DSH_GREP_ROW * sizeof(int));
+    }
+    state = &re->states[re->nstates];
+    state->pcs = dsh_xrealloc(NULL, (count + 1) * sizeof(int));
+    memcpy(state->pcs, re->list, count * sizeof(int));
+    state->npcs = count;
+    state->match = 0;
+    for (it = 0; it < count; it++) {
+        state->match |= re->prog[re->list[it]].op == DSH_RE_OP_MATCH;
+    }
+    memset(re->table + re->nstates * DSH_GREP_ROW, 0xff, DSH_GREP_ROW * sizeof(int));
+    return re->nstates++;
+}
+
+static void dsh_re_flush(struct dsh_re *re) {
+    int it;
+
+    for (it = 0; it < re->nstates; it++) {
+        free(re->states[it].pcs);
+    }
+    re->nstates = 0;
+}
+
+/*
+ * Makes the transition from state s on byte c (or DSH_GREP_EOL), coded
+ * as in the table. The search is unanchored, so after every byte the
+ * program starts over too. A newline goes back to the start state, and
+ * its match flag says whether the line it ends matched at its end.
+ */
+static int dsh_re_step(struct dsh_re *re, int s, int c) {
+    int count = 0, it, next;
+    if (re->nstates >= DSH_GREP_MAX_STATES) {
+        // Rebuild from scratch; keep the state we are in
+        int *pcs = re->states[s].pcs, npcs = re->states[s].npcs;
+        re->states[s].pcs = NULL;
+        dsh_re_flush(re);
+        memcpy(re->list, pcs, npcs * sizeof(int));
+        free(pcs);
+        s = dsh_re_state(re, npcs);
+        re->gen++;
+        count = 0;
+        dsh_re_closure(re, 0, 1, 0, &count);
+        re->start = dsh_re_state(re, count);
+    }
+
+    if (c == '\n') {
+        // The end of this line (did it match?) and the start of the next;
+        // the cache has room for the one state this can add
+        int eol = dsh_re_step(re, s, DSH_GREP_EOL);
+        re->table[s * DSH_GREP_ROW + c] = re->start * DSH_GREP_ROW << 2 | (eol & 1);
+        return re->table[s * DSH_GREP_ROW + c];
+    }
+
+    re->gen++;
+    for (it = 0; it < re->states[s].npcs; it++) {
+        struct dsh_re_inst *inst = &re->prog[re->states[s].pcs[it]];
+        int pc = re->states[s].pcs[it];
+
+        if (c == DSH_GREP_EOL) {
+            if (inst->op == DSH_RE_OP_EOL) {
+                dsh_re_closure(re, pc + 1, 0, 1, &count);
+            }
+        } else if (inst->op == DSH_RE_OP_SET && (inst->set[c >> 3] & (1 << (c & 7)))) {
+            dsh_re_closure(re, pc + 1, 0, 0, &count);
+        }
+    }
+    if (c != DSH_GREP_EOL) {
+        dsh_re_closure(re, 0, 0, 0, &count);
+    }
+    next = dsh_re_state(re, count);
+    re->table[s * DSH_GREP_ROW + c] = next * DSH_GREP_ROW << 2 | (re->states[next].npcs == 0) << 1 |
+                                      re->states[next].match;
+    return re->table[s * DSH_GREP_ROW + c];
+}
+
+/*
+ * Finds the first line in [p, end) the regex matches, running the DFA
+ * straight through the lines. Where the line starts is only worked out
+ * once it has matched.
+ */
+static int dsh_re_search(struct dsh_re *re, const char *p, const char *end, const char **line,
+                         const char **line_end) {
+    const char *from = p, *newline;
+    int row = re->start * DSH_GREP_ROW, t;
+
+    if (re->states[re->start].match) {
+        goto found;  // every line matches
+    }
+    for (; p < end; p++) {
+        if ((t = re->table[row + (unsigned char) *p]) < 0) {
+            t = dsh_re_step(re, row / DSH_GREP_ROW, (unsigned char) *p);
+        }
+        if (t & 3) {
+            if (t & 1) {
+                goto found;
+            }
+            // Dead: nothing can match before the next line (after a failed ^)
+            newline = memchr(p + 1, '\n', end - p - 1);
+            if (newline == NULL) {
+                return 0;
+            }
+            p = newline - 1;
+        }
+        row = t >> 2;
+    }
+    if (end > from && end[-1] != '\n') {
+        // The last line has no newline
+        if ((t = re->table[row + DSH_GREP_EOL]) < 0) {
+            t = dsh_re_step(re, row / DSH_GREP_ROW, DSH_GREP_EOL);
+        }
+        if (t & 1) {
+            p = end - 1;
+            goto found;
+        }
+    }
+    return 0;
+
+found:
+    *line = memrchr(from, '\n', p - from);
+    *line = *line ? *line + 1 : from;
+    p = memchr(p, '\n', end - p);
+    *line_end = p ? p + 1 : end;
+    return 1;
+}
+
+/*
+ * The longest run of single bytes every match has to contain, taken
+ * from the top-level concatenation only. Written to buf; returns its length.
+ */
+static size_t dsh_re_required(struct dsh_re *re, int n, char *buf, size_t size, size_t *run, size_t *best,
+                              char *best_buf) {
+    struct dsh_re_node *node = &re->nodes[n];
+    int c, only = -1, count = 0;
+
+    if (node->type == DSH_RE_CAT) {
+        dsh_re_required(re, node->left, buf, size, run, best, best_buf);
+        dsh_re_required(re, re->nodes[n].right, buf, size, run, best, best_buf);
+        return *best;
+    }
+    if (node->type == DSH_RE_SET) {
+        for (c = 0; c < 256 && count < 2; c++) {
+            if (node->set[c >> 3] & (1 << (c & 7))) {
+                only = c;
+                count++;
+            }
+        }
+        if (count == 1 && *run < size) {
+            buf[(*run)++] = only;
+            if (*run > *best) {
+                *best = *run;
+                memcpy(best_buf, buf, *run);
+            }
+            return *best;
+        }
+    }
+    if (node->type != DSH_RE_BOL && node->type != DSH_RE_EOL && node->type != DSH_RE_EMPTY) {
+        *run = 0;  // anything else ends the run
+    }
+    return *best;
+}
+
+static struct dsh_re *dsh_re_compile(const char *pattern, int extended, int icase, char *required,
+                                     size_t required_size, size_t *required_len) {
+    struct dsh_re *re = dsh_xcalloc(1, sizeof(*re));
+    struct dsh_re_parser ps;
+    char scratch[256];
+    size_t run = 0, best = 0;
+    int root, count = 0;
+
+    ps.re = re;
+    ps.p = pattern;
+    ps.extended = extended;
+    ps.icase = icase;
+    ps.error = 0;
+    root = dsh_re_alt(&ps);
+    if (ps.error || *ps.p != '\0') {
+        free(re->nodes);
+        free(re);
+        return NULL;
+    }
+
+    if (required_size > sizeof(scratch)) {
+        required_size = sizeof(scratch);
+    }
+    *required_len = dsh_re_required(re, root, scratch, required_size, &run, &best, required);
+
+    dsh_re_compile_node(re, root);
+    dsh_re_emit(re, DSH_RE_OP_MATCH, 0, 0, NULL);
+    re->mark = dsh_xcalloc(re->nprog, sizeof(int));
+    re->list = dsh_xrealloc(NULL, re->nprog * sizeof(int));
+    re->gen = 1;
+    dsh_re_closure(re, 0, 1, 0, &count);
+    re->start = dsh_re_state(re, count);
+    return re;
+}
+
+static void dsh_re_free(struct dsh_re *re) {
+    if (re) {
+        dsh_re_flush(re);
+        free(re->states);
+        free(re->table);
+        free(re->prog);
+        free(re->nodes);
+        free(re->mark);
+        free(re->list);
+        free(re);
+    }
+}
+
+/* ---- patterns and options ---- */
+
+enum {
+    DSH_GREP_INVERT = 1,
+    DSH_GREP_COUNT = 2,
+    DSH_GREP_NUMBER = 4,
+    DSH_GREP_LIST = 8,
+    DSH_GREP_QUIET = 16,
+    DSH_GREP_LINE = 32      // -x
+};
+
+struct dsh_grep {
+    int flags;
+    // literals (-F, or a pattern with nothing special in it)
+    const char *literals[DSH_GREP_MAX_PATTERNS];
+    size_t lengths[DSH_GREP_MAX_PATTERNS];
+    const char *hits[DSH_GREP_MAX_PATTERNS];  // next hit of each in the current buffer
+    int nliterals;
+    // or a regex, with its required literal to find candidates
+    struct dsh_re *re;
+    char required[64];
+    size_t required_len;
+    const char *hits_base;  // the end of the buffer hits[] were found in
+    int dense;              // candidate lines in a row that came soon after the last
+    unsigned long long selected;  // lines selected by the streams closed so far, for $?
+};
+
+static int dsh_grep_plain(const char *pattern, int extended) {
+    return strpbrk(pattern, extended ? ".[]()*+?{}|^$\\" : ".[]*^$\\") == NULL;
+}
+
+/*
+ * Finds the first line in [p, end) that contains a match. end is at a
+ * line boundary. Sets *line and *line_end (just past its newline) and
+ * returns 1, or returns 0.
+ */
+static int dsh_grep_find(struct dsh_grep *g, const char *p, const char *end, const char **line,
+                         const char **line_end) {
+    while (p < end) {
+        const char *hit = NULL;
+        const char *start, *stop;
+        int it;
+
+        if (g->re == NULL) {
+            // Earliest next hit among the literals, each found once
+            for (it = 0; it < g->nliterals; it++) {
+                if (g->hits_base != end || (g->hits[it] != NULL && g->hits[it] < p)) {
+                    g->hits[it] = memmem(p, end - p, g->literals[it], g->lengths[it]);
+                }
+                if (g->hits[it] && (hit == NULL || g->hits[it] < hit)) {
+                    hit = g->hits[it];
+                }
+            }
+            g->hits_base = end;
+            if (hit == NULL) {
+                return 0;
+            }
+        } else if (g->required_len == 0) {
+            return dsh_re_search(g->re, p, end, line, line_end);
+        } else if (g->dense >= DSH_GREP_DENSE) {
+            // The literal is on most lines and only costs: run the DFA
+            // alone for a while, then try it again
+            stop = end - p > DSH_IO_BUFSIZE ? memchr(p + DSH_IO_BUFSIZE, '\n', end - p - DSH_IO_BUFSIZE) : NULL;
+            stop = stop ? stop + 1 : end;
+            if (dsh_re_search(g->re, p, stop, line, line_end)) {
+                return 1;
+            }
+            g->dense = 0;
+            p = stop;
+            continue;
+        } else {
+            hit = memmem(p, end - p, g->required, g->required_len);
+            if (hit == NULL) {
+                return 0;
+            }
+        }
+
+        start = memrchr(p, '\n', hit - p);
+        start = start ? start + 1 : p;
+        g->dense = start - p < DSH_GREP_SKIP ? g->dense + 1 : 0;
+        stop = memchr(hit, '\n', end - hit);
+        stop = stop ? stop + 1 : end;
+
+        if (g->re != NULL) {
+            if (dsh_re_search(g->re, start, stop, line, line_end)) {
+                return 1;
+            }
+        } else if (!(g->flags & DSH_GREP_LINE)) {
+            *line = start;
+            *line_end = stop;
+            return 1;
+        } else {
+            // -x: some literal has to be the whole line
+            size_t len = stop - start - (stop[-1] == '\n');
+            for (it = 0; it < g->nliterals; it++) {
+                if (g->lengths[it] == len && memcmp(start, g->literals[it], len) == 0) {
+                    *line = start;
+                    *line_end = stop;
+                    return 1;
+                }
+            }
+        }
+        p = stop;
+    }
+    return 0;
+}
+
+/* ---- the stream operator ---- */
+
+struct dsh_grep_stream {
+    struct dsh_stream base;
+    struct dsh_grep *grep;
+    const char *label;          // "name:" prefix, or NULL
+    unsigned long long lineno;  // lines before the unprocessed input
+    unsigned long long count;   // lines selected
+    char *carry;                // a line split across writes
+    size_t carry_len, carry_cap;
+    int done;
+    struct dsh_grep *owned;     // freed with the stream: a pipeline stage's own grep
+};
+
+static int dsh_grep_emit(struct dsh_grep_stream *gs, const char *line, const char *line_end) {
+    struct dsh_stream *next = gs->base.next;
+    int flags = gs->grep->flags;
+    char prefix[64];
+    int n;
+
+    if (gs->label && next->write(next, gs->label, strlen(gs->label)) != 0) {
+        return -1;
+    }
+    if (gs->label && next->write(next, ":", 1) != 0) {
+        return -1;
+    }
+    if (flags & DSH_GREP_NUMBER) {
+        n = snprintf(prefix, sizeof(prefix), "%llu:", gs->lineno);
+        if (next->write(next, prefix, n) != 0) {
+            return -1;
+        }
+    }
+    if (next->write(next, line, line_end - line) != 0) {
+        return -1;
+    }
+    return line_end[-1] == '\n' ? 0 : next->write(next, "\n", 1);
+}
+
+// Emits every line of [p, end) (used for -v), one by one if they need prefixes
+static int dsh_grep_emit_block(struct dsh_grep_stream *gs, const char *p, const char *end) {
+    if (p == end) {
+        return 0;
+    }
+    gs->count += dsh_text_count(p, end - p, '\n') + (end[-1] != '\n');
+    if (gs->grep->flags & (DSH_GREP_COUNT | DSH_GREP_LIST | DSH_GREP_QUIET)) {
+        gs->lineno += dsh_text_count(p, end - p, '\n');
+        return 0;
+    }
+    if (gs->label == NULL && !(gs->grep->flags & DSH_GREP_NUMBER)) {
+        // Passed on by reference, as one piece
+        int status = gs->base.next->write(gs->base.next, p, end - p);
+        gs->lineno += dsh_text_count(p, end - p, '\n');
+        if (status == 0 && end[-1] != '\n') {
+            status = gs->base.next->write(gs->base.next, "\n", 1);
+        }
+        return status;
+    }
+    while (p < end) {
+        const char *stop = memchr(p, '\n', end - p);
+        stop = stop ? stop + 1 : end;
+        gs->lineno++;
+        if (dsh_grep_emit(gs, p, stop) != 0) {
+            return -1;
+        }
+        p = stop;
+    }
+    return 0;
+}
+
+// Handles complete lines in [p, end)
+static int dsh_grep_lines(struct dsh_grep_stream *gs, const char *p, const char *end) {
+    int flags = gs->grep->flags;
+    const char *line, *line_end;
+
+    gs->grep->hits_base = NULL;  // hits are remembered only within [p, end)
+    gs->grep->dense = 0;
+    while (!gs->done && p < end && dsh_grep_find(gs->grep, p, end, &line, &line_end)) {
+        if (flags & DSH_GREP_INVERT) {
+            if (dsh_grep_emit_block(gs, p, line) != 0) {
+                return -1;
+            }
+            gs->lineno++;
+        } else {
+            if (flags & DSH_GREP_NUMBER) {
+                gs->lineno += dsh_text_count(p, line - p, '\n');
+            }
+            gs->lineno++;
+            gs->count++;
+            if (flags & (DSH_GREP_LIST | DSH_GREP_QUIET)) {
+                gs->done = 1;
+            } else if (!(flags & DSH_GREP_COUNT) && dsh_grep_emit(gs, line, line_end) != 0) {
+                return -1;
+            }
+        }
+        p = line_end;
+    }
+    if (!gs->done && p < end) {
+        if (flags & DSH_GREP_INVERT) {
+            return dsh_grep_emit_block(gs, p, end);
+        }
+        if (flags & DSH_GREP_NUMBER) {
+            gs->lineno += dsh_text_count(p, end - p, '\n');
+        }
+    }
+    return 0;
+}
+
+static void dsh_grep_carry(struct dsh_grep_stream *gs, const char *buf, size_t len) {
+    if (gs->carry_len + len > gs->carry_cap) {
+        while (gs->carry_len + len > gs->carry_cap) {
+            gs->carry_cap = gs->carry_cap ? gs->carry_cap * 2 : 4096;
+        }
+        gs->carry = dsh_xrealloc(gs->carry, gs->carry_cap);
+    }
+    memcpy(gs->carry + gs->carry_len, buf, len);
+    gs->carry_len += len;
+}
+
+/*
+ * Lines are worked on where they are; only a line cut in two by the
+ * end of a buffer is copied, to be finished by the next one.
+ */
+static int dsh_grep_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_grep_stream *gs = (struct dsh_grep_stream *) stream;
+    const char *end = buf + len, *last;
+
+    if (gs->done) {
+        return 1;
+    }
+    if (gs->carry_len > 0) {
+        const char *newline = memchr(buf, '\n', len);
+        if (newline == NULL) {
+            dsh_grep_carry(gs, buf, len);
+            return 0;
+        }
+        dsh_grep_carry(gs, buf, newline + 1 - buf);
+        if (dsh_grep_lines(gs, gs->carry, gs->carry + gs->carry_len) != 0) {
+            return -1;
+        }
+        gs->carry_len = 0;
+        buf = newline + 1;
+    }
+
+    last = buf < end ? memrchr(buf, '\n', end - buf) : NULL;
+    if (last == NULL) {
+        dsh_grep_carry(gs, buf, end - buf);
+        return gs->done;
+    }
+    if (dsh_grep_lines(gs, buf, last + 1) != 0) {
+        return -1;
+    }
+    if (last + 1 < end) {
+        dsh_grep_carry(gs, last + 1, end - last - 1);
+    }
+    return gs->done;
+}
+
+static int dsh_grep_close(struct dsh_stream *stream) {
+    struct dsh_grep_stream *gs = (struct dsh_grep_stream *) stream;
+    struct dsh_stream *next = stream->next;
+    int flags = gs->grep->flags;
+    int status = 0;
+
+    if (gs->carry_len > 0 && !gs->done) {
+        status = dsh_grep_lines(gs, gs->carry, gs->carry + gs->carry_len);
+    }
+    if (status == 0 && (flags & DSH_GREP_LIST) && !(flags & DSH_GREP_QUIET) && gs->count > 0) {
+        const char *name = gs->label ? gs->label : "(standard input)";
+        status = next->write(next, name, strlen(name)) != 0 || next->write(next, "\n", 1) != 0 ? -1 : 0;
+    } else if (status == 0 && (flags & DSH_GREP_COUNT) && !(flags & (DSH_GREP_LIST | DSH_GREP_QUIET))) {
+        char line[64];
+        int n = snprintf(line, sizeof(line), "%llu\n", gs->count);
+        if (gs->label && (next->write(next, gs->label, strlen(gs->label)) != 0 || next->write(next, ":", 1) != 0)) {
+            status = -1;
+        } else {
+            status = next->write(next, line, n) != 0 ? -1 : 0;
+        }
+    }
+    // As grep(1): 0 once some line was selected, 1 while none was
+    gs->grep->selected += gs->count;
+    dsh_status = gs->grep->selected > 0 ? 0 : 1;
+    free(gs->carry);
+    if (gs->owned) {
+        dsh_grep_free(gs->owned);
+    }
+    free(gs);
+    return status;
+}
+
+struct dsh_stream *dsh_grep_stream(struct dsh_grep *grep, const char *label, struct dsh_stream *next) {
+    struct dsh_grep_stream *gs = dsh_xcalloc(1, sizeof(*gs));
+    gs->base.write = dsh_grep_write;
+    gs->base.close = dsh_grep_close;
+    gs->base.next = next;
+    gs->grep = grep;
+    gs->label = label;
+    return &gs->base;
+}
+
+/*
+ * Parses grep's options and compiles the patterns. Returns NULL when
+ * the external grep should run instead; otherwise *operands is set to
+ * the first file operand.
+ */
+struct dsh_grep *dsh_grep_compile(char **args, char ***operands) {
+    const char *patterns[DSH_GREP_MAX_PATTERNS];
+    int npatterns = 0, extended = 0, fixed = 0, icase = 0;
+    struct dsh_grep *g;
+    int argi, it;
+    int flags = 0;
+
+    for (argi = 1; args[argi] != NULL && args[argi][0] == '-' && args[argi][1] != '\0'; argi++) {
+        const char *flag;
+
+        if (strcmp(args[argi], "--") == 0) {
+            argi++;
+            break;
+        }
+        for (flag = args[argi] + 1; *flag; flag++) {
+            switch (*flag) {
+            case 'F': fixed = 1; extended = 0; break;
+            case 'E': extended = 1; fixed = 0; break;
+            case 'G': extended = 0; fixed = 0; break;
+            case 'i': icase = 1; break;
+            case 'v': flags |= DSH_GREP_INVERT; break;
+            case 'c': flags |= DSH_GREP_COUNT; break;
+            case 'n': flags |= DSH_GREP_NUMBER; break;
+            case 'l': flags |= DSH_GREP_LIST; break;
+            case 'q': flags |= DSH_GREP_QUIET; break;
+            case 'x': flags |= DSH_GREP_LINE; break;
+            case 'e':
+                if (npatterns == DSH_GREP_MAX_PATTERNS) {
+                    return NULL;
+                }
+                if (flag[1]) {
+                    patterns[npatterns++] = flag + 1;
+                } else if (args[argi + 1]) {
+                    patterns[npatterns++] = args[++argi];
+                } else {
+                    return NULL;
+                }
+                flag += strlen(flag) - 1;
+                break;
+            default:
+                return NULL;
+            }
+        }
+    }
+    if (npatterns == 0) {
+        if (args[argi] == NULL) {
+            return NULL;
+        }
+        patterns[npatterns++] = args[argi++];
+    }
+    *operands = args + argi;
+
+    g = dsh_xcalloc(1, sizeof(*g));
+    g->flags = flags;
+
+    for (it = 0; it < npatterns; it++) {
+        if (strchr(patterns[it], '\n') || patterns[it][0] == '\0') {
+            free(g);
+            return NULL;  // several patterns in one, or the empty one: leave those to grep
+        }
+    }
+
+    if (!icase && (fixed || (npatterns == 1 && dsh_grep_plain(patterns[0], extended)))) {
+        for (it = 0; it < npatterns; it++) {
+            g->literals[it] = patterns[it];
+            g->lengths[it] = strlen(patterns[it]);
+        }
+        g->nliterals = npatterns;
+        return g;
+    }
+
+    // Everything else becomes one regex: the patterns as alternatives
+    {
+        size_t len = 0;
+        char *joined, *p;
+
+        for (it = 0; it < npatterns; it++) {
+            len += 2 * strlen(patterns[it]) + 8;
+        }
+        joined = p = dsh_xrealloc(NULL, len + 8);
+        for (it = 0; it < npatterns; it++) {
+            const char *s = patterns[it];
+
+            if (it > 0) {
+                p += sprintf(p, "%s", extended ? "|" : "\\|");
+            }
+            p += sprintf(p, "%s", flags & DSH_GREP_LINE ? (extended ? "^(" : "^\\(") : (extended ? "(" : "\\("));
+            if (fixed) {
+                // Literal text: escape what would be special
+                for (; *s; s++) {
+                    if (strchr(".[]*^$\\+?(){}|", *s)) {
+                        if (!extended && strchr("+?(){}|", *s)) {
+                            *p++ = *s;
+                            continue;
+                        }
+                        *p++ = '\\';
+                    }
+                    *p++ = *s;
+                }
+            } else {
+                p += sprintf(p, "%s", s);
+            }
+            p += sprintf(p, "%s", flags & DSH_GREP_LINE ? (extended ? ")$" : "\\)$") : (extended ? ")" : "\\)"));
+        }
+        *p = '\0';
+
+        g->re = dsh_re_compile(joined, extended || fixed ? extended : 0, icase, g->required,
+                               sizeof(g->required), &g->required_len);
+        free(joined);
+        if (g->re == NULL) {
+            free(g);
+            return NULL;
+        }
+    }
+    return g;
+}
+
+void dsh_grep_free(struct dsh_grep *g) {
+    if (g) {
+        dsh_re_free(g->re);
+        free(g);
+    }
+}
+
+int dsh_grep(char **args) {
+    char *stdin_only[] = { "-", NULL };
+    char **operands;
+    struct dsh_grep *g = dsh_grep_compile(args, &operands);
+    struct dsh_stream *out;
+    int count, it, failed = 0;
+
+    if (g == NULL) {
+        return dsh_launch(args);  // the real grep
+    }
+    if (operands[0] == NULL) {
+        operands = stdin_only;
+    }
+    for (count = 0; operands[count] != NULL; count++) {
+        ;
+    }
+
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    for (it = 0; it < count; it++) {
+        const char *name = operands[it];
+        struct dsh_stream *gs;
+        int fd = STDIN_FILENO;
+
+        if (strcmp(name, "-") != 0) {
+            fd = open(name, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                fprintf(stderr, "dsh: grep: %s: %s\n", name, strerror(errno));
+                failed = 1;
+                continue;
+            }
+        }
+        // One file is not labelled, except by -l which prints only names
+        gs = dsh_grep_stream(g, count > 1 || (g->flags & DSH_GREP_LIST)
+                                    ? (fd == STDIN_FILENO ? "(standard input)" : name) : NULL, out);
+        dsh_stream_feed(gs, fd, name);
+        gs->close(gs);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    out->close(out);
+    // A file that could not be read is 2, unless -q already found what it asked about
+    if (failed && !((g->flags & DSH_GREP_QUIET) && g->selected > 0)) {
+        dsh_status = 2;
+    }
+    dsh_grep_free(g);
+    return 1;
+}
+
+/*
+ * grep as one stage of a pipeline (pipeline.c). Returns NULL when args
+ * need the external grep; otherwise *operands is set to the file
+ * operands, which only a first stage has, and then only one.
+ */
+struct dsh_stream *dsh_grep_stage(char **args, char ***operands, struct dsh_stream *next) {
+    struct dsh_grep *g = dsh_grep_compile(args, operands);
+    struct dsh_grep_stream *gs;
+    const char *label = NULL;
+
+    if (g == NULL) {
+        return NULL;
+    }
+    if ((g->flags & DSH_GREP_LIST) && (*operands)[0] != NULL && strcmp((*operands)[0], "-") != 0) {
+        label = (*operands)[0];  // -l prints it even for one file
+    }
+    gs = (struct dsh_grep_stream *) dsh_grep_stream(g, label, next);
+    gs->owned = g;
+    return &gs->base;
+}
@@ -0,0 +1,141 @@
+#include <stdlib.h>  // for free()
+#include <stdio.h>   // for fprintf()
+#include <string.h>  // for strlen(), memcpy(), memset()
+
+#include "dsh.h"
+
+/*
+ * Names as numbers.
+ *
+ * dsh_intern() gives every name it sees a small id, the same one every
+ * time. Ids are handed out 0, 1, 2, ... and never change or go away, so
+ * whatever is looked up by name can be an array indexed by id instead of
+ * a table of its own:
+ *
+ *   - the builtins, whose names take ids 0 .. dsh_num_builtins() - 1
+ *     before anything else, so builtin_func[id] is the builtin;
+ *   - the variables and functions of vars.c;
+ *   - the PATH cache of dsh_spawn_with();
+ *   - the command names of the profiler's samples.
+ *
+ * Finding a command is then one hash of its name and a probe, not a
+ * strcmp() against every builtin. The names are command names and
+ * variable names, which a shell only sees so many of, so nothing is
+ * ever freed.
+ */
+
+#define DSH_INTERN_BUFSIZE 64  // starting size of the table
+
+static char **dsh_intern_names;          // id -> name
+static unsigned long *dsh_intern_hashes; // id -> hash of the name
+static int dsh_intern_len;
+static int dsh_intern_cap;
+static int *dsh_intern_slots;            // open addressing: id + 1, 0 when free
+static size_t dsh_intern_nslots;
+
+// FNV-1a
+static unsigned long dsh_intern_hash(const char *name) {
+    unsigned long hash = 2166136261UL;
+
+    while (*name) {
+        hash = (hash ^ (unsigned char) *name++) * 16777619UL;
+    }
+    return hash;
+}
+
+// Doubles the slots, which are only ever half full
+static void dsh_intern_grow(void) {
+    size_t it;
+
+    free(dsh_intern_slots);
+    dsh_intern_nslots = dsh_intern_nslots ? dsh_intern_nslots * 2 : DSH_INTERN_BUFSIZE;
+    dsh_intern_slots = dsh_xrealloc(NULL, dsh_intern_nslots * sizeof(*dsh_intern_slots));
+    memset(dsh_intern_slots, 0, dsh_intern_nslots * sizeof(*dsh_intern_slots));
+    for (it = 0; it < (size_t) dsh_intern_len; it++) {
+        size_t slot = dsh_intern_hashes[it] & (dsh_intern_nslots - 1);
+        while (dsh_intern_slots[slot]) {
+            slot = (slot + 1) & (dsh_intern_nslots - 1);
+        }
+        dsh_intern_slots[slot] = it + 1;
+    }
+}
+
+// The id of name, or -1 with *slot where it would go
+static int dsh_intern_lookup(const char *name, unsigned long hash, size_t *slot) {
+    size_t at;
+
+    for (at = hash & (dsh_intern_nslots - 1); dsh_intern_slots[at]; at = (at + 1) & (dsh_intern_nslots - 1)) {
+        int id = dsh_intern_slots[at] - 1;
+        const char *a = dsh_intern_names[id], *b = name;
+
+        if (dsh_intern_hashes[id] != hash) {
+            continue;
+        }
+        // Names are short: a loop beats a call to strcmp()
+        while (*a && *a == *b) {
+            a++;
+            b++;
+        }
+        if (*a == *b) {
+            return id;
+        }
+    }
+    *slot = at;
+    return -1;
+}
+
+static int dsh_intern_add(const char *name, unsigned long hash, size_t slot) {
+    size_t len = strlen(name) + 1;
+    int id = dsh_intern_len++;
+
+    if (id == dsh_intern_cap) {
+        dsh_intern_cap = dsh_intern_cap ? dsh_intern_cap * 2 : DSH_INTERN_BUFSIZE;
+        dsh_intern_names = dsh_xrealloc(dsh_intern_names, dsh_intern_cap * sizeof(*dsh_intern_names));
+        dsh_intern_hashes = dsh_xrealloc(dsh_intern_hashes, dsh_intern_cap * sizeof(*dsh_intern_hashes));
+    }
+    dsh_intern_names[id] = memcpy(dsh_xrealloc(NULL, len), name, len);
+    dsh_intern_hashes[id] = hash;
+    dsh_intern_slots[slot] = id + 1;
+    if ((size_t) dsh_intern_len * 2 > dsh_intern_nslots) {
+        dsh_intern_grow();
+    }
+    return id;
+}
+
+// The first use gives the builtins their ids, in the order of builtin_str
+static void dsh_intern_init(void) {
+    int it;
+
+    if (dsh_intern_nslots == 0) {
+        dsh_intern_grow();
+        for (it = 0; it < dsh_num_builtins(); it++) {
+            dsh_intern(builtin_str[it]);
+        }
+    }
+}
+
+// The id of name, given one if it has none yet
+int dsh_intern(const char *name) {
+    unsigned long hash = dsh_intern_hash(name);
+    size_t slot;
+    int id;
+
+    dsh_intern_init();
+    if ((id = dsh_intern_lookup(name, hash, &slot)) < 0) {
+        id = dsh_intern_add(name, hash, slot);
+    }
+    return id;
+}
+
+// The id of name, or -1 if it has none: a name never seen is nothing yet
+int dsh_intern_find(const char *name) {
+    size_t slot;
+
+    dsh_intern_init();
+    return dsh_intern_lookup(name, dsh_intern_hash(name), &slot);
+}
+
+// The name id stands for; id has to be one dsh_intern() gave out
+const char *dsh_intern_name(int id) {
+    return dsh_intern_names[id];
+}
@@ -0,0 +1,398 @@
+#include <sys/types.h>  // for ssize_t, off_t
+#include <sys/stat.h>   // for fstat(), S_ISREG
+#include <unistd.h>     // for read(), pread(), write(), lseek()
+#include <errno.h>      // for errno, EINTR
+#include <stdlib.h>     // for malloc(), free(), getenv(), exit()
+#include <stdio.h>      // for fprintf()
+#include <string.h>     // for strcmp(), memset()
+
+#ifdef DSH_IO_URING
+#include <sys/mman.h>         // for mmap()
+#include <pthread.h>          // for pthread_atfork()
+#include <sys/syscall.h>      // for __NR_io_uring_setup, __NR_io_uring_enter
+#include <stdint.h>           // for uintptr_t
+#include <linux/io_uring.h>   // for struct io_uring_params, io_uring_sqe, ...
+#endif
+
+#include "dsh.h"
+
+/*
+ * The shell's own file I/O: reading commands, and the files builtins
+ * read (memo's cache entries).
+ *
+ * A dsh_io_source is a buffered reader over one descriptor. Plain
+ * read() fills it one chunk at a time. Built with -DDSH_IO_URING
+ * (`make IO_URING=1`), and when the kernel lets us set up a ring,
+ * regular files the shell opened itself are read ahead instead: two
+ * chunk-sized reads are kept queued, each refill hands back one that
+ * has usually landed already and queues the next into the half just
+ * used up, and queued reads go to the kernel together in the next
+ * io_uring_enter(). Reading a script overlaps with running it and takes
+ * about one syscall per two chunks.
+ * stdin, pipes and terminals are always read with plain read(): a
+ * read left in flight on them could take input meant for a command.
+ *
+ * The ring belongs to the process that set it up. A fork()ed child
+ * drops it: reaping its completions would steal the parent's, and the
+ * parent would wait for them forever. Sources the child inherited with
+ * reads in flight go on with pread() from where they were.
+ *
+ * If io_uring_setup() fails (old kernel, seccomp, or DSH_IO=read in
+ * the environment) everything quietly uses read(). There is no epoll
+ * stage in between: the shell waits on one descriptor at a time, and
+ * epoll cannot wait on regular files anyway.
+ *
+ * The ring is driven with raw syscalls, so there is no liburing to
+ * depend on.
+ */
+
+#define DSH_IO_URING_ENTRIES 8
+
+// Plain read() retried on EINTR; counted so dshstat shows the syscalls
+static ssize_t dsh_io_read_plain(int fd, void *buf, size_t size) {
+    ssize_t n;
+
+    do {
+        n = read(fd, buf, size);
+    } while (n < 0 && errno == EINTR);
+    dsh_stats.io_reads++;
+    return n;
+}
+
+ssize_t dsh_io_write_all(int fd, const void *buf, size_t size) {
+    const char *p = buf;
+    size_t left = size;
+
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        left -= n;
+    }
+    return size;
+}
+
+#ifdef DSH_IO_URING
+
+struct dsh_io_ring {
+    int fd;                       // -1 when there is no ring
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned unsubmitted;         // queued in the SQ ring, not yet entered
+};
+
+static struct dsh_io_ring dsh_io_ring = { .fd = -1 };
+static int dsh_io_ring_tried;
+
+// In a fork()ed child: the ring, and what completes on it, is the parent's
+static void dsh_io_ring_forked(void) {
+    if (dsh_io_ring.fd >= 0) {
+        close(dsh_io_ring.fd);
+        dsh_io_ring.fd = -1;
+    }
+}
+
+static int dsh_io_ring_setup(void) {
+    struct io_uring_params params;
+    const char *backend = getenv("DSH_IO");
+    size_t sq_size, cq_size;
+    char *sq, *cq;
+    void *sqes;
+    int fd;
+
+    if (backend && strcmp(backend, "read") == 0) {
+        return -1;
+    }
+
+    memset(&params, 0, sizeof(params));
+    fd = syscall(__NR_io_uring_setup, DSH_IO_URING_ENTRIES, &params);
+    if (fd < 0) {
+        return -1;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) {
+            sq_size = cq_size;
+        }
+        cq_size = sq_size;
+    }
+    sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+    } else {
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            munmap(sq, sq_size);
+            close(fd);
+            return -1;
+        }
+    }
+    sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        if (cq != sq) {
+            munmap(cq, cq_size);
+        }
+        munmap(sq, sq_size);
+        close(fd);
+        return -1;
+    }
+
+    dsh_io_ring.sq_head = (unsigned *) (sq + params.sq_off.head);
+    dsh_io_ring.sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    dsh_io_ring.sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    dsh_io_ring.sq_array = (unsigned *) (sq + params.sq_off.array);
+    dsh_io_ring.cq_head = (unsigned *) (cq + params.cq_off.head);
+    dsh_io_ring.cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    dsh_io_ring.cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    dsh_io_ring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    dsh_io_ring.sqes = sqes;
+    dsh_io_ring.fd = fd;
+    pthread_atfork(NULL, NULL, dsh_io_ring_forked);
+    return 0;
+}
+
+static int dsh_io_ring_ready(void) {
+    if (!dsh_io_ring_tried) {
+        dsh_io_ring_tried = 1;
+        dsh_io_ring_setup();
+    }
+    return dsh_io_ring.fd >= 0;
+}
+
+/*
+ * Queues a read of one chunk at offset into half of src's buffer. The
+ * completion's user_data is the source with the half in its low bit.
+ * Every source has at most two reads in flight and the ring has room
+ * for more than that, so the SQ ring cannot fill up.
+ */
+static void dsh_io_ring_queue(struct dsh_io_source *src, int half, off_t offset) {
+    unsigned tail = *dsh_io_ring.sq_tail;
+    unsigned idx = tail & *dsh_io_ring.sq_mask;
+    struct io_uring_sqe *sqe = &dsh_io_ring.sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = src->fd;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t) (src->buf + half * DSH_IO_BUFSIZE);
+    sqe->len = DSH_IO_BUFSIZE;
+    sqe->user_data = (uintptr_t) src | half;
+    dsh_io_ring.sq_array[idx] = idx;
+    __atomic_store_n(dsh_io_ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    dsh_io_ring.unsubmitted++;
+
+    src->queued[half] = 1;
+    src->done[half] = 0;
+    src->offsets[half] = offset;
+}
+
+// Submits what is queued, waits for one completion, and hands out every completion there is
+static int dsh_io_ring_enter(void) {
+    unsigned head, tail;
+    int n;
+
+    do {
+        n = syscall(__NR_io_uring_enter, dsh_io_ring.fd, dsh_io_ring.unsubmitted, 1,
+                    IORING_ENTER_GETEVENTS, NULL, 0);
+    } while (n < 0 && errno == EINTR);
+    dsh_stats.io_enters++;
+    if (n < 0) {
+        return -1;
+    }
+    dsh_io_ring.unsubmitted -= n;
+
+    head = *dsh_io_ring.cq_head;
+    tail = __atomic_load_n(dsh_io_ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &dsh_io_ring.cqes[head & *dsh_io_ring.cq_mask];
+        struct dsh_io_source *src = (struct dsh_io_source *) (uintptr_t) (cqe->user_data & ~(uint64_t) 1);
+        int half = cqe->user_data & 1;
+
+        src->results[half] = cqe->res;
+        src->done[half] = 1;
+        dsh_stats.io_reads++;
+        head++;
+    }
+    __atomic_store_n(dsh_io_ring.cq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int dsh_io_ring_wait(struct dsh_io_source *src, int half) {
+    while (src->queued[half] && !src->done[half] && dsh_io_ring.fd >= 0) {
+        if (dsh_io_ring_enter() != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * One refill: the next chunk is wanted in the half not being read from.
+ * Usually it was queued by the previous refill and has already landed.
+ * The half just used up is free, so the read after that goes into it
+ * now, and is submitted by the same io_uring_enter() that waits.
+ */
+static ssize_t dsh_io_ring_fill(struct dsh_io_source *src) {
+    int want = !src->half;
+    ssize_t n;
+
+    // No ring after a fork(): the kernel only ever fills the parent's buffers
+    if (dsh_io_ring.fd < 0) {
+        src->queued[0] = src->queued[1] = 0;
+        do {
+            n = pread(src->fd, src->buf + want * DSH_IO_BUFSIZE, DSH_IO_BUFSIZE, src->offset);
+        } while (n < 0 && errno == EINTR);
+        dsh_stats.io_reads++;
+        if (n > 0) {
+            src->half = want;
+            src->offset += n;
+        }
+        return n;
+    }
+
+    // A read queued before a short chunk is at the wrong offset
+    if (src->queued[want] && src->offsets[want] != src->offset) {
+        if (dsh_io_ring_wait(src, want) != 0) {
+            return -1;
+        }
+        src->queued[want] = 0;
+    }
+    if (!src->queued[want]) {
+        dsh_io_ring_queue(src, want, src->offset);
+    }
+    if (!src->queued[src->half]) {
+        dsh_io_ring_queue(src, src->half, src->offset + DSH_IO_BUFSIZE);
+    }
+    if (dsh_io_ring_wait(src, want) != 0) {
+        return -1;
+    }
+
+    src->queued[want] = 0;
+    n = src->results[want];
+    if (n < 0) {
+        errno = -n;
+        return -1;
+    }
+    src->half = want;
+    src->offset += n;
+    return n;
+}
+
+#endif
+
+/*
+ * Points src (zeroed, or used before) at fd. Anything still in flight
+ * for the old descriptor is waited for first.
+ */
+void dsh_io_open(struct dsh_io_source *src, int fd) {
+    dsh_io_close(src);
+    src->fd = fd;
+    src->pos = src->len = 0;
+    src->eof = 0;
+    src->half = 1;
+    src->readahead = 0;
+
+#ifdef DSH_IO_URING
+    {
+        struct stat st;
+        off_t offset;
+
+        if (fd != STDIN_FILENO && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            (offset = lseek(fd, 0, SEEK_CUR)) >= 0 && dsh_io_ring_ready()) {
+            src->readahead = 1;
+            src->offset = offset;
+        }
+    }
+#endif
+}
+
+// Waits out reads still in flight and frees the buffer; the descriptor is the caller's
+void dsh_io_close(struct dsh_io_source *src) {
+#ifdef DSH_IO_URING
+    int half;
+
+    for (half = 0; half < 2; half++) {
+        dsh_io_ring_wait(src, half);
+        src->queued[half] = 0;
+    }
+#endif
+    free(src->buf);
+    src->buf = NULL;
+    src->pos = src->len = 0;
+}
+
+/*
+ * Refills src once everything in it has been used. The new bytes are
+ * src->buf[src->pos .. src->len). Returns how many there are, 0 at the
+ * end of the input, or -1 with errno set.
+ */
+ssize_t dsh_io_fill(struct dsh_io_source *src) {
+    ssize_t n;
+
+    if (src->eof) {
+        return 0;
+    }
+    if (src->buf == NULL) {
+        src->buf = malloc(2 * DSH_IO_BUFSIZE);
+        if (!src->buf) {
+            fprintf(stderr, "dsh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        dsh_stats.allocations++;
+    }
+
+#ifdef DSH_IO_URING
+    if (src->readahead) {
+        n = dsh_io_ring_fill(src);
+    } else
+#endif
+    {
+        src->half = 0;
+        n = dsh_io_read_plain(src->fd, src->buf, DSH_IO_BUFSIZE);
+    }
+
+    if (n <= 0) {
+        src->eof = 1;
+        src->pos = src->len = 0;
+        return n;
+    }
+    src->pos = src->half * DSH_IO_BUFSIZE;
+    src->len = src->pos + n;
+    return n;
+}
+
+// Copies the rest of src to fd
+int dsh_io_copy(struct dsh_io_source *src, int fd) {
+    ssize_t n;
+
+    while (1) {
+        if (src->pos < src->len &&
+            dsh_io_write_all(fd, src->buf + src->pos, src->len - src->pos) < 0) {
+            return -1;
+        }
+        src->pos = src->len;
+        n = dsh_io_fill(src);
+        if (n <= 0) {
+            return n;
+        }
+    }
+}
@@ -1,45 +1,90 @@
 #include <sys/types.h>//for pid_t
-#include <sys/wait.h>//for waitpid(), WIFEXITED, WUNTRACED, WIFSIGNALED
-#include <unistd.h> // for fork(), execvp()
+#include <sys/wait.h>//for waitpid(), WIFEXITED, WEXITSTATUS, WUNTRACED, WIFSIGNALED, WTERMSIG
+#include <sys/stat.h>  // for stat(), S_ISREG
+#include <unistd.h> // for isatty(), access()
+#include <fcntl.h>   // for open(), O_CLOEXEC
+#include <spawn.h>   // for posix_spawn(), posix_spawnp()
 #include <stdlib.h>  // for malloc(), realloc(), exit(), EXIT_SUCCESS
 #include <stdio.h>   // for getchar(), fprintf(), printf(), stderr
+#include <string.h>  // for strchr(), strcmp(), memchr(), memcpy()
+#include <errno.h>   // for errno, ENOENT, EINTR
+
+#include "dsh.h"
 
 #define DSH_RL_BUFSIZE 1024  // Default buffer size to start reading input
 #define DSH_TOK_BUFSIZE 64  // Starting size for our array of tokens (arguments)
 #define DSH_TOK_DELIM " \t\r\n\a"  // These characters will separate tokens (like spaces, tabs, newlines, etc.)
+#define DSH_TOK_OPS "|;()"  // and these are tokens of their own
+#define DSH_PATH_MAX 4096  // longest $PATH entry plus command name we remember
+
+extern char **environ;  // the environment we hand to every command we start
 
-int dsh_cd(char **args);
 int dsh_help(char **args);
 int dsh_exit(char **args);
+int dsh_hash(char **args);
 
 char *builtin_str[] = {
     "cd",
     "help",
-    "exit"
+    "exit",
+    "dag",
+    "memo",
+    "dshstat",
+    "timings",
+    "pushd",
+    "popd",
+    "dirs",
+    "pwd",
+    "cat",
+    "head",
+    "tail",
+    "wc",
+    "grep",
+    "walk",
+    "sort",
+    "uniq",
+    "set",
+    "time",
+    "local",
+    "unset",
+    "shift",
+    "export",
+    "hash"
 };
 
 int (*builtin_func[]) (char **) = {
     &dsh_cd,
     &dsh_help,
-    &dsh_exit
+    &dsh_exit,
+    &dsh_dag,
+    &dsh_memo,
+    &dsh_dshstat,
+    &dsh_timings,
+    &dsh_pushd,
+    &dsh_popd,
+    &dsh_dirs,
+    &dsh_pwd_builtin,
+    &dsh_cat,
+    &dsh_head,
+    &dsh_tail,
+    &dsh_wc,
+    &dsh_grep,
+    &dsh_walk,
+    &dsh_sort,
+    &dsh_uniq,
+    &dsh_set,
+    &dsh_time,
+    &dsh_local,
+    &dsh_unset,
+    &dsh_shift,
+    &dsh_export,
+    &dsh_hash
 };
 
 int dsh_num_builtins(){
     return sizeof(builtin_str) / sizeof(char *);
 }
 
-int dsh_cd(char **args){
-    if(args[1] == NULL){
-        fprintf(stderr, "dsh: expected argument to \"cd\"\n");
-    }
-    else {
-        if(chdir(args[1]) != 0){
-            perror("dsh");
-        }
-    }
-    return 1;
-}
-
 int dsh_help(char **args){
     int it;
     printf("Bhakti's Dhruva Shell");
@@ -59,10 +104,160 @@ int dsh_exit(char **args){
 }
 
 /*
- * This function launches a program.
- * It does this by forking the current process, and in the child process,
- * it replaces itself with the program we want to run using execvp().
- * 
+ * Where each command was found on $PATH, by the id of its name, for as
+ * long as $PATH equals dsh_path_seen. posix_spawnp() tries an execve()
+ * in every directory until one works, so a command in /usr/bin under a
+ * long $PATH costs several failed system calls before it starts; a
+ * remembered one costs none. As in other shells, a program put earlier
+ * on $PATH afterwards is not noticed until `hash -r`.
+ */
+static char **dsh_path_hits;
+static size_t dsh_path_cap;
+static char *dsh_path_seen;
+
+static void dsh_path_forget(void) {
+    size_t it;
+
+    for (it = 0; it < dsh_path_cap; it++) {
+        free(dsh_path_hits[it]);
+        dsh_path_hits[it] = NULL;
+    }
+}
+
+// The full path of name, or NULL to leave the search to posix_spawnp()
+static const char *dsh_path_find(const char *name) {
+    const char *path = dsh_var_lookup("PATH");
+    const char *entry;
+    char file[DSH_PATH_MAX];
+    struct stat st;
+    int id;
+
+    if (!path || !*path || strchr(name, '/')) {
+        return NULL;
+    }
+    // A different $PATH makes every remembered hit stale
+    if (!dsh_path_seen || strcmp(dsh_path_seen, path) != 0) {
+        dsh_path_forget();
+        free(dsh_path_seen);
+        dsh_path_seen = dsh_xstrdup(path);
+    }
+    // Only names found on PATH are interned: typos and one-offs would pile up
+    id = dsh_intern_find(name);
+    if (id >= 0 && (size_t) id < dsh_path_cap && dsh_path_hits[id]) {
+        return dsh_path_hits[id];
+    }
+
+    for (entry = path; entry; entry = strchr(entry, ':') ? strchr(entry, ':') + 1 : NULL) {
+        size_t len = strcspn(entry, ":");
+
+        // Relative entries depend on the directory: posix_spawnp() searches those
+        if (entry[0] != '/') {
+            return NULL;
+        }
+        if (len + strlen(name) + 2 > sizeof(file)) {
+            continue;
+        }
+        snprintf(file, sizeof(file), "%.*s/%s", (int) len, entry, name);
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0) {
+            id = dsh_intern(name);
+            if ((size_t) id >= dsh_path_cap) {
+                size_t cap = dsh_path_cap ? dsh_path_cap : DSH_TOK_BUFSIZE;
+
+                while (cap <= (size_t) id) {
+                    cap *= 2;
+                }
+                dsh_path_hits = dsh_xrealloc(dsh_path_hits, cap * sizeof(char *));
+                memset(dsh_path_hits + dsh_path_cap, 0, (cap - dsh_path_cap) * sizeof(char *));
+                dsh_path_cap = cap;
+            }
+            dsh_path_hits[id] = dsh_xstrdup(file);
+            return dsh_path_hits[id];
+        }
+    }
+    return NULL;
+}
+
+// hash [-r]: what the PATH cache remembers, or with -r, forget it
+int dsh_hash(char **args) {
+    size_t it;
+
+    if (args[1] && strcmp(args[1], "-r") == 0) {
+        dsh_path_forget();
+        return 1;
+    }
+    for (it = 0; it < dsh_path_cap; it++) {
+        if (dsh_path_hits[it]) {
+            printf("%s\n", dsh_path_hits[it]);
+        }
+    }
+    return 1;
+}
+
+/*
+ * This function starts a program without waiting for it.
+ *
+ * It used to fork() and execvp() by hand. posix_spawnp() does the same
+ * job, but glibc implements it with a vfork-style clone that shares our
+ * memory until the exec, so starting a command no longer has to copy the
+ * shell's page tables; and when the exec fails the error comes back here
+ * instead of from a half-started child. A command found on $PATH before
+ * is started from where it was found (dsh_path_find).
+ *
+ * Returns the child's pid, or -1 if it could not be started.
+ * dsh_launch() waits on the pid right away; the dag builtin and batch
+ * mode keep several of them running at once.
+ */
+pid_t dsh_spawn(char **args) {
+    return dsh_spawn_with(args, NULL);
+}
+
+// dsh_spawn() with file actions, e.g. the dup2()s that put a pipeline stage between its pipes
+pid_t dsh_spawn_with(char **args, const posix_spawn_file_actions_t *actions) {
+    const char *file;
+    pid_t pid;
+    int err = -1;
+
+    // Anything a builtin printed has to come out before the child's output
+    fflush(stdout);
+
+    dsh_prof_phase = DSH_PROF_SPAWN;
+    if ((file = dsh_path_find(args[0])) != NULL &&
+        (err = posix_spawn(&pid, file, actions, NULL, args, environ)) != 0) {
+        // Gone or changed since: forget what was found, and let posix_spawnp() search and report
+        dsh_path_forget();
+    }
+    if (err != 0) {
+        err = posix_spawnp(&pid, args[0], actions, NULL, args, environ);
+    }
+
+    if (err != 0) {
+        errno = err;
+        perror("dsh");  // print the error message, e.g. command not found
+        if (err == ENOENT) {
+            dsh_stats.exec_not_found++;
+        } else if (err == EAGAIN || err == ENOMEM) {
+            dsh_stats.fork_failures++;  // too many processes, or out of memory
+        } else {
+            dsh_stats.exec_failures++;
+        }
+        return -1;
+    }
+
+    dsh_stats.forks++;
+    return pid;
+}
+
+/*
+ * The exit status of the last command, which $? expands to: the
+ * program's own, 128+N if signal N killed it, 127 if it could not be
+ * started. A builtin that fails sets it to 1; one that works leaves the
+ * 0 dsh_dispatch() put there.
+ */
+int dsh_status;
+
+/*
+ * This function launches a program and waits for it to finish.
+ *
  * args is a NULL-terminated array of strings (just like we got from dsh_split_line).
  * args[0] is the command (like "ls"), args[1], args[2], etc. are its arguments.
  */
@@ -70,42 +265,163 @@ int dsh_launch(char **args) {
     pid_t pid, wpid;  // pid: process ID of child, wpid: for waiting
     int status;       // to store the exit status of the child
 
-    // Fork the current process: create a duplicate process
-    pid = fork();
-
-    if (pid == 0) {
-        // This block runs in the child process
-
-        /*
-         * execvp replaces the current child process image with the command in args.
-         * If it works, it doesn't return.
-         * If it fails (e.g., command not found), it returns -1.
-         */
-        if (execvp(args[0], args) == -1) {
-            perror("dsh");  // print error message if exec fails
-        }
-
-        // If exec failed, we manually exit the child process
-        exit(EXIT_FAILURE);
-    } 
-    else if (pid < 0) {
-        // fork() failed: maybe out of memory or too many processes
-        perror("dsh");  // print the error message
-    } 
-    else {
-        // This block runs in the parent process
+    pid = dsh_spawn(args);
 
+    if (pid > 0) {
         // Wait for the child process to finish
         // We use waitpid to wait specifically for the child we just created
-        do {
+        dsh_prof_phase = DSH_PROF_WAIT;
+        while (1) {
             wpid = waitpid(pid, &status, WUNTRACED);
+            if (wpid < 0) {
+                if (errno == EINTR) {
+                    continue;  // a signal arrived first; keep waiting
+                }
+                perror("dsh");
+                dsh_status = 1;
+                return 1;
+            }
             // We loop until the child either exits normally or is terminated by a signal
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+            if (WIFEXITED(status) || WIFSIGNALED(status)) {
+                break;
+            }
+        }
+        dsh_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    } else {
+        dsh_status = 127;  // it could not be started
     }
 
     return 1;  // Returning 1 so that the shell continues running
 }
 
+int dsh_is_builtin(const char *name) {
+    int id = dsh_intern_find(name);
+    return id >= 0 && id < dsh_num_builtins();
+}
+
+/*
+ * What each byte is to the tokenizer. The operators are words of their
+ * own; their tokens point into dsh_tok_ops, not into the line (see
+ * dsh_split_line). The bytes that make a word need expanding are word
+ * bytes too, marked so dsh_execute can tell in the same look whether
+ * there is anything to expand. Keep in step with DSH_TOK_DELIM,
+ * DSH_TOK_OPS and expand.c.
+ */
+enum { DSH_TOK_WORD, DSH_TOK_EXPAND, DSH_TOK_END, DSH_TOK_SPACE, DSH_TOK_OP };
+
+static const unsigned char dsh_tok_class[256] = {
+    ['\0'] = DSH_TOK_END,
+    [' '] = DSH_TOK_SPACE, ['\t'] = DSH_TOK_SPACE, ['\r'] = DSH_TOK_SPACE,
+    ['\n'] = DSH_TOK_SPACE, ['\a'] = DSH_TOK_SPACE,
+    ['|'] = DSH_TOK_OP, [';'] = DSH_TOK_OP, ['('] = DSH_TOK_OP, [')'] = DSH_TOK_OP,
+    ['$'] = DSH_TOK_EXPAND, ['*'] = DSH_TOK_EXPAND, ['?'] = DSH_TOK_EXPAND, ['['] = DSH_TOK_EXPAND,
+    ['\\'] = DSH_TOK_EXPAND
+};
+
+// Runs args with its $VARIABLES and patterns filled in, from an arena mark of its own
+static int dsh_execute_expanded(char **args) {
+    struct dsh_expand_mark mark;
+    int status;
+
+    dsh_expand_mark(&mark);
+    status = dsh_dispatch(dsh_expand(args));
+    dsh_expand_release(&mark);
+    return status;
+}
+
+/*
+ * This function decides what to do with a parsed command.
+ * A line with | ; ( ) { or } in it is a list of commands (subshell.c), each
+ * of which comes back here. A simple command has its $VARIABLES and
+ * file name patterns filled in just before it runs, so it sees what the
+ * commands before it set and made; one with neither runs as it is.
+ */
+int dsh_execute(char **args) {
+    int it, expand = 0;
+
+    if (args[0] == NULL) {
+        // An empty line: nothing to do, keep the shell running
+        return 1;
+    }
+    for (it = 0; args[it] != NULL; it++) {
+        const unsigned char *p = (const unsigned char *) args[it];
+
+        if (p[0] != '\0' && p[1] == '\0' && strchr(DSH_TOK_OPS "{}", p[0])) {
+            return dsh_list(args);
+        }
+        for (; *p; p++) {
+            expand |= dsh_tok_class[*p] == DSH_TOK_EXPAND;
+        }
+    }
+    if (args[0][0] == 't' && strcmp(args[0], "time") == 0) {
+        return dsh_time(args);  // which comes back here with the command
+    }
+    // Most commands have nothing to expand, and need no arena
+    return expand ? dsh_execute_expanded(args) : dsh_dispatch(args);
+}
+
+/*
+ * Runs a simple command whose words are already expanded. NAME=VALUE
+ * words on their own set variables. Functions and builtins run inside
+ * the shell itself (cd has to, or it would only change the directory
+ * of a child); everything else is launched.
+ *
+ * Both are found by the id of the command's name (intern.c): a builtin's
+ * id is its index in builtin_func, and functions are kept by id.
+ */
+int dsh_dispatch(char **args) {
+    struct dsh_func *func;
+    int id;
+
+    if (args[0] == NULL) {
+        return 1;  // every word expanded to nothing
+    }
+    dsh_stats.commands++;
+
+    // A name the shell has never seen is neither
+    if ((id = dsh_intern_find(args[0])) >= 0) {
+        if ((func = dsh_func_of(id)) != NULL) {
+            return dsh_func_call(func, args);
+        }
+        if (id < dsh_num_builtins()) {
+            dsh_stats.builtins++;
+            dsh_prof_phase = DSH_PROF_BUILTIN;
+            dsh_status = 0;
+            return (*builtin_func[id])(args);
+        }
+    }
+    // No function or builtin has an = in its name, so builtins need not wait for this
+    if (dsh_var_assign(args)) {
+        return 1;
+    }
+
+    return dsh_launch(args);
+}
+
+static char dsh_tok_ops[][2] = { "|", ";", "(", ")" };
+
+static char *dsh_tok_op(char c) {
+    return dsh_tok_ops[strchr(DSH_TOK_OPS, c) - DSH_TOK_OPS];
+}
+
+// Appends token, making the array bigger when it is full
+static char **dsh_tok_push(char **tokens, int *position, int *bufsize, char *token) {
+    tokens[(*position)++] = token;  // store the pointer to this token
+
+    // If we’ve run out of space in the tokens array, make it bigger!
+    if (*position >= *bufsize) {
+        *bufsize += DSH_TOK_BUFSIZE;  // increase the buffer size
+        tokens = realloc(tokens, *bufsize * sizeof(char*));  // try to reallocate
+        dsh_stats.split_growths++;
+
+        if (!tokens) {
+            fprintf(stderr, "dsh: allocation error\n");
+            exit(EXIT_FAILURE);  // again, check if reallocation failed
+        }
+    }
+    return tokens;
+}
+
 /*
  * This function takes a full line of input (like: "ls -l /home")
  * and splits it into individual parts (tokens) like: ["ls", "-l", "/home"]
@@ -117,7 +433,8 @@ char **dsh_split_line(char *line) {
 
     // Allocate memory for storing token pointers (char* array)
     char **tokens = malloc(bufsize * sizeof(char*));  
-    char *token;  // to temporarily hold each token
+
+    dsh_stats.allocations++;
 
     // Always check if malloc succeeded!
     if (!tokens) {
@@ -126,29 +443,39 @@ char **dsh_split_line(char *line) {
     }
 
     /*
-     * strtok breaks the string `line` into tokens separated by delimiters.
-     * It modifies the original string by inserting '\0' at the end of each token.
-     * First call gives the first token, subsequent calls (with NULL) give the next ones.
+     * Words are runs of characters between delimiters; the end of each
+     * one is overwritten with '\0' so it becomes a string of its own.
+     * The operators | ; ( and ) are words by themselves even when they
+     * touch another word: `(cd /tmp;ls)` is ( cd /tmp ; ls ). The
+     * operator's own character may have to become that '\0', so its
+     * token is one of dsh_tok_ops instead.
      */
-    token = strtok(line, DSH_TOK_DELIM);
-    
-    while (token != NULL) {
-        tokens[position] = token;  // store the pointer to this token
-        position++;  // move to the next slot in the tokens array
-
-        // If we’ve run out of space in the tokens array, make it bigger!
-        if (position >= bufsize) {
-            bufsize += DSH_TOK_BUFSIZE;  // increase the buffer size
-            tokens = realloc(tokens, bufsize * sizeof(char*));  // try to reallocate
-
-            if (!tokens) {
-                fprintf(stderr, "dsh: allocation error\n");
-                exit(EXIT_FAILURE);  // again, check if reallocation failed
-            }
-        }
+    for (;;) {
+        char *token;
 
-        // Get the next token (this will be NULL if we're done)
-        token = strtok(NULL, DSH_TOK_DELIM);
+        // Skip to the start of the next word
+        while (dsh_tok_class[(unsigned char) *line] == DSH_TOK_SPACE) {
+            line++;
+        }
+        if (*line == '\0') {
+            break;
+        }
+        if (dsh_tok_class[(unsigned char) *line] == DSH_TOK_OP) {
+            tokens = dsh_tok_push(tokens, &position, &bufsize, dsh_tok_op(*line++));
+            continue;
+        }
+        token = line;
+        while (dsh_tok_class[(unsigned char) *line] <= DSH_TOK_EXPAND) {  // word bytes of either kind
+            line++;
+        }
+        tokens = dsh_tok_push(tokens, &position, &bufsize, token);
+        if (dsh_tok_class[(unsigned char) *line] == DSH_TOK_OP) {
+            // An operator right after the word: take it before its character is lost
+            tokens = dsh_tok_push(tokens, &position, &bufsize, dsh_tok_op(*line));
+            *line++ = '\0';
+        } else if (*line != '\0') {
+            *line++ = '\0';
+        }
     }
 
     // After the loop, we NULL-terminate the array so we know where it ends
@@ -158,48 +485,91 @@ char **dsh_split_line(char *line) {
 
 
 /*
- * This function reads a full line of input from stdin (usually the terminal).
+ * Where commands come from: stdin unless main() opened a script file.
+ * A script is read through its own descriptor, so the commands it runs
+ * still get the shell's real stdin.
+ */
+struct dsh_io_source dsh_input;
+
+/*
+ * This function reads a full line of input from dsh_input (usually the terminal).
  * It keeps reading until the user presses Enter (newline) or Ctrl+D (EOF).
- * Since we don’t know in advance how long the input will be,
- * we dynamically grow the buffer if needed.
+ *
+ * Input arrives in chunks (see io.c); memchr() finds the end of the
+ * line in the chunk and the whole line is copied out at once, into a
+ * buffer of exactly its size. Only a line that runs past the end of a
+ * chunk needs a growing buffer, which doubles so a very long line is
+ * not copied over and over.
+ *
+ * Returns NULL once the input is used up. A last line without a newline
+ * is still returned as a line first. Only the current line is ever held
+ * in memory, so a script piped in from somewhere runs command by
+ * command, however long it is.
  */
 char *dsh_read_line(void) {
-    int bufsize = DSH_RL_BUFSIZE;  // initial size of our input buffer
-    int position = 0;              // current position to insert next character
-    char *buffer = malloc(sizeof(char) * bufsize);  // allocate memory
-    int c;  // NOTE: using int here is **very important** to handle EOF correctly
+    struct dsh_io_source *in = &dsh_input;
+    char *buffer = NULL;   // the line so far
+    size_t bufsize = 0;    // how much room buffer has
+    size_t position = 0;   // how much of it is used
 
-    // Check if malloc failed
-    if (!buffer) {
-        fprintf(stderr, "dsh: allocation error\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // Read characters one by one until newline or EOF
     while (1) {
-        c = getchar();  // reads one character from stdin
+        char *start, *newline;
+        size_t n;
 
-        // If we hit EOF (Ctrl+D) or user presses Enter, we stop reading
-        if (c == EOF || c == '\n') {
-            buffer[position] = '\0';  // null-terminate the string
-            return buffer;  // return the full line we read
-        } else {
-            buffer[position] = c;  // store the character
+        if (in->pos == in->len) {
+            ssize_t got = dsh_io_fill(in);
+            if (got < 0) {
+                perror("dsh");
+            }
+            if (got <= 0) {
+                if (buffer == NULL) {
+                    return NULL;  // nothing left to run
+                }
+                break;  // a last line without a newline
+            }
         }
-        position++;  // move to the next position
-
-        // If buffer is full, we need more space — reallocate it
-        if (position >= bufsize) {
-            bufsize += DSH_RL_BUFSIZE;  // increase buffer size
-            buffer = realloc(buffer, bufsize);  // try to reallocate more memory
 
-            // Check if realloc failed
+        start = in->buf + in->pos;
+        newline = memchr(start, '\n', in->len - in->pos);
+        n = newline ? (size_t) (newline - start) : in->len - in->pos;
+
+        if (position + n + 1 > bufsize) {
+            if (buffer == NULL && newline) {
+                bufsize = n + 1;  // the usual case: the whole line is here
+            } else {
+                if (bufsize < DSH_RL_BUFSIZE) {
+                    bufsize = DSH_RL_BUFSIZE;
+                }
+                while (position + n + 1 > bufsize) {
+                    bufsize *= 2;
+                }
+            }
+            if (buffer == NULL) {
+                dsh_stats.allocations++;
+            } else {
+                dsh_stats.read_growths++;
+            }
+            buffer = realloc(buffer, bufsize);
             if (!buffer) {
                 fprintf(stderr, "dsh: allocation error\n");
                 exit(EXIT_FAILURE);
             }
         }
+        memcpy(buffer + position, start, n);
+        position += n;
+        in->pos += n;
+
+        if (newline) {
+            in->pos++;
+            dsh_stats.bytes_read++;
+            break;
+        }
     }
+
+    buffer[position] = '\0';
+    dsh_stats.lines_read++;
+    dsh_stats.bytes_read += position;
+    return buffer;
 }
 
 
@@ -214,16 +584,44 @@ void dsh_loop(void) {
     char *line;   // holds the line typed by the user
     char **args;  // holds the command + arguments (after splitting)
     int status;   // keeps track of whether we should continue or exit
+    unsigned long long start, read_done, parse_done, done;  // for dshstat's phase timings
+    // Only prompt a person; a piped-in script would just fill stdout with prompts
+    int interactive = isatty(dsh_input.fd);
 
     /*
      * A do-while loop ensures we run the shell at least once before checking status.
      * This is perfect for a shell, because we *want* it to run until told otherwise.
      */
     do {
-        printf("dhruva > ");   // our prompt (you can customize this!)
+        if (interactive) {
+            printf("dhruva > ");   // our prompt (you can customize this!)
+            fflush(stdout);
+        }
+        dsh_prof_enter(dsh_stats.lines_read + 1, NULL);  // tell the profiler where we are
+        dsh_prof_phase = DSH_PROF_READ;
+        start = dsh_now_ns();
         line = dsh_read_line();           // 1. Read: get user input
+        read_done = dsh_now_ns();
+        if (line == NULL) {
+            // End of input (Ctrl+D, or the end of a script): same as exit
+            if (interactive) {
+                printf("\n");
+            }
+            break;
+        }
+        dsh_prof_phase = DSH_PROF_PARSE;
         args = dsh_split_line(line);      // 2. Parse: break it into command & args
-        status = dsh_execute(args);       // 3. Execute: run the command
+        parse_done = dsh_now_ns();
+        dsh_prof_enter(dsh_stats.lines_read, args[0]);
+        status = dsh_execute(args);       // 3. Execute: fill in $VARIABLES and run the command
+        done = dsh_now_ns();
+
+        dsh_stats_record(DSH_PHASE_READ, read_done - start);
+        dsh_stats_record(DSH_PHASE_PARSE, parse_done - read_done);
+        dsh_stats_record(DSH_PHASE_EXECUTE, done - parse_done);
+        if (args[0] != NULL) {
+            dsh_timing_record(args[0], done - parse_done);
+        }
 
         // After executing, we free up the memory used by line and args
         free(line);
@@ -233,11 +631,46 @@ void dsh_loop(void) {
 }
 
 
+// The benchmarks link the shell's functions into their own program
+#ifndef DSH_NO_MAIN
 int main(int argc, char **argv) {
     // Entry point of the shell.
     // argc: number of arguments
     // argv: array of arguments (e.g., script name or flags)
 
+    int argi = 1;
+
+    dsh_timing_init();  // $SECONDS counts from here
+
+    // `dsh --batch ...` runs a file of independent commands in parallel
+    if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+        return dsh_batch_main(argc - 1, argv + 1);
+    }
+
+    // `dsh --profile FILE` samples where the shell spends its time
+    // and writes collapsed stacks to FILE on exit.
+    if (argi + 1 < argc && strcmp(argv[argi], "--profile") == 0) {
+        dsh_prof_start(argv[argi + 1]);
+        argi += 2;
+    }
+
+    // `dsh SCRIPT` runs the commands in SCRIPT, one line at a time
+    if (argi < argc) {
+        if (argv[argi][0] == '-' || argi + 1 < argc) {
+            fprintf(stderr, "usage: dsh [--profile FILE] [SCRIPT]\n"
+                            "       dsh --batch [-j N] [-o LOG] [FILE]\n");
+            return EXIT_FAILURE;
+        }
+        // close-on-exec: the commands we launch should not inherit it
+        int fd = open(argv[argi], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            perror("dsh");
+            return EXIT_FAILURE;
+        }
+        dsh_io_open(&dsh_input, fd);
+        dsh_prof_set_script(argv[argi]);
+    }
+
     // Load config files, if any.
     // Useful if you want to support something like ~/.dshrc
     // You can parse it and set things like prompt or aliases.
@@ -251,8 +684,9 @@ int main(int argc, char **argv) {
 
     // Cleanup and shutdown tasks
     // If you allocated memory or opened files, you should free/close them here.
-    // For now, nothing to clean up, keeping it minimal and simple.
+    dsh_prof_finish();
 
     return EXIT_SUCCESS;
     // Return a success code to the OS.
 }
+#endif
@@ -0,0 +1,373 @@
+#include <sys/types.h>  // for pid_t
+#include <sys/stat.h>   // for stat(), mkdir()
+#include <sys/wait.h>   // for waitpid(), WIFEXITED, WEXITSTATUS
+#include <fcntl.h>      // for open(), O_* flags
+#include <unistd.h>     // for fork(), execvp(), dup2(), close(), lseek(), isatty()
+#include <errno.h>      // for errno, EEXIST, ENOENT
+#include <stdlib.h>     // for getenv(), exit()
+#include <stdio.h>      // for snprintf(), fprintf(), fscanf(), perror()
+#include <string.h>     // for strcmp(), strlen()
+
+#include "dsh.h"
+
+/*
+ * memo: replay the saved result of a deterministic command.
+ *
+ *     memo [-e VAR]... [-i FILE]... [-h FILE]... [--] COMMAND [ARGS...]
+ *
+ * The cache key is a hash of the working directory, the argv, the
+ * selected environment variables (-e), the stat() of each -i input
+ * (device, inode, size, mtime), the contents of each -h input and what
+ * the command would read on stdin (dsh_memo_hash_stdin).
+ * Entries live in $DSH_MEMO_DIR (or $XDG_CACHE_HOME/dsh/memo, or
+ * ~/.cache/dsh/memo), one directory per key holding "stdout", "stderr"
+ * and "status". On a hit the output is copied back out and the exit
+ * status becomes $? again, without running the command at all; on a
+ * miss it runs with its output captured, and the entry is published
+ * with rename() so readers never see half of it.
+ *
+ * stdout and stderr are stored separately, so their relative order is
+ * not preserved on replay.
+ */
+
+#define DSH_MEMO_DIR_MAX 4096                     // the cache directory itself
+#define DSH_MEMO_ENTRY_MAX (DSH_MEMO_DIR_MAX + 64)   // dir + "/<key>"
+#define DSH_MEMO_PATH_MAX (DSH_MEMO_ENTRY_MAX + 64)  // dir + "/<key>/stdout"
+
+// Two FNV-1a streams with different offsets, used together as a 128-bit key
+struct dsh_memo_hash {
+    unsigned long long a;
+    unsigned long long b;
+};
+
+static void dsh_memo_hash_init(struct dsh_memo_hash *h) {
+    h->a = 0xcbf29ce484222325ULL;
+    h->b = 0x84222325cbf29ce4ULL;
+}
+
+static void dsh_memo_hash_add(struct dsh_memo_hash *h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    size_t it;
+
+    for (it = 0; it < len; it++) {
+        h->a = (h->a ^ p[it]) * 0x100000001b3ULL;
+        h->b = (h->b ^ p[it]) * 0x100000001b3ULL;
+        h->b ^= h->b >> 29;
+    }
+    // A separator, so ("ab", "c") and ("a", "bc") hash differently
+    h->a = (h->a ^ 0xff) * 0x100000001b3ULL;
+    h->b = (h->b ^ 0xfe) * 0x100000001b3ULL;
+}
+
+static void dsh_memo_hash_str(struct dsh_memo_hash *h, const char *s) {
+    dsh_memo_hash_add(h, s, strlen(s));
+}
+
+// Hashes what is left to read on fd
+static int dsh_memo_hash_fd(struct dsh_memo_hash *h, int fd) {
+    struct dsh_io_source src = { 0 };
+    ssize_t n;
+
+    dsh_io_open(&src, fd);
+    while ((n = dsh_io_fill(&src)) > 0) {
+        dsh_memo_hash_add(h, src.buf + src.pos, n);
+        src.pos = src.len;
+    }
+    dsh_io_close(&src);
+    return n < 0 ? -1 : 0;
+}
+
+static int dsh_memo_hash_file(struct dsh_memo_hash *h, const char *path) {
+    int status;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+    status = dsh_memo_hash_fd(h, fd);
+    close(fd);
+    return status;
+}
+
+/*
+ * Adds what the command would read on stdin to the key. A terminal or
+ * /dev/null (or no stdin at all) gives it nothing to read that a key
+ * could hold; a regular file is hashed from where the command would
+ * start reading, and rewound to there. A pipe could only be hashed by
+ * using it up, so that, or anything else, returns -1: not memoizable.
+ */
+static int dsh_memo_hash_stdin(struct dsh_memo_hash *h) {
+    struct stat in, null;
+    off_t pos;
+
+    if (fstat(STDIN_FILENO, &in) != 0 || isatty(STDIN_FILENO) ||
+        (S_ISCHR(in.st_mode) && stat("/dev/null", &null) == 0 && in.st_rdev == null.st_rdev)) {
+        dsh_memo_hash_str(h, "stdin:none");
+        return 0;
+    }
+    if (!S_ISREG(in.st_mode) || (pos = lseek(STDIN_FILENO, 0, SEEK_CUR)) < 0) {
+        return -1;
+    }
+    dsh_memo_hash_str(h, "stdin:");
+    if (dsh_memo_hash_fd(h, STDIN_FILENO) != 0 || lseek(STDIN_FILENO, pos, SEEK_SET) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// mkdir -p; returns 0 when the directory exists afterwards
+static int dsh_memo_mkdirs(char *path) {
+    char *p;
+
+    for (p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+                *p = '/';
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+static int dsh_memo_dir(char *buf, size_t size) {
+    const char *dir = getenv("DSH_MEMO_DIR");
+    const char *base;
+    int n;
+
+    if (dir && *dir) {
+        n = snprintf(buf, size, "%s", dir);
+    } else if ((base = getenv("XDG_CACHE_HOME")) && *base) {
+        n = snprintf(buf, size, "%s/dsh/memo", base);
+    } else if ((base = getenv("HOME")) && *base) {
+        n = snprintf(buf, size, "%s/.cache/dsh/memo", base);
+    } else {
+        fprintf(stderr, "dsh: memo: set DSH_MEMO_DIR or HOME\n");
+        return -1;
+    }
+    if (n < 0 || (size_t) n >= size || dsh_memo_mkdirs(buf) != 0) {
+        fprintf(stderr, "dsh: memo: cannot create cache directory %s\n", buf);
+        return -1;
+    }
+    return 0;
+}
+
+// Copies a file to an already open descriptor
+static int dsh_memo_copy(const char *path, int out) {
+    struct dsh_io_source src = { 0 };
+    int status;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+    dsh_io_open(&src, fd);
+    status = dsh_io_copy(&src, out);
+    dsh_io_close(&src);
+    close(fd);
+    return status;
+}
+
+// Copies out what the command printed, and makes its exit status $?
+static void dsh_memo_replay(const char *entry) {
+    char path[DSH_MEMO_PATH_MAX];
+    FILE *fp;
+
+    // Flush anything the shell itself printed so the replay lands after it
+    fflush(stdout);
+    snprintf(path, sizeof(path), "%s/stdout", entry);
+    dsh_memo_copy(path, STDOUT_FILENO);
+    snprintf(path, sizeof(path), "%s/stderr", entry);
+    dsh_memo_copy(path, STDERR_FILENO);
+
+    snprintf(path, sizeof(path), "%s/status", entry);
+    fp = fopen(path, "re");
+    if (!fp || fscanf(fp, "%d", &dsh_status) != 1) {
+        dsh_status = 1;  // the command could not run, or was killed
+    }
+    if (fp) {
+        fclose(fp);
+    }
+}
+
+static void dsh_memo_remove(const char *dir) {
+    char path[DSH_MEMO_PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/stdout", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/stderr", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/status", dir);
+    unlink(path);
+    rmdir(dir);
+}
+
+/*
+ * Runs the command with stdout and stderr going to files in tmp.
+ * Returns the exit status, or -1 if it could not be run or was killed
+ * by a signal (those results are not worth remembering).
+ */
+static int dsh_memo_capture(char **args, const char *tmp) {
+    char out_path[DSH_MEMO_PATH_MAX], err_path[DSH_MEMO_PATH_MAX];
+    pid_t pid;
+    int status;
+
+    snprintf(out_path, sizeof(out_path), "%s/stdout", tmp);
+    snprintf(err_path, sizeof(err_path), "%s/stderr", tmp);
+
+    pid = fork();
+    if (pid == 0) {
+        int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        int err = open(err_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+        if (out < 0 || err < 0 || dup2(out, STDOUT_FILENO) < 0 || dup2(err, STDERR_FILENO) < 0) {
+            perror("dsh: memo");
+            _exit(EXIT_FAILURE);
+        }
+        close(out);
+        close(err);
+        execvp(args[0], args);
+        status = errno;
+        perror("dsh");
+        // _exit: the shell's atexit handlers and stdio buffers are not the child's
+        _exit(status == ENOENT ? 127 : 126);
+    } else if (pid < 0) {
+        perror("dsh");
+        dsh_stats.fork_failures++;
+        return -1;
+    }
+    dsh_stats.forks++;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            perror("dsh: memo");
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int dsh_memo(char **args) {
+    struct dsh_memo_hash h;
+    char dir[DSH_MEMO_DIR_MAX], entry[DSH_MEMO_ENTRY_MAX], tmp[DSH_MEMO_ENTRY_MAX];
+    const char *cwd = dsh_pwd();
+    struct stat st;
+    int argi = 1;
+    int status, saved;
+    FILE *fp;
+
+    dsh_memo_hash_init(&h);
+
+    // The options feed the key as they are read
+    while (args[argi] != NULL && args[argi][0] == '-') {
+        const char *opt = args[argi];
+
+        if (strcmp(opt, "--") == 0) {
+            argi++;
+            break;
+        }
+        if (strcmp(opt, "-e") != 0 && strcmp(opt, "-i") != 0 && strcmp(opt, "-h") != 0) {
+            fprintf(stderr, "dsh: memo: unknown option %s\n", opt);
+            dsh_status = 1;
+            return 1;
+        }
+        if (args[argi + 1] == NULL) {
+            fprintf(stderr, "dsh: memo: %s needs an argument\n", opt);
+            dsh_status = 1;
+            return 1;
+        }
+
+        dsh_memo_hash_str(&h, opt);
+        dsh_memo_hash_str(&h, args[argi + 1]);
+        if (opt[1] == 'e') {
+            const char *value = getenv(args[argi + 1]);
+            // Unset and empty are different keys
+            dsh_memo_hash_str(&h, value ? "=" : "!");
+            dsh_memo_hash_str(&h, value ? value : "");
+        } else if (opt[1] == 'i') {
+            if (stat(args[argi + 1], &st) != 0) {
+                perror("dsh: memo");
+                dsh_status = 1;
+                return 1;
+            }
+            dsh_memo_hash_add(&h, &st.st_dev, sizeof(st.st_dev));
+            dsh_memo_hash_add(&h, &st.st_ino, sizeof(st.st_ino));
+            dsh_memo_hash_add(&h, &st.st_size, sizeof(st.st_size));
+            dsh_memo_hash_add(&h, &st.st_mtim, sizeof(st.st_mtim));
+        } else if (dsh_memo_hash_file(&h, args[argi + 1]) != 0) {
+            perror("dsh: memo");
+            dsh_status = 1;
+            return 1;
+        }
+        argi += 2;
+    }
+
+    if (args[argi] == NULL) {
+        fprintf(stderr, "dsh: usage: memo [-e VAR]... [-i FILE]... [-h FILE]... [--] COMMAND [ARGS...]\n");
+        dsh_status = 1;
+        return 1;
+    }
+
+    if (cwd == NULL) {
+        perror("dsh: memo");
+        dsh_status = 1;
+        return 1;
+    }
+    dsh_memo_hash_str(&h, cwd);
+    for (status = argi; args[status] != NULL; status++) {
+        dsh_memo_hash_str(&h, args[status]);
+    }
+    // Input that can't be part of the key: just run the command
+    if (dsh_memo_hash_stdin(&h) != 0) {
+        return dsh_launch(args + argi);
+    }
+
+    if (dsh_memo_dir(dir, sizeof(dir)) != 0) {
+        return dsh_launch(args + argi);
+    }
+    snprintf(entry, sizeof(entry), "%s/%016llx%016llx", dir, h.a, h.b);
+
+    // A hit: the entry is only ever published complete, so its existence is enough
+    if (stat(entry, &st) == 0) {
+        dsh_stats.memo_hits++;
+        dsh_memo_replay(entry);
+        return 1;
+    }
+    dsh_stats.memo_misses++;
+
+    snprintf(tmp, sizeof(tmp), "%s/.tmp.%ld", dir, (long) getpid());
+    dsh_memo_remove(tmp);  // left over from a shell that died mid-capture
+    if (mkdir(tmp, 0700) != 0) {
+        perror("dsh: memo");
+        return dsh_launch(args + argi);
+    }
+
+    status = dsh_memo_capture(args + argi, tmp);
+    saved = 0;
+    if (status >= 0) {
+        char path[DSH_MEMO_PATH_MAX];
+
+        snprintf(path, sizeof(path), "%s/status", tmp);
+        fp = fopen(path, "w");
+        if (fp) {
+            saved = fprintf(fp, "%d\n", status) > 0;
+            saved = fclose(fp) == 0 && saved;
+        }
+    }
+    dsh_memo_replay(tmp);
+    if (status >= 0) {
+        dsh_status = status;  // even if the status file could not be written
+    }
+
+    // Without its status an entry would replay as 1 forever. Another shell
+    // may have published the same key meanwhile; theirs wins
+    if (!saved || rename(tmp, entry) != 0) {
+        dsh_memo_remove(tmp);
+    }
+    return 1;
+}
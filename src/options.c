@@ -0,0 +1,112 @@
+#include <stdlib.h>   // for strtol()
+#include <stdio.h>    // for printf(), fprintf()
+#include <string.h>   // for strcmp(), strchr(), strncmp()
+
+#include "dsh.h"
+
+/*
+ * set: the shell's options.
+ *
+ *     set -o                  list them
+ *     set -o NAME[=VALUE]     turn one on, or give it a value
+ *     set +o NAME             turn it off
+ *
+ * An option is a number in dsh_options[], read where it matters. -1
+ * means "the shell decides", as pipethreads does from the CPU count
+ * and pipesize from how earlier runs of the same pipeline went.
+ * VALUE is a number with an optional K, M or G, or auto.
+ */
+
+long dsh_options[DSH_NUM_OPTIONS] = {
+    [DSH_OPT_PIPETHREADS] = -1,
+    [DSH_OPT_PIPESIZE] = -1
+};
+
+static const char *dsh_option_names[DSH_NUM_OPTIONS] = {
+    [DSH_OPT_PIPETHREADS] = "pipethreads",
+    [DSH_OPT_PIPESIZE] = "pipesize"
+};
+
+static int dsh_option_find(const char *name, size_t len) {
+    int it;
+
+    for (it = 0; it < DSH_NUM_OPTIONS; it++) {
+        if (strncmp(name, dsh_option_names[it], len) == 0 && dsh_option_names[it][len] == '\0') {
+            return it;
+        }
+    }
+    return -1;
+}
+
+// A number with an optional K, M or G, or "auto" for -1. Returns -1 for anything else
+static int dsh_option_value(const char *value, long *out) {
+    char *end;
+    long n = strtol(value, &end, 10);
+
+    if (strcmp(value, "auto") == 0) {
+        *out = -1;
+        return 0;
+    }
+    if (end == value || n < 0) {
+        return -1;
+    }
+    switch (*end) {
+    case '\0': break;
+    case 'k': case 'K': n <<= 10; break;
+    case 'm': case 'M': n <<= 20; break;
+    case 'g': case 'G': n <<= 30; break;
+    default: return -1;
+    }
+    if (*end && end[1] != '\0') {
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+int dsh_set(char **args) {
+    int it;
+
+    if (args[1] == NULL || (strcmp(args[1], "-o") == 0 && args[2] == NULL)) {
+        for (it = 0; it < DSH_NUM_OPTIONS; it++) {
+            long value = dsh_options[it];
+            if (value < 0) {
+                printf("%-16s auto\n", dsh_option_names[it]);
+            } else if (value <= 1) {
+                printf("%-16s %s\n", dsh_option_names[it], value ? "on" : "off");
+            } else {
+                printf("%-16s %ld\n", dsh_option_names[it], value);
+            }
+        }
+        return 1;
+    }
+
+    for (it = 1; args[it] != NULL; it += 2) {
+        const char *name = args[it + 1];
+        const char *equals;
+        int option;
+
+        if ((strcmp(args[it], "-o") != 0 && strcmp(args[it], "+o") != 0) || name == NULL) {
+            fprintf(stderr, "dsh: usage: set [-o|+o NAME[=VALUE]]...\n");
+            dsh_status = 1;
+            return 1;
+        }
+        equals = strchr(name, '=');
+        option = dsh_option_find(name, equals ? (size_t) (equals - name) : strlen(name));
+        if (option < 0) {
+            fprintf(stderr, "dsh: set: %s: no such option\n", name);
+            dsh_status = 1;
+            return 1;
+        }
+        if (args[it][0] == '+') {
+            dsh_options[option] = 0;
+        } else if (equals == NULL) {
+            dsh_options[option] = 1;
+        } else if (dsh_option_value(equals + 1, &dsh_options[option]) != 0) {
+            fprintf(stderr, "dsh: set: %s: not a size\n", name);
+            dsh_status = 1;
+            return 1;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,424 @@
+#define _GNU_SOURCE      // for pipe2(), F_SETPIPE_SZ
+#include <sys/types.h>   // for pid_t
+#include <sys/wait.h>    // for waitpid(), WIFEXITED, WEXITSTATUS, WTERMSIG
+#include <sys/resource.h> // for getrusage(), struct rusage
+#include <spawn.h>       // for posix_spawn_file_actions_init(), posix_spawn_file_actions_adddup2()
+#include <fcntl.h>       // for open(), fcntl(), O_CLOEXEC
+#include <unistd.h>      // for pipe2(), fork(), dup2(), close(), _exit(), sysconf()
+#include <errno.h>       // for errno, EINTR
+#include <stdlib.h>      // for EXIT_SUCCESS
+#include <stdio.h>       // for fprintf(), perror(), fflush(), fopen(), fscanf()
+#include <string.h>      // for strcmp(), strerror(), memmove()
+
+#include "dsh.h"
+
+/*
+ * Pipelines: `cat f | grep x | wc -l`.
+ *
+ * When every stage is a builtin that is also a stream operator (text.c,
+ * grep.c, sort.c), nothing is started. The stages become one chain of
+ * streams inside the shell: the first stage's files are fed into the
+ * head of the chain and its tail writes to stdout. Buffers go down the
+ * chain by reference, so a mapped file reaches `wc -l` with no pipe,
+ * no fork and no copy, and a `head` that has enough stops the feed.
+ * A `sort | uniq -c` in the chain becomes one hash aggregate.
+ *
+ * With CPUs to spare (or `set -o pipethreads`), the stages after the
+ * first run on threads of their own, each fed through a ring (ring.c)
+ * instead of a pipe: the stages work at the same time and the data still
+ * never goes through the kernel.
+ *
+ * Anything else - an external command, an option only the real program
+ * knows, a later stage with files of its own - runs the classic way:
+ * one process per stage, joined by pipes, with builtins, functions and
+ * ( ... ) or { ... } groups in a fork()ed copy of the shell.
+ */
+
+#define DSH_PIPELINE_MAX 64
+
+typedef struct dsh_stream *(*dsh_stage_maker)(char **args, char ***operands, struct dsh_stream *next);
+
+static const struct {
+    const char *name;
+    dsh_stage_maker make;
+    int many;  // as the first stage, may read several files one after the other
+} dsh_pipeline_stages[] = {
+    { "cat", dsh_text_stage, 1 },
+    { "head", dsh_text_stage, 0 },
+    { "tail", dsh_text_stage, 0 },
+    { "wc", dsh_text_stage, 0 },
+    { "grep", dsh_grep_stage, 0 },
+    { "sort", dsh_sort_stage, 0 },
+    { "uniq", dsh_sort_stage, 0 }
+};
+
+#define DSH_PIPELINE_NUM_STAGES ((int) (sizeof(dsh_pipeline_stages) / sizeof(dsh_pipeline_stages[0])))
+
+// Where a chain that is given up on drains into; it wants nothing
+static int dsh_null_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    return 1;
+}
+
+static int dsh_null_close(struct dsh_stream *stream) {
+    return 0;
+}
+
+static struct dsh_stream dsh_null_stream = { dsh_null_write, dsh_null_close, NULL };
+
+// A ( ... ) or { ... } stage
+static int dsh_pipeline_is_group(const char *word) {
+    return (word[0] == '(' || word[0] == '{') && word[1] == '\0';
+}
+
+// Which stream builtin name is, or -1; a function of that name wins
+static int dsh_pipeline_kind(const char *name) {
+    int it;
+
+    if (dsh_func_find(name)) {
+        return -1;
+    }
+    for (it = 0; it < DSH_PIPELINE_NUM_STAGES; it++) {
+        if (strcmp(name, dsh_pipeline_stages[it].name) == 0) {
+            return it;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Runs the stages as one chain of streams. Returns 0, having run
+ * nothing, when some stage needs a process of its own.
+ *
+ * The streams are made front to back with no next and linked once all
+ * of them exist, so giving up half way only has to drain what was made.
+ */
+static int dsh_pipeline_fuse(char **stages[], int n) {
+    struct dsh_stream *chain[2 * DSH_PIPELINE_MAX];
+    char **first = NULL;
+    struct dsh_stream *out;
+    long rings;
+    int built = 0, fits = 1, failed = 0, it;
+
+    // Every stage is a builtin; the threads behind rings are not sampled (profile.c)
+    dsh_prof_phase = DSH_PROF_BUILTIN;
+    dsh_status = 0;  // not the last command's, whatever the stages leave it at
+    for (it = 0; it < n && fits; it++) {
+        struct dsh_stream *stream = NULL;
+        char **operands = NULL;
+        int kind = dsh_pipeline_kind(stages[it][0]);
+        int start = it, count;
+
+        if (kind < 0) {
+            break;
+        }
+        if (it + 1 < n && strcmp(stages[it][0], "sort") == 0 && strcmp(stages[it + 1][0], "uniq") == 0) {
+            stream = dsh_sort_count_stage(stages[it], stages[it + 1], &operands, NULL);
+            it += stream != NULL;
+        }
+        if (stream == NULL) {
+            stream = dsh_pipeline_stages[kind].make(stages[it], &operands, NULL);
+        }
+        if (stream == NULL) {
+            break;
+        }
+        chain[built++] = stream;
+
+        for (count = 0; operands[count] != NULL; count++) {
+            ;
+        }
+        // Later stages read the pipe, not files; several files only where that means one after the other
+        fits = start == 0 ? count <= 1 || dsh_pipeline_stages[kind].many : count == 0;
+        if (start == 0) {
+            first = operands;
+        }
+    }
+
+    if (it < n || !fits) {
+        for (it = 0; it < built; it++) {
+            chain[it]->next = &dsh_null_stream;
+            chain[it]->close(chain[it]);
+        }
+        return 0;
+    }
+
+    // Stages after the first get threads of their own, each behind a ring
+    rings = dsh_options[DSH_OPT_PIPETHREADS] < 0 ? sysconf(_SC_NPROCESSORS_ONLN) - 1
+            : dsh_options[DSH_OPT_PIPETHREADS] ? built - 1 : 0;
+    for (it = built - 1; it > 0 && rings > 0; it--, rings--) {
+        memmove(chain + it + 1, chain + it, (built - it) * sizeof(*chain));
+        chain[it] = dsh_ring_stream(NULL);
+        built++;
+    }
+
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    for (it = 0; it < built; it++) {
+        chain[it]->next = it + 1 < built ? chain[it + 1] : out;
+    }
+
+    if (first[0] == NULL) {
+        dsh_stream_feed(chain[0], STDIN_FILENO, "-");
+    }
+    for (it = 0; first[it] != NULL; it++) {
+        int fd = STDIN_FILENO;
+
+        if (strcmp(first[it], "-") != 0 && (fd = open(first[it], O_RDONLY | O_CLOEXEC)) < 0) {
+            fprintf(stderr, "dsh: %s: %s: %s\n", stages[0][0], first[it], strerror(errno));
+            failed = 1;
+            continue;
+        }
+        dsh_stream_feed(chain[0], fd, first[it]);
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+
+    /*
+     * Each close flushes into the next stream, which is still open. The
+     * status is the last stage's, as in dsh_pipeline_spawn(): one of an
+     * earlier stage (a grep that found nothing) is wiped before it
+     * closes. A file the first stage could not read makes it 1 only if
+     * that stage is also the last.
+     */
+    for (it = 0; it < built; it++) {
+        if (it == built - 1) {
+            dsh_status = 0;
+        }
+        chain[it]->close(chain[it]);
+    }
+    out->close(out);
+    if (failed && built == 1) {
+        dsh_status = 1;
+    }
+    dsh_stats.pipelines_fused++;
+    return 1;
+}
+
+/*
+ * How big the pipes between programs are.
+ *
+ * The kernel's 64 KB means a writer and a reader moving gigabytes take
+ * turns every 64 KB: a context switch or two for each. `set -o
+ * pipesize=SIZE` gives every pipe SIZE bytes (F_SETPIPE_SZ), `set -o
+ * pipesize` the most the system allows (/proc/sys/fs/pipe-max-size),
+ * `set +o pipesize` the kernel's default.
+ *
+ * By default each pipeline learns. One that ran for a while with its
+ * processes switching more than DSH_PIPE_BUSY times a second gets pipes
+ * four times as big the next time it runs, up to the maximum. Pipelines
+ * are told apart by their command names.
+ */
+#define DSH_PIPE_LEARNED 64               // pipelines remembered
+#define DSH_PIPE_BUSY 2000                // context switches a second that mean the pipes are too small
+#define DSH_PIPE_MIN_NS 50000000ULL       // a shorter run says nothing
+#define DSH_PIPE_DEFAULT 65536            // the kernel's size
+
+static struct {
+    unsigned long key;  // 0: unused
+    long size;
+} dsh_pipe_learned[DSH_PIPE_LEARNED];
+
+static unsigned long dsh_pipe_key(char **stages[], int n) {
+    unsigned long key = 5381;
+    const char *p;
+    int it;
+
+    for (it = 0; it < n; it++) {
+        for (p = stages[it][0]; *p; p++) {
+            key = key * 33 ^ (unsigned char) *p;
+        }
+        key = key * 33 ^ '|';
+    }
+    return key | 1;
+}
+
+static long dsh_pipe_max(void) {
+    static long max;
+    FILE *fp;
+
+    if (max == 0) {
+        max = 1 << 20;  // the usual limit, if it cannot be read
+        fp = fopen("/proc/sys/fs/pipe-max-size", "r");
+        if (fp) {
+            if (fscanf(fp, "%ld", &max) != 1 || max < DSH_PIPE_DEFAULT) {
+                max = 1 << 20;
+            }
+            fclose(fp);
+        }
+    }
+    return max;
+}
+
+/*
+ * One process per stage, each reading the pipe before it and writing
+ * the one after it. The shell closes its copies of the pipe ends as it
+ * goes, so every reader sees end of file when its writer is done.
+ */
+static int dsh_pipeline_spawn(char **stages[], int n) {
+    pid_t pids[DSH_PIPELINE_MAX];
+    unsigned long key = dsh_pipe_key(stages, n);
+    int slot = key % DSH_PIPE_LEARNED;
+    long size = dsh_options[DSH_OPT_PIPESIZE];
+    struct rusage before, after;
+    unsigned long long start, ns;
+    pid_t last = -1;  // the last stage, whose status is the pipeline's
+    int in = -1, started = 0, it, status;
+
+    if (size < 0) {
+        size = dsh_pipe_learned[slot].key == key ? dsh_pipe_learned[slot].size : 0;
+    } else if (size == 1 || size > dsh_pipe_max()) {
+        size = dsh_pipe_max();
+    }
+    getrusage(RUSAGE_CHILDREN, &before);
+    start = dsh_now_ns();
+
+    fflush(stdout);
+    for (it = 0; it < n; it++) {
+        int fds[2] = { -1, -1 };
+        pid_t pid = -1;
+
+        if (it + 1 < n && pipe2(fds, O_CLOEXEC) != 0) {
+            perror("dsh");
+            break;
+        }
+        if (fds[1] >= 0 && size > 0) {
+            fcntl(fds[1], F_SETPIPE_SZ, (int) size);  // only a hint: a full pipe just stays smaller
+        }
+        if (dsh_is_builtin(stages[it][0]) || dsh_func_find(stages[it][0]) || dsh_pipeline_is_group(stages[it][0])) {
+            dsh_prof_phase = DSH_PROF_SPAWN;
+            pid = fork();
+            if (pid == 0) {
+                if (in >= 0) {
+                    dup2(in, STDIN_FILENO);
+                    close(in);
+                }
+                if (fds[1] >= 0) {
+                    dup2(fds[1], STDOUT_FILENO);
+                    close(fds[1]);
+                    close(fds[0]);
+                }
+                if (dsh_pipeline_is_group(stages[it][0])) {
+                    dsh_execute(stages[it]);  // its words are expanded as its commands run
+                } else {
+                    dsh_dispatch(stages[it]);
+                }
+                fflush(stdout);
+                _exit(dsh_status);
+            }
+            if (pid < 0) {
+                perror("dsh");
+                dsh_stats.fork_failures++;
+            } else {
+                dsh_stats.forks++;
+            }
+        } else {
+            posix_spawn_file_actions_t actions;
+
+            // The pipes are close-on-exec; only the dup2()ed copies make it into the program
+            posix_spawn_file_actions_init(&actions);
+            if (in >= 0) {
+                posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+            }
+            if (fds[1] >= 0) {
+                posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+            }
+            pid = dsh_spawn_with(stages[it], &actions);
+            posix_spawn_file_actions_destroy(&actions);
+        }
+
+        if (pid > 0) {
+            pids[started++] = pid;
+            last = it == n - 1 ? pid : last;
+        }
+        if (in >= 0) {
+            close(in);
+        }
+        if (fds[1] >= 0) {
+            close(fds[1]);
+        }
+        in = fds[0];
+    }
+    if (in >= 0) {
+        close(in);
+    }
+
+    dsh_prof_phase = DSH_PROF_WAIT;
+    dsh_status = 127;  // unless the last stage started
+    for (it = 0; it < started; it++) {
+        while (waitpid(pids[it], &status, 0) < 0 && errno == EINTR) {
+            ;
+        }
+        if (pids[it] == last) {
+            dsh_status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+    }
+
+    ns = dsh_now_ns() - start;
+    getrusage(RUSAGE_CHILDREN, &after);
+    if (dsh_options[DSH_OPT_PIPESIZE] < 0 && n > 1 && ns > DSH_PIPE_MIN_NS) {
+        long switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+        long current = size > 0 ? size : DSH_PIPE_DEFAULT;
+
+        if (switches * 1e9 / ns > DSH_PIPE_BUSY && current < dsh_pipe_max()) {
+            dsh_pipe_learned[slot].key = key;
+            dsh_pipe_learned[slot].size = current * 4 < dsh_pipe_max() ? current * 4 : dsh_pipe_max();
+        }
+    }
+    return 1;
+}
+
+/*
+ * Runs args, which has at least one "|" word in it. The words are
+ * expanded first, all stages at once. The "|" words are cut out while
+ * it runs and put back afterwards, so the caller gets its array back
+ * as it was.
+ */
+int dsh_pipeline(char **args) {
+    char **stages[DSH_PIPELINE_MAX];
+    struct dsh_expand_mark mark;
+    char *bar = NULL;
+    int n = 1, depth = 0, it;
+
+    dsh_expand_mark(&mark);
+    args = dsh_expand(args);
+    stages[0] = args;
+    for (it = 0; args[it] != NULL; it++) {
+        // A "|" inside a ( ... ) or { ... } stage belongs to that stage
+        if (args[it][0] != '\0' && args[it][1] == '\0' && strchr("({)}", args[it][0])) {
+            depth += args[it][0] == '(' || args[it][0] == '{' ? 1 : -1;
+        }
+        if (depth > 0 || args[it][0] != '|' || args[it][1] != '\0') {
+            continue;
+        }
+        if (it == 0 || stages[n - 1] == args + it || args[it + 1] == NULL) {
+            fprintf(stderr, "dsh: syntax error near `|'\n");
+            n = 0;
+            break;
+        }
+        if (n == DSH_PIPELINE_MAX) {
+            fprintf(stderr, "dsh: more than %d commands in a pipeline\n", DSH_PIPELINE_MAX);
+            n = 0;
+            break;
+        }
+        stages[n++] = args + it + 1;
+    }
+    if (n == 0) {
+        dsh_expand_release(&mark);
+        return 1;
+    }
+
+    for (it = 1; it < n; it++) {
+        bar = stages[it][-1];
+        stages[it][-1] = NULL;
+    }
+    dsh_stats.commands++;
+    dsh_stats.pipelines++;
+    if (!dsh_pipeline_fuse(stages, n)) {
+        dsh_pipeline_spawn(stages, n);
+    }
+    for (it = 1; it < n; it++) {
+        stages[it][-1] = bar;
+    }
+    dsh_expand_release(&mark);
+    return 1;
+}
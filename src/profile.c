@@ -0,0 +1,265 @@
+#define _GNU_SOURCE       // for SIGEV_THREAD_ID
+#include <sys/syscall.h>  // for SYS_gettid
+#include <signal.h>       // for sigaction(), sigprocmask(), SIGPROF
+#include <time.h>         // for timer_create(), timer_settime()
+#include <unistd.h>       // for syscall()
+#include <stdlib.h>       // for calloc(), free(), getenv(), atol()
+#include <stdio.h>        // for fopen(), fprintf()
+#include <string.h>       // for memset(), strchr()
+
+#include "dsh.h"
+
+/*
+ * A sampling profiler for the shell itself: `dsh --profile FILE`.
+ *
+ * A POSIX timer on CLOCK_MONOTONIC raises SIGPROF $DSH_PROFILE_HZ times
+ * a second (default 99). It counts wall time rather than CPU time, so
+ * the samples taken while the shell sits in waitpid() show up too.
+ * The signal goes to the main thread alone (SIGEV_THREAD_ID): the
+ * threads of walk, sort and threaded pipelines never run the handler,
+ * so blocking SIGPROF in the main thread keeps it out of a fold.
+ * The handler notes which script line and command are running and what
+ * the shell is doing (dsh_prof_phase), and appends that to a ring,
+ * bumping the last entry instead when nothing has changed, so a
+ * command that runs for hours takes up one slot. The loop folds the
+ * ring into a table now and then, outside the handler.
+ *
+ * At exit FILE gets one collapsed stack per (line, command, phase):
+ *
+ *     dsh;stdin:12;make;wait 5312
+ *
+ * which is what flamegraph.pl and similar tools read.
+ */
+
+#define DSH_PROF_RING 4096          // samples between two folds, at most
+#define DSH_PROF_TABLE_BUFSIZE 256  // starting size of the fold table
+#define DSH_PROF_MAX_NAMES 1024     // names the profiler will intern itself
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid  // what glibc calls it, when it does
+#endif
+
+struct dsh_prof_sample {
+    long line;
+    int cmd;     // id of the command's name (intern.c), -1 outside of a command
+    int phase;
+    unsigned long count;
+};
+
+volatile sig_atomic_t dsh_prof_phase;
+int dsh_prof_active;
+
+static volatile long dsh_prof_line;
+static volatile int dsh_prof_cmd = -1;
+static size_t dsh_prof_names;
+
+static struct dsh_prof_sample dsh_prof_ring[DSH_PROF_RING];
+static volatile sig_atomic_t dsh_prof_len;
+static unsigned long dsh_prof_dropped;
+
+// Folded samples; a linear probing table keyed on (line, cmd, phase)
+static struct dsh_prof_sample *dsh_prof_table;
+static size_t dsh_prof_table_cap;
+static size_t dsh_prof_table_len;
+
+static const char *dsh_prof_file;
+static const char *dsh_prof_script = "stdin";
+
+static const char *dsh_prof_phase_names[DSH_PROF_NUM_PHASES] = {
+    "read",
+    "parse",
+    "builtin",
+    "spawn",
+    "wait"
+};
+
+static void dsh_prof_handler(int sig) {
+    long line = dsh_prof_line;
+    int cmd = dsh_prof_cmd;
+    int phase = dsh_prof_phase;
+    int len = dsh_prof_len;
+
+    (void) sig;
+    if (len > 0) {
+        struct dsh_prof_sample *last = &dsh_prof_ring[len - 1];
+        if (last->line == line && last->cmd == cmd && last->phase == phase) {
+            last->count++;
+            return;
+        }
+    }
+    if (len >= DSH_PROF_RING) {
+        dsh_prof_dropped++;
+        return;
+    }
+    dsh_prof_ring[len].line = line;
+    dsh_prof_ring[len].cmd = cmd;
+    dsh_prof_ring[len].phase = phase;
+    dsh_prof_ring[len].count = 1;
+    dsh_prof_len = len + 1;
+}
+
+static size_t dsh_prof_slot(const struct dsh_prof_sample *s, size_t cap) {
+    size_t h = (size_t) s->line * 0x9e3779b97f4a7c15ULL;
+    h ^= (size_t) (s->cmd + 1) * 0xc2b2ae3d27d4eb4fULL;
+    h ^= (size_t) s->phase;
+    return (h ^ (h >> 31)) & (cap - 1);
+}
+
+static void dsh_prof_table_add(const struct dsh_prof_sample *s) {
+    size_t slot;
+
+    // Keep the table at most half full
+    if ((dsh_prof_table_len + 1) * 2 > dsh_prof_table_cap) {
+        struct dsh_prof_sample *old = dsh_prof_table;
+        size_t old_cap = dsh_prof_table_cap;
+        size_t it;
+
+        dsh_prof_table_cap = old_cap ? old_cap * 2 : DSH_PROF_TABLE_BUFSIZE;
+        dsh_prof_table = calloc(dsh_prof_table_cap, sizeof(*dsh_prof_table));
+        if (!dsh_prof_table) {
+            fprintf(stderr, "dsh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+        dsh_prof_table_len = 0;
+        for (it = 0; it < old_cap; it++) {
+            if (old[it].count) {
+                dsh_prof_table_add(&old[it]);
+            }
+        }
+        free(old);
+    }
+
+    slot = dsh_prof_slot(s, dsh_prof_table_cap);
+    while (dsh_prof_table[slot].count) {
+        struct dsh_prof_sample *t = &dsh_prof_table[slot];
+        if (t->line == s->line && t->cmd == s->cmd && t->phase == s->phase) {
+            t->count += s->count;
+            return;
+        }
+        slot = (slot + 1) & (dsh_prof_table_cap - 1);
+    }
+    dsh_prof_table[slot] = *s;
+    dsh_prof_table_len++;
+}
+
+// Moves the ring into the table with SIGPROF held off
+static void dsh_prof_fold(void) {
+    sigset_t block, old;
+    int it;
+
+    sigemptyset(&block);
+    sigaddset(&block, SIGPROF);
+    sigprocmask(SIG_BLOCK, &block, &old);
+    for (it = 0; it < dsh_prof_len; it++) {
+        dsh_prof_table_add(&dsh_prof_ring[it]);
+    }
+    dsh_prof_len = 0;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+int dsh_prof_start(const char *path) {
+    struct sigaction sa;
+    struct sigevent sev;
+    struct itimerspec its;
+    timer_t timer;
+    const char *hz_env = getenv("DSH_PROFILE_HZ");
+    long hz = hz_env ? atol(hz_env) : 99;
+
+    if (hz < 1 || hz > 100000) {
+        hz = 99;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = dsh_prof_handler;
+    // Interrupted read()s and waitpid()s pick up where they left off
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) != 0) {
+        perror("dsh: profile");
+        return -1;
+    }
+
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_MONOTONIC, &sev, &timer) != 0) {
+        perror("dsh: profile");
+        return -1;
+    }
+    its.it_interval.tv_sec = 1 / hz;  // 1 Hz is a whole second, not 1e9 ns
+    its.it_interval.tv_nsec = 1000000000L / hz % 1000000000L;
+    its.it_value = its.it_interval;
+    if (timer_settime(timer, 0, &its, NULL) != 0) {
+        perror("dsh: profile");
+        return -1;
+    }
+
+    dsh_prof_file = path;
+    dsh_prof_active = 1;
+    return 0;
+}
+
+void dsh_prof_set_script(const char *name) {
+    dsh_prof_script = name;
+}
+
+/*
+ * Called by the loop before every command. Looking the name up here
+ * keeps the handler down to a few loads and stores; its id is one hash
+ * probe, however many commands have been seen. A name that is not
+ * interned yet (a path) takes one of DSH_PROF_MAX_NAMES; assignments,
+ * operator words and names past that go under "(other)", so a long
+ * script of them cannot grow the names without end.
+ */
+void dsh_prof_enter(long line, const char *cmd) {
+    int id = -1;
+
+    if (!dsh_prof_active) {
+        return;
+    }
+    if (dsh_prof_len >= DSH_PROF_RING / 2) {
+        dsh_prof_fold();
+    }
+
+    if (cmd && !strchr(cmd, '=') && !(cmd[0] != '\0' && cmd[1] == '\0' && strchr("|;(){}", cmd[0]))) {
+        id = dsh_intern_find(cmd);
+        if (id < 0 && dsh_prof_names < DSH_PROF_MAX_NAMES) {
+            id = dsh_intern(cmd);
+            dsh_prof_names++;
+        }
+    }
+    dsh_prof_line = line;
+    dsh_prof_cmd = id;
+}
+
+void dsh_prof_finish(void) {
+    FILE *fp;
+    size_t it;
+
+    if (!dsh_prof_active) {
+        return;
+    }
+    signal(SIGPROF, SIG_IGN);
+    dsh_prof_active = 0;
+    dsh_prof_fold();
+
+    fp = fopen(dsh_prof_file, "w");
+    if (!fp) {
+        perror("dsh: profile");
+        return;
+    }
+    for (it = 0; it < dsh_prof_table_cap; it++) {
+        const struct dsh_prof_sample *s = &dsh_prof_table[it];
+        if (!s->count) {
+            continue;
+        }
+        fprintf(fp, "dsh;%s:%ld;%s;%s %lu\n", dsh_prof_script, s->line,
+                s->cmd >= 0 ? dsh_intern_name(s->cmd) : s->phase == DSH_PROF_READ ? "(prompt)" : "(other)",
+                dsh_prof_phase_names[s->phase], s->count);
+    }
+    fclose(fp);
+    if (dsh_prof_dropped) {
+        fprintf(stderr, "dsh: profile: %lu samples dropped\n", dsh_prof_dropped);
+    }
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE            // for syscall()
+#include <linux/futex.h>       // for FUTEX_WAIT_PRIVATE, FUTEX_WAKE_PRIVATE
+#include <sys/syscall.h>       // for SYS_futex
+#include <pthread.h>           // for pthread_create(), pthread_join()
+#include <stdatomic.h>         // for atomic_uint, atomic_int
+#include <unistd.h>            // for syscall()
+#include <stdlib.h>            // for posix_memalign(), malloc(), free()
+#include <stdio.h>             // for fprintf()
+#include <string.h>            // for memcpy(), memset()
+
+#include "dsh.h"
+
+/*
+ * A stream that hands what it is given to another thread: the stages
+ * after it in a pipeline run there while the ones before it go on.
+ *
+ * The two threads share a ring of DSH_RING_SLOTS blocks of
+ * DSH_RING_BLOCK bytes. The writer copies into the block at `head`
+ * and publishes it by moving head on; the reader passes the block at
+ * `tail` down its chain and gives it back by moving tail on. Each
+ * counter has one writer, so there are no locks, and each sits on its
+ * own cache line so the two sides do not steal it from each other.
+ *
+ * A side that finds the ring full (or empty) says so in a flag and
+ * sleeps in futex() on the other side's counter; the other side only
+ * makes the wake-up call when it sees the flag. Under a steady stream
+ * nobody sleeps and no system call is made at all. A full ring blocks
+ * the writer, which is the backpressure a pipe gives.
+ *
+ * Blocks are published when full, or earlier if the reader is idle,
+ * so a slow trickle of input does not sit in a half-full block.
+ */
+
+#define DSH_RING_SLOTS 8
+#define DSH_RING_BLOCK (256 * 1024)
+#define DSH_RING_LINE 64  // bytes in a cache line
+
+struct dsh_ring_slot {
+    char *data;
+    size_t len;  // 0 in a published slot: the end
+};
+
+struct dsh_ring_stream {
+    struct dsh_stream base;
+    pthread_t thread;
+    int started;
+    int direct;               // no thread could be started: pass writes on in place
+    unsigned filled;          // the writer's own copy of head
+    struct dsh_ring_slot slots[DSH_RING_SLOTS];
+
+    // the writer's
+    _Alignas(DSH_RING_LINE) atomic_uint head;  // slots published
+    atomic_int writer_sleeps;
+
+    // the reader's
+    _Alignas(DSH_RING_LINE) atomic_uint tail;  // slots given back
+    atomic_int reader_sleeps;
+    atomic_int stop;          // what the chain after the ring last said: 1 enough, -1 error
+};
+
+static void dsh_ring_sleep(atomic_uint *word, unsigned seen, atomic_int *sleeps) {
+    atomic_store(sleeps, 1);
+    // If the other side moved on after our last look, this returns at once
+    if (atomic_load(word) == seen) {
+        syscall(SYS_futex, (unsigned *) word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    }
+    atomic_store(sleeps, 0);
+}
+
+static void dsh_ring_wake(atomic_uint *word, atomic_int *sleeps) {
+    if (atomic_load(sleeps)) {
+        syscall(SYS_futex, (unsigned *) word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
+
+static void *dsh_ring_read(void *arg) {
+    struct dsh_ring_stream *rs = arg;
+    struct dsh_stream *next = rs->base.next;
+    unsigned tail = 0;
+    int status = 0;
+
+    for (;;) {
+        struct dsh_ring_slot *slot;
+
+        while (atomic_load(&rs->head) == tail) {
+            dsh_ring_sleep(&rs->head, tail, &rs->reader_sleeps);
+        }
+        slot = &rs->slots[tail % DSH_RING_SLOTS];
+        if (slot->len == 0) {
+            return NULL;  // the end: the writer is in close(), waiting for us
+        }
+        // After the chain has had enough, the blocks are only given back
+        if (status == 0 && (status = next->write(next, slot->data, slot->len)) != 0) {
+            atomic_store(&rs->stop, status);
+        }
+        slot->len = 0;
+        atomic_store(&rs->tail, ++tail);
+        dsh_ring_wake(&rs->tail, &rs->writer_sleeps);
+    }
+}
+
+// Waits for the slot at filled to be free
+static struct dsh_ring_slot *dsh_ring_slot(struct dsh_ring_stream *rs) {
+    unsigned tail;
+    struct dsh_ring_slot *slot;
+
+    while (rs->filled - (tail = atomic_load(&rs->tail)) == DSH_RING_SLOTS) {
+        dsh_ring_sleep(&rs->tail, tail, &rs->writer_sleeps);
+    }
+    slot = &rs->slots[rs->filled % DSH_RING_SLOTS];
+    if (slot->data == NULL) {
+        slot->data = malloc(DSH_RING_BLOCK);
+        if (!slot->data) {
+            fprintf(stderr, "dsh: allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return slot;
+}
+
+static void dsh_ring_publish(struct dsh_ring_stream *rs) {
+    atomic_store(&rs->head, ++rs->filled);
+    dsh_ring_wake(&rs->head, &rs->reader_sleeps);
+}
+
+static int dsh_ring_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_ring_stream *rs = (struct dsh_ring_stream *) stream;
+    struct dsh_ring_slot *slot = NULL;
+    int stop;
+
+    if (rs->direct) {
+        return stream->next->write(stream->next, buf, len);
+    }
+    if (!rs->started) {
+        // Started on first use: by now the pipeline has linked next in
+        rs->started = 1;
+        if (pthread_create(&rs->thread, NULL, dsh_ring_read, rs) != 0) {
+            rs->direct = 1;
+            return stream->next->write(stream->next, buf, len);
+        }
+    }
+    if ((stop = atomic_load(&rs->stop)) != 0) {
+        return stop;
+    }
+
+    while (len > 0) {
+        size_t n;
+
+        slot = dsh_ring_slot(rs);
+        n = DSH_RING_BLOCK - slot->len < len ? DSH_RING_BLOCK - slot->len : len;
+        memcpy(slot->data + slot->len, buf, n);
+        slot->len += n;
+        buf += n;
+        len -= n;
+        if (slot->len == DSH_RING_BLOCK) {
+            dsh_ring_publish(rs);
+            slot = NULL;
+        }
+    }
+    if (slot && atomic_load(&rs->reader_sleeps)) {
+        dsh_ring_publish(rs);  // the reader has nothing to do: give it what there is
+    }
+    return 0;
+}
+
+static int dsh_ring_close(struct dsh_stream *stream) {
+    struct dsh_ring_stream *rs = (struct dsh_ring_stream *) stream;
+    int it, status;
+
+    if (rs->started && !rs->direct) {
+        struct dsh_ring_slot *slot = dsh_ring_slot(rs);
+        if (slot->len > 0) {
+            dsh_ring_publish(rs);
+            dsh_ring_slot(rs);
+        }
+        dsh_ring_publish(rs);  // an empty block: the end
+        pthread_join(rs->thread, NULL);
+    }
+    status = atomic_load(&rs->stop) < 0 ? -1 : 0;
+    for (it = 0; it < DSH_RING_SLOTS; it++) {
+        free(rs->slots[it].data);
+    }
+    free(rs);
+    return status;
+}
+
+struct dsh_stream *dsh_ring_stream(struct dsh_stream *next) {
+    struct dsh_ring_stream *rs;
+
+    if (posix_memalign((void **) &rs, DSH_RING_LINE, sizeof(*rs)) != 0) {
+        fprintf(stderr, "dsh: allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(rs, 0, sizeof(*rs));
+    rs->base.write = dsh_ring_write;
+    rs->base.close = dsh_ring_close;
+    rs->base.next = next;
+    return &rs->base;
+}
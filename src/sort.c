@@ -0,0 +1,1175 @@
+#include <sys/types.h>         // for ssize_t
+#include <sys/stat.h>          // for fstat()
+#include <sys/mman.h>          // for mmap(), munmap(), madvise()
+#include <pthread.h>           // for pthread_create(), pthread_join()
+#include <stdint.h>            // for uint64_t
+#include <unistd.h>            // for close(), unlink(), sysconf()
+#include <fcntl.h>             // for open()
+#include <errno.h>             // for errno
+#include <ctype.h>             // for toupper()
+#include <stdlib.h>            // for free(), strtoull(), mkstemp(), getenv()
+#include <stdio.h>             // for fprintf(), snprintf()
+#include <string.h>            // for memchr(), memcmp(), memcpy(), strcmp(), strerror()
+
+#include "dsh.h"
+
+/*
+ * sort and uniq, run inside the shell, and the two fused into one
+ * hash aggregate for `sort | uniq -c`.
+ *
+ *     sort [-fnru] [-S SIZE] [FILE...]
+ *     uniq [-cdu] [FILE]
+ *
+ * sort copies its input into an arena of 1 MB blocks and keeps one
+ * record per line: where it is, how long, and a key for the first
+ * comparison, either the first eight bytes as a big-endian integer
+ * or, with -n, the number as a double. Most comparisons end at the key;
+ * only equal keys look at the bytes. The records are merge sorted in
+ * parallel: one slice per CPU, then the slices merged pairwise, each
+ * pair on its own thread.
+ *
+ * When the arena and records pass the memory cap (-S, default 256M)
+ * the sorted records are written out as a run to an unlinked temporary
+ * file in $TMPDIR and the memory is reused. At the end the runs are
+ * mmap()ed and merged through a heap.
+ *
+ * Lines compare as bytes, as in the C locale. Ties under -f or -n are
+ * broken by the whole line unless -u asks for one line per key, as in
+ * GNU sort. Other options run the external program.
+ */
+
+#define DSH_SORT_BLOCK (1 << 20)          // arena block; bigger only for a longer line
+#define DSH_SORT_MEMORY (256UL << 20)     // default memory cap before spilling
+#define DSH_SORT_PARALLEL 65536           // fewer lines than this sort on one thread
+#define DSH_SORT_MAX_THREADS 16
+#define DSH_SORT_INSERTION 24             // runs this short are insertion sorted first
+
+enum {
+    DSH_SORT_REVERSE = 1,
+    DSH_SORT_NUMERIC = 2,
+    DSH_SORT_UNIQUE = 4,
+    DSH_SORT_FOLD = 8
+};
+
+struct dsh_sort_line {
+    union {
+        uint64_t prefix;  // the first 8 bytes, big-endian, zero padded (upper-cased for -f)
+        double number;    // -n: the leading number
+    } key;
+    const char *text;     // always followed by a '\n'
+    size_t len;           // without it
+};
+
+/* ---- comparing lines ---- */
+
+static int dsh_sort_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/*
+ * The leading number of a line for -n: blanks, an optional '-', digits
+ * and a fraction. Sets where the significant digits are, for the exact
+ * comparison, and returns an approximation good enough to order
+ * numbers that are not very close.
+ */
+static double dsh_sort_number(const char *s, size_t len, int *neg, const char **ip, size_t *ilen,
+                              const char **fp, size_t *flen) {
+    const char *end = s + len;
+    double value = 0, scale = 0.1;
+
+    while (s < end && dsh_sort_blank(*s)) {
+        s++;
+    }
+    *neg = s < end && *s == '-';
+    s += *neg;
+    while (s < end && *s == '0') {
+        s++;
+    }
+    *ip = s;
+    while (s < end && *s >= '0' && *s <= '9') {
+        value = value * 10 + (*s++ - '0');
+    }
+    *ilen = s - *ip;
+    *fp = s;
+    *flen = 0;
+    if (s < end && *s == '.') {
+        *fp = ++s;
+        while (s < end && *s >= '0' && *s <= '9') {
+            value += (*s++ - '0') * scale;
+            scale /= 10;
+        }
+        *flen = s - *fp;
+        while (*flen > 0 && (*fp)[*flen - 1] == '0') {
+            (*flen)--;
+        }
+    }
+    if (*ilen == 0 && *flen == 0) {
+        *neg = 0;  // -0 is 0
+    }
+    return *neg ? -value : value;
+}
+
+// Exact -n comparison, for numbers the doubles cannot tell apart
+static int dsh_sort_numcmp(const char *a, size_t alen, const char *b, size_t blen) {
+    const char *ai, *af, *bi, *bf;
+    size_t ail, afl, bil, bfl, common;
+    int an, bn, c;
+
+    dsh_sort_number(a, alen, &an, &ai, &ail, &af, &afl);
+    dsh_sort_number(b, blen, &bn, &bi, &bil, &bf, &bfl);
+    if (an != bn) {
+        return an ? -1 : 1;
+    }
+    if (ail != bil) {
+        c = ail < bil ? -1 : 1;
+    } else if ((c = memcmp(ai, bi, ail)) == 0) {
+        common = afl < bfl ? afl : bfl;
+        c = memcmp(af, bf, common);
+        if (c == 0) {
+            c = afl == bfl ? 0 : afl < bfl ? -1 : 1;  // no trailing zeros: longer is bigger
+        }
+    }
+    return an ? -c : c;
+}
+
+static int dsh_sort_bytes(const char *a, size_t alen, const char *b, size_t blen, size_t from, int fold) {
+    size_t common = alen < blen ? alen : blen;
+    size_t it;
+    int c;
+
+    if (fold) {
+        for (it = from; it < common; it++) {
+            c = toupper((unsigned char) a[it]) - toupper((unsigned char) b[it]);
+            if (c != 0) {
+                return c;
+            }
+        }
+    } else if (common > from && (c = memcmp(a + from, b + from, common - from)) != 0) {
+        return c;
+    }
+    return alen == blen ? 0 : alen < blen ? -1 : 1;
+}
+
+// By the options' key only: 0 means the lines are equal as far as -u is concerned
+static int dsh_sort_key_compare(int flags, const struct dsh_sort_line *a, const struct dsh_sort_line *b) {
+    size_t from;
+
+    if (flags & DSH_SORT_NUMERIC) {
+        double diff = a->key.number - b->key.number;
+        double scale = (a->key.number < 0 ? -a->key.number : a->key.number) +
+                       (b->key.number < 0 ? -b->key.number : b->key.number);
+        if (diff > scale * 1e-9) {
+            return 1;
+        }
+        if (diff < -scale * 1e-9) {
+            return -1;
+        }
+        return dsh_sort_numcmp(a->text, a->len, b->text, b->len);
+    }
+    if (a->key.prefix != b->key.prefix) {
+        return a->key.prefix < b->key.prefix ? -1 : 1;
+    }
+    from = a->len < b->len ? a->len : b->len;
+    return dsh_sort_bytes(a->text, a->len, b->text, b->len, from < 8 ? from : 8, flags & DSH_SORT_FOLD);
+}
+
+static int dsh_sort_compare(int flags, const struct dsh_sort_line *a, const struct dsh_sort_line *b) {
+    int c = dsh_sort_key_compare(flags, a, b);
+
+    if (c == 0 && (flags & (DSH_SORT_NUMERIC | DSH_SORT_FOLD)) && !(flags & DSH_SORT_UNIQUE)) {
+        c = dsh_sort_bytes(a->text, a->len, b->text, b->len, 0, 0);  // the last resort
+    }
+    return flags & DSH_SORT_REVERSE ? -c : c;
+}
+
+static void dsh_sort_make_line(int flags, struct dsh_sort_line *line, const char *text, size_t len) {
+    line->text = text;
+    line->len = len;
+    if (flags & DSH_SORT_NUMERIC) {
+        const char *ip, *fp;
+        size_t ilen, flen;
+        int neg;
+        line->key.number = dsh_sort_number(text, len, &neg, &ip, &ilen, &fp, &flen);
+    } else {
+        uint64_t prefix = 0;
+        size_t it;
+        for (it = 0; it < 8; it++) {
+            unsigned char c = it < len ? (unsigned char) text[it] : 0;
+            if (flags & DSH_SORT_FOLD) {
+                c = toupper(c);
+            }
+            prefix = prefix << 8 | c;
+        }
+        line->key.prefix = prefix;
+    }
+}
+
+/* ---- parallel merge sort ---- */
+
+static void dsh_sort_insertion(int flags, struct dsh_sort_line *lines, size_t n) {
+    size_t it, at;
+
+    for (it = 1; it < n; it++) {
+        struct dsh_sort_line line = lines[it];
+        for (at = it; at > 0 && dsh_sort_compare(flags, &lines[at - 1], &line) > 0; at--) {
+            lines[at] = lines[at - 1];
+        }
+        lines[at] = line;
+    }
+}
+
+static void dsh_sort_merge(int flags, const struct dsh_sort_line *a, size_t na, const struct dsh_sort_line *b,
+                           size_t nb, struct dsh_sort_line *out) {
+    const struct dsh_sort_line *a_end = a + na, *b_end = b + nb;
+
+    while (a < a_end && b < b_end) {
+        // <= keeps equal lines in input order
+        *out++ = dsh_sort_compare(flags, a, b) <= 0 ? *a++ : *b++;
+    }
+    memcpy(out, a, (a_end - a) * sizeof(*a));
+    out += a_end - a;
+    memcpy(out, b, (b_end - b) * sizeof(*b));
+}
+
+// Bottom-up merge sort of lines[0..n), using tmp; the result ends up in lines
+static void dsh_sort_lines_serial(int flags, struct dsh_sort_line *lines, struct dsh_sort_line *tmp, size_t n) {
+    struct dsh_sort_line *from = lines, *to = tmp, *swap;
+    size_t width, it;
+
+    for (it = 0; it < n; it += DSH_SORT_INSERTION) {
+        dsh_sort_insertion(flags, lines + it, n - it < DSH_SORT_INSERTION ? n - it : DSH_SORT_INSERTION);
+    }
+    for (width = DSH_SORT_INSERTION; width < n; width *= 2) {
+        for (it = 0; it < n; it += 2 * width) {
+            size_t mid = it + width < n ? it + width : n;
+            size_t end = it + 2 * width < n ? it + 2 * width : n;
+            dsh_sort_merge(flags, from + it, mid - it, from + mid, end - mid, to + it);
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != lines) {
+        memcpy(lines, from, n * sizeof(*lines));
+    }
+}
+
+struct dsh_sort_task {
+    pthread_t thread;
+    int flags;
+    struct dsh_sort_line *lines, *tmp;  // sort: the slice; merge: two slices, one after the other
+    size_t n, mid;
+};
+
+static void *dsh_sort_slice(void *arg) {
+    struct dsh_sort_task *task = arg;
+    dsh_sort_lines_serial(task->flags, task->lines, task->tmp, task->n);
+    return NULL;
+}
+
+static void *dsh_sort_pair(void *arg) {
+    struct dsh_sort_task *task = arg;
+    dsh_sort_merge(task->flags, task->lines, task->mid, task->lines + task->mid, task->n - task->mid, task->tmp);
+    memcpy(task->lines, task->tmp, task->n * sizeof(*task->lines));
+    return NULL;
+}
+
+// Runs fn on every task, on threads when there is more than one
+static void dsh_sort_run(struct dsh_sort_task *tasks, int count, void *(*fn)(void *)) {
+    int it, started = 0;
+
+    for (it = 1; it < count; it++) {
+        if (pthread_create(&tasks[it].thread, NULL, fn, &tasks[it]) != 0) {
+            break;
+        }
+        started = it;
+    }
+    for (it = started + 1; it < count; it++) {
+        fn(&tasks[it]);  // no thread for these: run them here
+    }
+    fn(&tasks[0]);
+    for (it = 1; it <= started; it++) {
+        pthread_join(tasks[it].thread, NULL);
+    }
+}
+
+static void dsh_sort_lines(int flags, struct dsh_sort_line *lines, size_t n) {
+    struct dsh_sort_task tasks[DSH_SORT_MAX_THREADS];
+    struct dsh_sort_line *tmp;
+    size_t bounds[DSH_SORT_MAX_THREADS + 1];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int slices = 1, it, width;
+
+    if (n < 2) {
+        return;
+    }
+    tmp = dsh_xrealloc(NULL, n * sizeof(*tmp));
+    while (slices * 2 <= cpus && slices * 2 <= DSH_SORT_MAX_THREADS && n / (slices * 2) >= DSH_SORT_PARALLEL) {
+        slices *= 2;
+    }
+    for (it = 0; it <= slices; it++) {
+        bounds[it] = n * it / slices;
+    }
+
+    for (it = 0; it < slices; it++) {
+        tasks[it].flags = flags;
+        tasks[it].lines = lines + bounds[it];
+        tasks[it].tmp = tmp + bounds[it];
+        tasks[it].n = bounds[it + 1] - bounds[it];
+    }
+    dsh_sort_run(tasks, slices, dsh_sort_slice);
+
+    // Then merge neighbours, half as many pairs each round
+    for (width = 1; width < slices; width *= 2) {
+        int pairs = 0;
+        for (it = 0; it + width < slices; it += 2 * width) {
+            int last = it + 2 * width < slices ? it + 2 * width : slices;
+            tasks[pairs].flags = flags;
+            tasks[pairs].lines = lines + bounds[it];
+            tasks[pairs].tmp = tmp + bounds[it];
+            tasks[pairs].n = bounds[last] - bounds[it];
+            tasks[pairs].mid = bounds[it + width] - bounds[it];
+            pairs++;
+        }
+        dsh_sort_run(tasks, pairs, dsh_sort_pair);
+    }
+    free(tmp);
+}
+
+/* ---- the line arena ---- */
+
+struct dsh_sort_block {
+    struct dsh_sort_block *next;
+    size_t used, cap;
+    char data[];
+};
+
+struct dsh_sort_arena {
+    struct dsh_sort_block *blocks;  // newest first
+    size_t bytes;                   // in all blocks
+    size_t partial;                 // bytes of an unfinished line at the end of the newest block
+};
+
+// Room for len more bytes after the partial line, which moves along if it has to
+static struct dsh_sort_block *dsh_sort_reserve(struct dsh_sort_arena *arena, size_t len) {
+    struct dsh_sort_block *block = arena->blocks;
+    size_t size;
+
+    if (block && block->cap - block->used >= len) {
+        return block;
+    }
+    size = arena->partial + len > DSH_SORT_BLOCK ? arena->partial + len : DSH_SORT_BLOCK;
+    block = dsh_xrealloc(NULL, sizeof(*block) + size);
+    block->cap = size;
+    block->used = arena->partial;
+    if (arena->partial > 0) {
+        memcpy(block->data, arena->blocks->data + arena->blocks->used - arena->partial, arena->partial);
+        arena->blocks->used -= arena->partial;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->bytes += size;
+    return block;
+}
+
+static void dsh_sort_arena_free(struct dsh_sort_arena *arena, int keep_partial) {
+    struct dsh_sort_block *block = arena->blocks, *next;
+    char *partial = NULL;
+    size_t len = keep_partial ? arena->partial : 0;
+
+    if (len > 0) {
+        partial = dsh_xrealloc(NULL, len);
+        memcpy(partial, block->data + block->used - len, len);
+    }
+    while (block) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->bytes = 0;
+    arena->partial = 0;
+    if (len > 0) {
+        block = dsh_sort_reserve(arena, len);
+        memcpy(block->data, partial, len);
+        block->used = len;
+        arena->partial = len;
+        free(partial);
+    }
+}
+
+/*
+ * Appends buf to the arena and calls take() for every line it completes.
+ * At the end of the input (buf NULL) an unfinished last line gets its
+ * newline and is taken too.
+ */
+static void dsh_sort_append(struct dsh_sort_arena *arena, const char *buf, size_t len,
+                            void (*take)(void *ctx, const char *text, size_t len), void *ctx) {
+    struct dsh_sort_block *block;
+    char *p, *end, *newline;
+
+    if (buf == NULL) {
+        if (arena->partial == 0) {
+            return;
+        }
+        buf = "\n";
+        len = 1;
+    }
+    block = dsh_sort_reserve(arena, len);
+    memcpy(block->data + block->used, buf, len);
+    p = block->data + block->used - arena->partial;
+    block->used += len;
+    end = block->data + block->used;
+
+    while ((newline = memchr(p, '\n', end - p)) != NULL) {
+        take(ctx, p, newline - p);
+        p = newline + 1;
+    }
+    arena->partial = end - p;
+}
+
+/* ---- sort ---- */
+
+struct dsh_sort_run {
+    int fd;
+    char *map;
+    size_t size;
+    const char *pos;   // the next line
+    struct dsh_sort_line line;
+};
+
+struct dsh_sort_stream {
+    struct dsh_stream base;
+    int flags;
+    size_t memory;
+    struct dsh_sort_arena arena;
+    struct dsh_sort_line *lines;
+    size_t nlines, caplines;
+    struct dsh_sort_run *runs;
+    int nruns;
+    int failed;
+};
+
+static void dsh_sort_take(void *ctx, const char *text, size_t len) {
+    struct dsh_sort_stream *ss = ctx;
+
+    if (ss->nlines == ss->caplines) {
+        ss->caplines = ss->caplines ? ss->caplines * 2 : 4096;
+        ss->lines = dsh_xrealloc(ss->lines, ss->caplines * sizeof(*ss->lines));
+    }
+    dsh_sort_make_line(ss->flags, &ss->lines[ss->nlines++], text, len);
+}
+
+// Writes lines[0..n) to next, dropping key-equal neighbours for -u
+static int dsh_sort_emit(int flags, struct dsh_sort_line *lines, size_t n, struct dsh_stream *next) {
+    size_t it;
+
+    for (it = 0; it < n; it++) {
+        if ((flags & DSH_SORT_UNIQUE) && it > 0 && dsh_sort_key_compare(flags, &lines[it - 1], &lines[it]) == 0) {
+            continue;
+        }
+        if (next->write(next, lines[it].text, lines[it].len + 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sorts what is in memory out to a new run file and empties the arena
+static int dsh_sort_spill(struct dsh_sort_stream *ss) {
+    const char *tmpdir = getenv("TMPDIR");
+    char path[4096];
+    struct dsh_stream *out;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/dsh-sort.XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "dsh: sort: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    unlink(path);  // gone when it is closed, however that happens
+
+    dsh_sort_lines(ss->flags, ss->lines, ss->nlines);
+    out = dsh_stream_fd(fd);
+    if (dsh_sort_emit(ss->flags, ss->lines, ss->nlines, out) != 0 || out->close(out) != 0) {
+        fprintf(stderr, "dsh: sort: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    ss->runs = dsh_xrealloc(ss->runs, (ss->nruns + 1) * sizeof(*ss->runs));
+    memset(&ss->runs[ss->nruns], 0, sizeof(ss->runs[0]));
+    ss->runs[ss->nruns++].fd = fd;
+    ss->nlines = 0;
+    dsh_sort_arena_free(&ss->arena, 1);
+    return 0;
+}
+
+static int dsh_sort_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_sort_stream *ss = (struct dsh_sort_stream *) stream;
+
+    // A block at a time, so a big mapped file cannot overshoot the cap by much
+    while (len > 0 && !ss->failed) {
+        size_t n = len < DSH_SORT_BLOCK ? len : DSH_SORT_BLOCK;
+
+        dsh_sort_append(&ss->arena, buf, n, dsh_sort_take, ss);
+        buf += n;
+        len -= n;
+        if (ss->arena.bytes + ss->caplines * sizeof(*ss->lines) > ss->memory && dsh_sort_spill(ss) != 0) {
+            ss->failed = 1;
+        }
+    }
+    return ss->failed ? -1 : 0;
+}
+
+// The heap of runs, by their current lines
+static int dsh_sort_run_less(int flags, const struct dsh_sort_run *a, const struct dsh_sort_run *b) {
+    int c = dsh_sort_compare(flags, &a->line, &b->line);
+    return c < 0 || (c == 0 && a < b);  // earlier runs first: keeps the sort stable
+}
+
+static void dsh_sort_sift(int flags, struct dsh_sort_run **heap, int n, int at) {
+    for (;;) {
+        int least = at, left = 2 * at + 1, right = left + 1;
+        struct dsh_sort_run *swap;
+
+        if (left < n && dsh_sort_run_less(flags, heap[left], heap[least])) {
+            least = left;
+        }
+        if (right < n && dsh_sort_run_less(flags, heap[right], heap[least])) {
+            least = right;
+        }
+        if (least == at) {
+            return;
+        }
+        swap = heap[at];
+        heap[at] = heap[least];
+        heap[least] = swap;
+        at = least;
+    }
+}
+
+// Moves a run to its next line; returns 0 at its end
+static int dsh_sort_run_next(int flags, struct dsh_sort_run *run) {
+    const char *end = run->map + run->size, *newline;
+
+    if (run->pos >= end) {
+        return 0;
+    }
+    newline = memchr(run->pos, '\n', end - run->pos);  // every line in a run has one
+    dsh_sort_make_line(flags, &run->line, run->pos, newline - run->pos);
+    run->pos = newline + 1;
+    return 1;
+}
+
+static int dsh_sort_merge_runs(struct dsh_sort_stream *ss) {
+    struct dsh_sort_run **heap = dsh_xrealloc(NULL, ss->nruns * sizeof(*heap));
+    struct dsh_sort_line last;
+    struct dsh_stream *next = ss->base.next;
+    int n = 0, it, have_last = 0, status = 0;
+
+    for (it = 0; it < ss->nruns; it++) {
+        struct dsh_sort_run *run = &ss->runs[it];
+        struct stat st;
+
+        if (fstat(run->fd, &st) != 0 || st.st_size == 0) {
+            continue;
+        }
+        run->size = st.st_size;
+        run->map = mmap(NULL, run->size, PROT_READ, MAP_PRIVATE, run->fd, 0);
+        if (run->map == MAP_FAILED) {
+            fprintf(stderr, "dsh: sort: %s\n", strerror(errno));
+            run->map = NULL;
+            status = -1;
+            continue;
+        }
+        madvise(run->map, run->size, MADV_SEQUENTIAL);
+        run->pos = run->map;
+        if (dsh_sort_run_next(ss->flags, run)) {
+            heap[n++] = run;
+        }
+    }
+    for (it = n / 2 - 1; it >= 0; it--) {
+        dsh_sort_sift(ss->flags, heap, n, it);
+    }
+
+    while (n > 0 && status == 0) {
+        struct dsh_sort_run *run = heap[0];
+
+        if (!(ss->flags & DSH_SORT_UNIQUE) || !have_last || dsh_sort_key_compare(ss->flags, &last, &run->line) != 0) {
+            if (next->write(next, run->line.text, run->line.len + 1) != 0) {
+                status = -1;
+            }
+            last = run->line;  // stays mapped until the end
+            have_last = 1;
+        }
+        if (!dsh_sort_run_next(ss->flags, run)) {
+            heap[0] = heap[--n];
+        }
+        dsh_sort_sift(ss->flags, heap, n, 0);
+    }
+
+    for (it = 0; it < ss->nruns; it++) {
+        if (ss->runs[it].map) {
+            munmap(ss->runs[it].map, ss->runs[it].size);
+        }
+    }
+    free(heap);
+    return status;
+}
+
+static int dsh_sort_close(struct dsh_stream *stream) {
+    struct dsh_sort_stream *ss = (struct dsh_sort_stream *) stream;
+    int status = ss->failed ? -1 : 0, it;
+
+    dsh_sort_append(&ss->arena, NULL, 0, dsh_sort_take, ss);
+    if (status == 0 && ss->nruns == 0) {
+        dsh_sort_lines(ss->flags, ss->lines, ss->nlines);
+        status = dsh_sort_emit(ss->flags, ss->lines, ss->nlines, stream->next);
+    } else if (status == 0) {
+        status = ss->nlines > 0 ? dsh_sort_spill(ss) : 0;
+        if (status == 0) {
+            status = dsh_sort_merge_runs(ss);
+        }
+    }
+
+    for (it = 0; it < ss->nruns; it++) {
+        close(ss->runs[it].fd);
+    }
+    free(ss->runs);
+    free(ss->lines);
+    dsh_sort_arena_free(&ss->arena, 0);
+    free(ss);
+    return status;
+}
+
+// A file's last line ends with it, newline or not
+static void dsh_sort_end_file(struct dsh_stream *stream) {
+    struct dsh_sort_stream *ss = (struct dsh_sort_stream *) stream;
+
+    dsh_sort_append(&ss->arena, NULL, 0, dsh_sort_take, ss);
+}
+
+static struct dsh_stream *dsh_sort_stream(int flags, size_t memory, struct dsh_stream *next) {
+    struct dsh_sort_stream *ss = dsh_xcalloc(1, sizeof(*ss));
+    ss->base.write = dsh_sort_write;
+    ss->base.close = dsh_sort_close;
+    ss->base.next = next;
+    ss->flags = flags;
+    ss->memory = memory;
+    return &ss->base;
+}
+
+/* ---- sort | uniq -c, as one hash aggregate ---- */
+
+// In the arena, in front of each distinct line
+struct dsh_count_head {
+    unsigned long long count;
+    size_t len;
+};
+
+struct dsh_count_entry {
+    uint64_t hash;                 // 0: empty slot
+    struct dsh_count_head *head;
+};
+
+struct dsh_count_stream {
+    struct dsh_stream base;
+    struct dsh_sort_arena arena;    // lines seen for the first time, each after its head
+    struct dsh_count_entry *table;
+    size_t size, used;              // size is a power of two
+    char *carry;                    // a line split across writes
+    size_t carry_len, carry_cap;
+};
+
+static uint64_t dsh_count_hash(const char *text, size_t len) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ len, word;
+    size_t it = 0;
+
+    for (; it + 8 <= len; it += 8) {
+        memcpy(&word, text + it, 8);
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    word = 0;
+    memcpy(&word, text + it, len - it);
+    hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ULL;
+    hash ^= hash >> 29;
+    return hash | 1;
+}
+
+static void dsh_count_grow(struct dsh_count_stream *cs) {
+    struct dsh_count_entry *old = cs->table;
+    size_t old_size = cs->size, it;
+
+    cs->size = cs->size ? cs->size * 2 : 1024;
+    cs->table = dsh_xcalloc(cs->size, sizeof(*cs->table));
+    for (it = 0; it < old_size; it++) {
+        if (old[it].hash) {
+            size_t at = old[it].hash & (cs->size - 1);
+            while (cs->table[at].hash) {
+                at = (at + 1) & (cs->size - 1);
+            }
+            cs->table[at] = old[it];
+        }
+    }
+    free(old);
+}
+
+// One line, by reference: copied into the arena only the first time it is seen
+static void dsh_count_line(struct dsh_count_stream *cs, const char *text, size_t len) {
+    uint64_t hash = dsh_count_hash(text, len);
+    size_t at = hash & (cs->size - 1);
+    struct dsh_count_head *head;
+    struct dsh_sort_block *block;
+    size_t size;
+
+    while (cs->table[at].hash) {
+        head = cs->table[at].head;
+        if (cs->table[at].hash == hash && head->len == len && memcmp(head + 1, text, len) == 0) {
+            head->count++;
+            return;
+        }
+        at = (at + 1) & (cs->size - 1);
+    }
+
+    // Heads stay aligned: each line is padded to a multiple of one
+    size = (sizeof(*head) + len + 1 + sizeof(*head) - 1) / sizeof(*head) * sizeof(*head);
+    block = dsh_sort_reserve(&cs->arena, size);
+    head = (struct dsh_count_head *) (block->data + block->used);
+    head->count = 1;
+    head->len = len;
+    memcpy(head + 1, text, len);
+    ((char *) (head + 1))[len] = '\n';
+    block->used += size;
+    cs->table[at].hash = hash;
+    cs->table[at].head = head;
+    if (++cs->used * 2 > cs->size) {
+        dsh_count_grow(cs);
+    }
+}
+
+static int dsh_count_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_count_stream *cs = (struct dsh_count_stream *) stream;
+    const char *end = buf + len, *newline;
+
+    if (cs->carry_len > 0) {
+        newline = memchr(buf, '\n', len);
+        if (newline == NULL) {
+            newline = end;  // still unfinished: all of it goes on the carry
+        }
+        if (cs->carry_len + (newline - buf) > cs->carry_cap) {
+            cs->carry_cap = (cs->carry_len + (newline - buf)) * 2;
+            cs->carry = dsh_xrealloc(cs->carry, cs->carry_cap);
+        }
+        memcpy(cs->carry + cs->carry_len, buf, newline - buf);
+        cs->carry_len += newline - buf;
+        if (newline == end) {
+            return 0;
+        }
+        dsh_count_line(cs, cs->carry, cs->carry_len);
+        cs->carry_len = 0;
+        buf = newline + 1;
+    }
+
+    while (buf < end && (newline = memchr(buf, '\n', end - buf)) != NULL) {
+        dsh_count_line(cs, buf, newline - buf);
+        buf = newline + 1;
+    }
+    if (buf < end) {
+        if ((size_t) (end - buf) > cs->carry_cap) {
+            cs->carry_cap = (end - buf) * 2;
+            cs->carry = dsh_xrealloc(cs->carry, cs->carry_cap);
+        }
+        memcpy(cs->carry, buf, end - buf);
+        cs->carry_len = end - buf;
+    }
+    return 0;
+}
+
+static int dsh_count_close(struct dsh_stream *stream) {
+    struct dsh_count_stream *cs = (struct dsh_count_stream *) stream;
+    struct dsh_stream *next = stream->next;
+    struct dsh_sort_line *lines;
+    size_t n = 0, it;
+    int status = 0;
+
+    if (cs->carry_len > 0) {
+        dsh_count_line(cs, cs->carry, cs->carry_len);
+    }
+
+    // Only the distinct lines get sorted; each finds its count just in front of it
+    lines = dsh_xrealloc(NULL, (cs->used + 1) * sizeof(*lines));
+    for (it = 0; it < cs->size; it++) {
+        if (cs->table[it].hash) {
+            struct dsh_count_head *head = cs->table[it].head;
+            dsh_sort_make_line(0, &lines[n++], (const char *) (head + 1), head->len);
+        }
+    }
+    free(cs->table);
+    dsh_sort_lines(0, lines, n);
+
+    for (it = 0; it < n && status == 0; it++) {
+        const struct dsh_count_head *head = (const struct dsh_count_head *) lines[it].text - 1;
+        char prefix[32];
+        int len = snprintf(prefix, sizeof(prefix), "%7llu ", head->count);
+        if (next->write(next, prefix, len) != 0 || next->write(next, lines[it].text, lines[it].len + 1) != 0) {
+            status = -1;
+        }
+    }
+
+    free(lines);
+    free(cs->carry);
+    dsh_sort_arena_free(&cs->arena, 0);
+    free(cs);
+    return status;
+}
+
+/*
+ * What `sort | uniq -c` prints, without sorting every line: counts go
+ * in a hash table and only the distinct lines are sorted at the end.
+ */
+struct dsh_stream *dsh_sort_count_stream(struct dsh_stream *next) {
+    struct dsh_count_stream *cs = dsh_xcalloc(1, sizeof(*cs));
+    cs->base.write = dsh_count_write;
+    cs->base.close = dsh_count_close;
+    cs->base.next = next;
+    dsh_count_grow(cs);
+    return &cs->base;
+}
+
+/* ---- uniq ---- */
+
+enum {
+    DSH_UNIQ_COUNT = 1,
+    DSH_UNIQ_REPEATED = 2,  // -d
+    DSH_UNIQ_SINGLE = 4     // -u
+};
+
+struct dsh_uniq_stream {
+    struct dsh_stream base;
+    int flags;
+    const char *prev;       // the current group's line, or NULL
+    size_t prev_len;
+    unsigned long long count;
+    char *own;              // prev, once the buffer it was in is gone
+    size_t own_cap;
+    char *carry;            // a line split across writes
+    size_t carry_len, carry_cap;
+};
+
+static int dsh_uniq_flush(struct dsh_uniq_stream *us) {
+    struct dsh_stream *next = us->base.next;
+    char prefix[32];
+    int len;
+
+    if (us->prev == NULL || ((us->flags & DSH_UNIQ_REPEATED) && us->count < 2) ||
+        ((us->flags & DSH_UNIQ_SINGLE) && us->count > 1)) {
+        return 0;
+    }
+    if (us->flags & DSH_UNIQ_COUNT) {
+        len = snprintf(prefix, sizeof(prefix), "%7llu ", us->count);
+        if (next->write(next, prefix, len) != 0) {
+            return -1;
+        }
+    }
+    if (next->write(next, us->prev, us->prev_len) != 0) {
+        return -1;
+    }
+    return next->write(next, "\n", 1);
+}
+
+static int dsh_uniq_line(struct dsh_uniq_stream *us, const char *text, size_t len) {
+    if (us->prev && us->prev_len == len && memcmp(us->prev, text, len) == 0) {
+        us->count++;
+        return 0;
+    }
+    if (dsh_uniq_flush(us) != 0) {
+        return -1;
+    }
+    us->prev = text;
+    us->prev_len = len;
+    us->count = 1;
+    return 0;
+}
+
+// The buffer prev points into is about to go: keep a copy
+static void dsh_uniq_keep(struct dsh_uniq_stream *us) {
+    if (us->prev && us->prev != us->own) {
+        if (us->prev_len + 1 > us->own_cap) {
+            us->own_cap = (us->prev_len + 1) * 2;
+            free(us->own);
+            us->own = dsh_xrealloc(NULL, us->own_cap);
+        }
+        memcpy(us->own, us->prev, us->prev_len);
+        us->prev = us->own;
+    }
+}
+
+static int dsh_uniq_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_uniq_stream *us = (struct dsh_uniq_stream *) stream;
+    const char *end = buf + len, *newline;
+
+    if (us->carry_len > 0) {
+        newline = memchr(buf, '\n', len);
+        if (newline == NULL) {
+            newline = end;
+        }
+        if (us->carry_len + (newline - buf) > us->carry_cap) {
+            us->carry_cap = (us->carry_len + (newline - buf)) * 2;
+            us->carry = dsh_xrealloc(us->carry, us->carry_cap);
+        }
+        memcpy(us->carry + us->carry_len, buf, newline - buf);
+        us->carry_len += newline - buf;
+        if (newline == end) {
+            return 0;
+        }
+        if (dsh_uniq_line(us, us->carry, us->carry_len) != 0) {
+            return -1;
+        }
+        dsh_uniq_keep(us);
+        us->carry_len = 0;
+        buf = newline + 1;
+    }
+
+    // Lines are compared where they are; only the last group's line is copied
+    while (buf < end && (newline = memchr(buf, '\n', end - buf)) != NULL) {
+        if (dsh_uniq_line(us, buf, newline - buf) != 0) {
+            return -1;
+        }
+        buf = newline + 1;
+    }
+    dsh_uniq_keep(us);
+    if (buf < end) {
+        if ((size_t) (end - buf) > us->carry_cap) {
+            us->carry_cap = (end - buf) * 2;
+            us->carry = dsh_xrealloc(us->carry, us->carry_cap);
+        }
+        memcpy(us->carry, buf, end - buf);
+        us->carry_len = end - buf;
+    }
+    return 0;
+}
+
+static int dsh_uniq_close(struct dsh_stream *stream) {
+    struct dsh_uniq_stream *us = (struct dsh_uniq_stream *) stream;
+    int status = 0;
+
+    if (us->carry_len > 0) {
+        status = dsh_uniq_line(us, us->carry, us->carry_len);
+    }
+    if (status == 0) {
+        status = dsh_uniq_flush(us);
+    }
+    free(us->own);
+    free(us->carry);
+    free(us);
+    return status;
+}
+
+static struct dsh_stream *dsh_uniq_stream(int flags, struct dsh_stream *next) {
+    struct dsh_uniq_stream *us = dsh_xcalloc(1, sizeof(*us));
+    us->base.write = dsh_uniq_write;
+    us->base.close = dsh_uniq_close;
+    us->base.next = next;
+    us->flags = flags;
+    return &us->base;
+}
+
+/* ---- the builtins ---- */
+
+// -S SIZE: a number of bytes with an optional K, M or G (K is the default, as in GNU sort)
+static int dsh_sort_size(const char *value, size_t *memory) {
+    char *end;
+    unsigned long long n = strtoull(value, &end, 10);
+
+    if (end == value) {
+        return -1;
+    }
+    switch (*end) {
+    case 'b': case 'B': break;
+    case '\0': case 'k': case 'K': n <<= 10; break;
+    case 'm': case 'M': n <<= 20; break;
+    case 'g': case 'G': n <<= 30; break;
+    default: return -1;
+    }
+    if (*end && end[1]) {
+        return -1;
+    }
+    *memory = n;
+    return 0;
+}
+
+// Feeds each operand to stage; end_file, if given, runs after every one
+static int dsh_sort_feed(const char *tool, char **operands, struct dsh_stream *stage,
+                         void (*end_file)(struct dsh_stream *stage)) {
+    char *stdin_only[] = { "-", NULL };
+    int it;
+
+    if (operands[0] == NULL) {
+        operands = stdin_only;
+    }
+    for (it = 0; operands[it] != NULL; it++) {
+        int fd = STDIN_FILENO;
+
+        if (strcmp(operands[it], "-") != 0) {
+            fd = open(operands[it], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                fprintf(stderr, "dsh: %s: %s: %s\n", tool, operands[it], strerror(errno));
+                dsh_status = 1;
+                continue;
+            }
+        }
+        dsh_stream_feed(stage, fd, operands[it]);
+        if (end_file) {
+            end_file(stage);
+        }
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+    }
+    return 1;
+}
+
+// sort's options. Returns the first operand, or -1 for the external sort
+static int dsh_sort_opt(char **args, int *flags, size_t *memory) {
+    int argi;
+
+    *flags = 0;
+    *memory = DSH_SORT_MEMORY;
+    for (argi = 1; args[argi] != NULL && args[argi][0] == '-' && args[argi][1] != '\0'; argi++) {
+        const char *flag;
+
+        if (strcmp(args[argi], "--") == 0) {
+            return argi + 1;
+        }
+        for (flag = args[argi] + 1; *flag; flag++) {
+            if (*flag == 'r') {
+                *flags |= DSH_SORT_REVERSE;
+            } else if (*flag == 'n') {
+                *flags |= DSH_SORT_NUMERIC;
+            } else if (*flag == 'u') {
+                *flags |= DSH_SORT_UNIQUE;
+            } else if (*flag == 'f') {
+                *flags |= DSH_SORT_FOLD;
+            } else if (*flag == 'S' && (flag[1] || args[argi + 1])) {
+                if (dsh_sort_size(flag[1] ? flag + 1 : args[++argi], memory) != 0) {
+                    return -1;  // let sort explain
+                }
+                break;
+            } else {
+                return -1;
+            }
+        }
+    }
+    return argi;
+}
+
+// uniq's options. Returns the input operand, or -1 for the external uniq
+static int dsh_uniq_opt(char **args, int *flags) {
+    int argi;
+
+    *flags = 0;
+    for (argi = 1; args[argi] != NULL && args[argi][0] == '-' && args[argi][1] != '\0'; argi++) {
+        const char *flag;
+
+        if (strcmp(args[argi], "--") == 0) {
+            argi++;
+            break;
+        }
+        for (flag = args[argi] + 1; *flag; flag++) {
+            if (*flag == 'c') {
+                *flags |= DSH_UNIQ_COUNT;
+            } else if (*flag == 'd') {
+                *flags |= DSH_UNIQ_REPEATED;
+            } else if (*flag == 'u') {
+                *flags |= DSH_UNIQ_SINGLE;
+            } else {
+                return -1;
+            }
+        }
+    }
+    if (args[argi] != NULL && args[argi + 1] != NULL) {
+        return -1;  // an output file
+    }
+    return argi;
+}
+
+int dsh_sort(char **args) {
+    struct dsh_stream *out, *stage;
+    size_t memory;
+    int flags;
+    int argi = dsh_sort_opt(args, &flags, &memory);
+
+    if (argi < 0) {
+        return dsh_launch(args);
+    }
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    stage = dsh_sort_stream(flags, memory, out);
+    dsh_sort_feed("sort", args + argi, stage, dsh_sort_end_file);
+    stage->close(stage);
+    out->close(out);
+    return 1;
+}
+
+int dsh_uniq(char **args) {
+    struct dsh_stream *out, *stage;
+    int flags;
+    int argi = dsh_uniq_opt(args, &flags);
+
+    if (argi < 0) {
+        return dsh_launch(args);
+    }
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    stage = dsh_uniq_stream(flags, out);
+    dsh_sort_feed("uniq", args + argi, stage, NULL);
+    stage->close(stage);
+    out->close(out);
+    return 1;
+}
+
+/*
+ * sort or uniq as one stage of a pipeline (pipeline.c). Returns NULL
+ * when args need the external program; otherwise *operands is set to
+ * the file operands, which the pipeline feeds in itself.
+ */
+struct dsh_stream *dsh_sort_stage(char **args, char ***operands, struct dsh_stream *next) {
+    size_t memory;
+    int flags, argi;
+
+    if (strcmp(args[0], "sort") == 0) {
+        if ((argi = dsh_sort_opt(args, &flags, &memory)) < 0) {
+            return NULL;
+        }
+        *operands = args + argi;
+        return dsh_sort_stream(flags, memory, next);
+    }
+    if ((argi = dsh_uniq_opt(args, &flags)) < 0) {
+        return NULL;
+    }
+    *operands = args + argi;
+    return dsh_uniq_stream(flags, next);
+}
+
+/*
+ * `sort | uniq -c` as one pipeline stage: a dsh_sort_count_stream(),
+ * when sort has no options and uniq only -c and no input file. Returns
+ * NULL otherwise; *operands is set to sort's files.
+ */
+struct dsh_stream *dsh_sort_count_stage(char **sort, char **uniq, char ***operands, struct dsh_stream *next) {
+    size_t memory;
+    int flags, argi, uniq_argi;
+
+    if ((argi = dsh_sort_opt(sort, &flags, &memory)) < 0 || flags != 0) {
+        return NULL;
+    }
+    uniq_argi = dsh_uniq_opt(uniq, &flags);
+    if (uniq_argi < 0 || flags != DSH_UNIQ_COUNT || uniq[uniq_argi] != NULL) {
+        return NULL;
+    }
+    *operands = sort + argi;
+    return dsh_sort_count_stream(next);
+}
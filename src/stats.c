@@ -0,0 +1,159 @@
+#include <time.h>    // for clock_gettime(), CLOCK_MONOTONIC
+#include <stdio.h>   // for printf(), fprintf()
+#include <string.h>  // for strcmp(), memset()
+
+#include "dsh.h"
+
+/*
+ * dshstat: where the shell itself spends its time.
+ *
+ *     dshstat [-j] [-r]
+ *
+ * The counters in dsh_stats are bumped in place by the code they
+ * describe, and the main loop times every read / parse / execute phase
+ * into a log2 histogram. -j prints everything as JSON, -r zeroes it
+ * afterwards.
+ *
+ * The increments are plain, not atomic, so only the main thread may
+ * touch dsh_stats. The threads that walk, sort and threaded pipeline
+ * stages (ring.c) start run none of the code that counts; anything
+ * added to them that should be counted has to be tallied per thread
+ * and added in after the join.
+ */
+
+struct dsh_stats dsh_stats;
+
+static const char *dsh_phase_names[DSH_NUM_PHASES] = {
+    "read",
+    "parse",
+    "execute"
+};
+
+unsigned long long dsh_now_ns(void) {
+    struct timespec ts;
+
+    // CLOCK_MONOTONIC is served from the vDSO, so this is not a real syscall
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Bucket b holds durations in [2^b, 2^(b+1)) nanoseconds, so the whole
+ * range from 1ns to centuries fits in 64 counters.
+ */
+void dsh_stats_record(int phase, unsigned long long ns) {
+    struct dsh_hist *hist = &dsh_stats.phases[phase];
+    int bucket = 63 - __builtin_clzll(ns | 1);
+
+    hist->count++;
+    hist->total_ns += ns;
+    hist->buckets[bucket]++;
+}
+
+// The upper bound of the bucket the q-th quantile falls in
+static unsigned long long dsh_stats_quantile(const struct dsh_hist *hist, double q) {
+    unsigned long long seen = 0;
+    unsigned long long want = (unsigned long long) (q * hist->count);
+    int b;
+
+    for (b = 0; b < DSH_HIST_BUCKETS; b++) {
+        seen += hist->buckets[b];
+        if (seen > want) {
+            return b >= 63 ? ~0ULL : (2ULL << b);
+        }
+    }
+    return 0;
+}
+
+#define DSH_STATS_COUNTERS(X) \
+    X(commands)          \
+    X(builtins)          \
+    X(forks)             \
+    X(fork_failures)     \
+    X(exec_not_found)    \
+    X(exec_failures)     \
+    X(lines_read)        \
+    X(bytes_read)        \
+    X(allocations)       \
+    X(read_growths)      \
+    X(io_reads)          \
+    X(io_enters)         \
+    X(split_growths)     \
+    X(memo_hits)         \
+    X(memo_misses)       \
+    X(pipelines)         \
+    X(pipelines_fused)   \
+    X(subshells)         \
+    X(globs)
+
+static void dsh_stats_print_text(void) {
+    int p;
+
+#define X(name) printf("%-16s %llu\n", #name, dsh_stats.name);
+    DSH_STATS_COUNTERS(X)
+#undef X
+
+    printf("\n%-8s %10s %14s %12s %12s %12s\n", "phase", "count", "total_us", "p50_us<", "p90_us<", "p99_us<");
+    for (p = 0; p < DSH_NUM_PHASES; p++) {
+        const struct dsh_hist *hist = &dsh_stats.phases[p];
+        printf("%-8s %10llu %14.1f %12.1f %12.1f %12.1f\n", dsh_phase_names[p], hist->count,
+               hist->total_ns / 1e3,
+               dsh_stats_quantile(hist, 0.50) / 1e3,
+               dsh_stats_quantile(hist, 0.90) / 1e3,
+               dsh_stats_quantile(hist, 0.99) / 1e3);
+    }
+    printf("(read includes time spent waiting for input)\n");
+}
+
+static void dsh_stats_print_json(void) {
+    int p, b;
+
+    printf("{\"counters\":{");
+#define X(name) printf("%s\"" #name "\":%llu", strcmp(#name, "commands") ? "," : "", dsh_stats.name);
+    DSH_STATS_COUNTERS(X)
+#undef X
+    printf("},\"phases\":{");
+    for (p = 0; p < DSH_NUM_PHASES; p++) {
+        const struct dsh_hist *hist = &dsh_stats.phases[p];
+        int first = 1;
+
+        printf("%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"buckets\":{",
+               p ? "," : "", dsh_phase_names[p], hist->count, hist->total_ns);
+        // Only non-empty buckets, keyed by their lower bound in ns
+        for (b = 0; b < DSH_HIST_BUCKETS; b++) {
+            if (hist->buckets[b]) {
+                printf("%s\"%llu\":%llu", first ? "" : ",", 1ULL << b, hist->buckets[b]);
+                first = 0;
+            }
+        }
+        printf("}}");
+    }
+    printf("}}\n");
+}
+
+int dsh_dshstat(char **args) {
+    int json = 0, reset = 0;
+    int it;
+
+    for (it = 1; args[it] != NULL; it++) {
+        if (strcmp(args[it], "-j") == 0) {
+            json = 1;
+        } else if (strcmp(args[it], "-r") == 0) {
+            reset = 1;
+        } else {
+            fprintf(stderr, "dsh: usage: dshstat [-j] [-r]\n");
+            dsh_status = 1;
+            return 1;
+        }
+    }
+
+    if (json) {
+        dsh_stats_print_json();
+    } else if (!reset) {
+        dsh_stats_print_text();
+    }
+    if (reset) {
+        memset(&dsh_stats, 0, sizeof(dsh_stats));
+    }
+    return 1;
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>   // for fprintf()
+#include <string.h>  // for strcmp(), strchr(), memcpy()
+
+#include "dsh.h"
+
+/*
+ * Lists, subshells, groups and functions:
+ *
+ *     a ; b                  one after the other
+ *     ( list )               a subshell
+ *     { list ; }             a group, run as it is
+ *     name ( ) { list ; }    a function
+ *
+ * A subshell runs a list on a copy of the shell's state, so whatever it
+ * changes is gone when it ends: `(cd /tmp; x=1; set -o pipethreads)`
+ * leaves the shell where it was, and an exit inside ends only the
+ * subshell. A group is just a list in one piece; an exit inside ends
+ * the shell.
+ *
+ * Other shells fork() for a subshell's copy. dsh runs the list in the
+ * shell itself and puts the state back afterwards: the variables and
+ * functions (vars.c undoes the first change of each name inside), the
+ * directories (saved by dirs.c on the first change inside, "." as a
+ * descriptor) and the options, copied on the way in. The shell has no
+ * traps or jobs. A program the list starts sees the subshell's
+ * directory and environment just as it would from a forked copy, so it
+ * is spawned as usual; only a subshell that is a stage of a pipeline of
+ * processes still gets a process of its own (pipeline.c).
+ *
+ * A function is called like a command: its words are the positional
+ * parameters of its body, which runs in a frame of its own where
+ * `local` names live (vars.c).
+ *
+ * The words come from dsh_split_line, where | ; ( and ) are words of
+ * their own; { and } are reserved when they are whole words. A "(" or
+ * "{" may only start a command, and its ")" or "}" ends it.
+ */
+
+#define DSH_LIST_DEPTH 64  // ( and { inside each other
+
+static int dsh_is_op(const char *word, char op) {
+    return word[0] == op && word[1] == '\0';
+}
+
+static int dsh_is_any_op(const char *word) {
+    return word[0] != '\0' && word[1] == '\0' && strchr("|;(){}", word[0]);
+}
+
+// Whether a command may start after prev (NULL at the start of the line)
+static int dsh_list_starts(const char *prev) {
+    return prev == NULL || dsh_is_op(prev, ';') || dsh_is_op(prev, '(') || dsh_is_op(prev, '{') ||
+           dsh_is_op(prev, '|');
+}
+
+/*
+ * Checks the whole line before any of it runs, so `cd /; (ls` does not
+ * go to / and then complain. A `time` where a command starts is looked
+ * through: `time ( ... )` times the subshell.
+ */
+int dsh_list_check(char **args) {
+    char open[DSH_LIST_DEPTH];  // the ( and { not closed yet
+    const char *prev = NULL;
+    int depth = 0, body = 0, it;
+
+    for (it = 0; args[it] != NULL; it++) {
+        const char *word = args[it];
+        int starts = body || dsh_list_starts(prev);
+
+        if (body && !dsh_is_op(word, '{')) {
+            break;  // a function's body is a { ... } group
+        }
+        body = 0;
+        if (starts && strcmp(word, "time") == 0) {
+            continue;
+        }
+        if (dsh_is_op(word, '(') && !starts && args[it + 1] && dsh_is_op(args[it + 1], ')') &&
+            !dsh_is_any_op(prev) && prev == args[it - 1] && dsh_list_starts(it > 1 ? args[it - 2] : NULL)) {
+            // name ( ): a function's body comes next
+            prev = args[++it];
+            body = 1;
+        } else if (dsh_is_op(word, '(') || dsh_is_op(word, '{')) {
+            if (!starts) {
+                break;
+            }
+            if (depth == DSH_LIST_DEPTH) {
+                fprintf(stderr, "dsh: more than %d groups inside each other\n", DSH_LIST_DEPTH);
+                return -1;
+            }
+            open[depth++] = word[0];
+            prev = word;
+        } else if (dsh_is_op(word, ')') || dsh_is_op(word, '}')) {
+            if (prev == NULL || dsh_is_op(prev, '(') || dsh_is_op(prev, '{') || dsh_is_op(prev, '|') ||
+                depth == 0 || open[--depth] != (word[0] == ')' ? '(' : '{')) {
+                break;
+            }
+            prev = word;
+        } else if (dsh_is_op(word, ';') || dsh_is_op(word, '|')) {
+            if (starts) {
+                break;
+            }
+            prev = word;
+        } else if (prev && (dsh_is_op(prev, ')') || dsh_is_op(prev, '}'))) {
+            break;
+        } else {
+            prev = word;
+        }
+    }
+    if (args[it] != NULL) {
+        fprintf(stderr, "dsh: syntax error near `%s'\n", args[it]);
+        return -1;
+    }
+    if (body || (prev && dsh_is_op(prev, '|'))) {
+        fprintf(stderr, "dsh: syntax error near `%s'\n", body ? "(" : "|");
+        return -1;
+    }
+    if (depth > 0) {
+        fprintf(stderr, "dsh: syntax error: missing `%c'\n", open[depth - 1] == '(' ? ')' : '}');
+        return -1;
+    }
+    return 0;
+}
+
+static int dsh_list_each(char **args);
+
+static int dsh_subshell(char **body) {
+    struct dsh_dirs_frame dirs;
+    long options[DSH_NUM_OPTIONS];
+
+    if (dsh_scope_push(DSH_SCOPE_SUBSHELL, NULL) != 0) {
+        return 1;
+    }
+    dsh_stats.subshells++;
+    memcpy(options, dsh_options, sizeof(options));
+    dsh_dirs_enter(&dirs);
+    dsh_list_each(body);  // an exit stops the list, and that is all
+    dsh_dirs_leave(&dirs);
+    memcpy(dsh_options, options, sizeof(options));
+    dsh_scope_pop();
+    return 1;
+}
+
+/*
+ * Runs func with args (its name first) as the positional parameters.
+ * The body runs from a copy of its array of words, which the list
+ * cuts up as it goes, so the function may call itself; and the body is
+ * held, so it may even define itself anew. The copy is taken from the
+ * expansion arena, under whatever the body's commands expand, and
+ * given back with them.
+ */
+int dsh_func_call(struct dsh_func *func, char **args) {
+    struct dsh_expand_mark mark;
+    char **body;
+    int status;
+
+    if (dsh_scope_push(DSH_SCOPE_FUNCTION, args + 1) != 0) {
+        return 1;
+    }
+    dsh_expand_mark(&mark);
+    body = dsh_expand_alloc((func->len + 1) * sizeof(char *));
+    func->refs++;
+    memcpy(body, func->words, (func->len + 1) * sizeof(char *));
+    status = dsh_list_each(body);
+    dsh_func_release(func);
+    dsh_expand_release(&mark);
+    dsh_scope_pop();
+    return status;
+}
+
+// One command of a list: a pipeline, a group, a definition or a simple command
+static int dsh_list_run(char **cmd) {
+    int depth = 0, it, status;
+    char *close;
+
+    for (it = 0; cmd[it] != NULL; it++) {
+        if (dsh_is_op(cmd[it], '(') || dsh_is_op(cmd[it], '{')) {
+            depth++;
+        } else if (dsh_is_op(cmd[it], ')') || dsh_is_op(cmd[it], '}')) {
+            depth--;
+        } else if (depth == 0 && dsh_is_op(cmd[it], '|')) {
+            // It counts its stages itself; `time` times the whole pipeline
+            return strcmp(cmd[0], "time") == 0 ? dsh_time(cmd) : dsh_pipeline(cmd);
+        }
+    }
+    if (strcmp(cmd[0], "time") == 0 && cmd[1] != NULL && dsh_is_any_op(cmd[1])) {
+        return dsh_time(cmd);
+    }
+    if (!dsh_is_any_op(cmd[0]) && cmd[1] != NULL && dsh_is_op(cmd[1], '(')) {
+        // name ( ) { body }: the check made sure of the shape
+        dsh_func_define(cmd[0], cmd + 4, it - 5);
+        return 1;  // a bad name was reported, and the shell goes on
+    }
+    if (!dsh_is_op(cmd[0], '(') && !dsh_is_op(cmd[0], '{')) {
+        return dsh_execute(cmd);
+    }
+
+    // ( list ) or { list }: the check made sure the last word closes it
+    close = cmd[it - 1];
+    cmd[it - 1] = NULL;
+    status = cmd[0][0] == '(' ? dsh_subshell(cmd + 1) : dsh_list_each(cmd + 1);
+    cmd[it - 1] = close;
+    return status;
+}
+
+// Runs the commands between the ";"s at the top level; 0 after an exit
+static int dsh_list_each(char **args) {
+    int depth = 0, start = 0, it, status = 1;
+
+    // Walking the list, and what a subshell or function does around it, is the shell's own work
+    dsh_prof_phase = DSH_PROF_BUILTIN;
+    for (it = 0; status; it++) {
+        char *word = args[it];
+
+        if (word != NULL && (dsh_is_op(word, '(') || dsh_is_op(word, '{'))) {
+            depth++;
+        } else if (word != NULL && (dsh_is_op(word, ')') || dsh_is_op(word, '}'))) {
+            depth--;
+        } else if (word == NULL || (depth == 0 && dsh_is_op(word, ';'))) {
+            if (it > start) {
+                args[it] = NULL;
+                status = dsh_list_run(args + start);
+                args[it] = word;
+                dsh_prof_phase = DSH_PROF_BUILTIN;  // not the wait of the command before
+            }
+            if (word == NULL) {
+                break;
+            }
+            start = it + 1;
+        }
+    }
+    return status;
+}
+
+/*
+ * Runs args, which has an operator word in it. Like dsh_pipeline(), it
+ * cuts the array up while it runs and gives it back as it was.
+ */
+int dsh_list(char **args) {
+    if (dsh_list_check(args) != 0) {
+        return 1;
+    }
+    return dsh_list_each(args);
+}
@@ -0,0 +1,890 @@
+#define _GNU_SOURCE            // for copy_file_range(), splice(), memrchr()
+#include <sys/types.h>         // for off_t, ssize_t
+#include <sys/stat.h>          // for fstat(), S_ISREG, S_ISFIFO
+#include <sys/mman.h>          // for mmap(), munmap(), madvise()
+#include <sys/sendfile.h>      // for sendfile()
+#include <fcntl.h>             // for open(), splice()
+#include <unistd.h>            // for close(), copy_file_range()
+#include <errno.h>             // for errno, EINTR, EINVAL, EXDEV
+#include <stdlib.h>            // for free(), strtol()
+#include <stdio.h>             // for fprintf(), snprintf()
+#include <string.h>            // for memchr(), memrchr(), memcpy(), strcmp()
+
+#ifdef __SSE2__
+#include <emmintrin.h>         // for _mm_cmpeq_epi8(), _mm_movemask_epi8()
+#endif
+
+#include "dsh.h"
+
+/*
+ * cat, head, tail and wc, run inside the shell.
+ *
+ * Each tool is a streaming operator (struct dsh_stream): it is handed
+ * buffers with write() and passes what it produces on to the next
+ * stream, ending at one that writes to a descriptor. Inputs are fed in
+ * by dsh_stream_feed(): regular files are mmap()ed and pushed as one
+ * buffer, anything else is read in chunks. Nothing is copied on the
+ * way through: head passes on a prefix of the buffer it got, cat the
+ * buffer itself.
+ *
+ * On top of that each tool takes the shortcut its input allows:
+ *
+ *     cat    file -> stdout with copy_file_range(), else sendfile(),
+ *            and pipe -> stdout with splice(), all inside the kernel
+ *     wc -c  on a regular file is its st_size
+ *     wc -l  counts newlines 64 bytes at a time with SSE2
+ *     tail   on a regular file scans back from the end of the mapping
+ *
+ * Options these builtins do not know are not an error: the command is
+ * run as the external program instead, so `cat -A` or `tail -f` work
+ * as they always did.
+ */
+
+#define DSH_TEXT_OUT_BUFSIZE 65536    // fd streams batch small writes up to this
+#define DSH_TEXT_TAIL_KEEP (1 << 20)  // tail of a pipe: trim what it holds past this
+
+/*
+ * Counts the bytes equal to c. glibc's memchr() is vectorized but stops
+ * at every match; for counting, compare 64 bytes at a time and add up
+ * the match masks instead.
+ */
+size_t dsh_text_count(const char *buf, size_t len, char c) {
+    size_t count = 0, it = 0;
+
+#ifdef __SSE2__
+    __m128i needle = _mm_set1_epi8(c);
+
+    for (; it + 64 <= len; it += 64) {
+        unsigned long long mask;
+        mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + it)), needle));
+        mask |= (unsigned long long) (unsigned) _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + it + 16)), needle)) << 16;
+        mask |= (unsigned long long) (unsigned) _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + it + 32)), needle)) << 32;
+        mask |= (unsigned long long) (unsigned) _mm_movemask_epi8(
+                    _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (buf + it + 48)), needle)) << 48;
+        count += __builtin_popcountll(mask);
+    }
+#endif
+    for (; it < len; it++) {
+        count += buf[it] == c;
+    }
+    return count;
+}
+
+/* ---- descriptor stream: the end of every chain ---- */
+
+struct dsh_fd_stream {
+    struct dsh_stream base;
+    int fd;
+    size_t used;
+    char buf[DSH_TEXT_OUT_BUFSIZE];
+};
+
+static int dsh_fd_stream_flush(struct dsh_fd_stream *out) {
+    ssize_t n = out->used ? dsh_io_write_all(out->fd, out->buf, out->used) : 0;
+
+    out->used = 0;
+    return n < 0 ? -1 : 0;
+}
+
+// Small pieces are gathered into one write(); big ones go straight out
+static int dsh_fd_stream_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_fd_stream *out = (struct dsh_fd_stream *) stream;
+
+    if (out->used + len > sizeof(out->buf)) {
+        if (dsh_fd_stream_flush(out) != 0) {
+            return -1;
+        }
+        if (len >= sizeof(out->buf)) {
+            return dsh_io_write_all(out->fd, buf, len) < 0 ? -1 : 0;
+        }
+    }
+    memcpy(out->buf + out->used, buf, len);
+    out->used += len;
+    return 0;
+}
+
+static int dsh_fd_stream_close(struct dsh_stream *stream) {
+    int status = dsh_fd_stream_flush((struct dsh_fd_stream *) stream);
+
+    free(stream);
+    return status;
+}
+
+struct dsh_stream *dsh_stream_fd(int fd) {
+    struct dsh_fd_stream *out = dsh_xcalloc(1, sizeof(*out));
+
+    out->base.write = dsh_fd_stream_write;
+    out->base.close = dsh_fd_stream_close;
+    out->fd = fd;
+    return &out->base;
+}
+
+// The descriptor a chain ends in, if nothing but `stream` is in the way
+static int dsh_stream_direct_fd(struct dsh_stream *stream) {
+    struct dsh_fd_stream *out = (struct dsh_fd_stream *) stream;
+
+    if (stream->write != dsh_fd_stream_write) {
+        return -1;
+    }
+    if (dsh_fd_stream_flush(out) != 0) {
+        return -1;
+    }
+    return out->fd;
+}
+
+/*
+ * Pushes everything fd has into stream, stopping early if the stream
+ * says it has had enough. Returns 0, or -1 after printing an error.
+ */
+int dsh_stream_feed(struct dsh_stream *stream, int fd, const char *name) {
+    struct dsh_io_source src = { 0 };
+    struct stat st;
+    ssize_t n;
+    int status = 0;
+
+    /*
+     * A regular file is mapped from its offset, which is then moved past
+     * what the stream took: a redirected stdin is shared with the shell,
+     * and `head -n 1; wc -l` must leave the rest for the next command.
+     */
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        off_t offset = lseek(fd, 0, SEEK_CUR);
+        off_t base = offset & ~(off_t) (sysconf(_SC_PAGESIZE) - 1);
+        size_t len = st.st_size - offset;
+        char *map;
+
+        if (offset < 0 || offset >= st.st_size) {
+            return 0;
+        }
+        map = mmap(NULL, st.st_size - base, PROT_READ, MAP_PRIVATE, fd, base);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size - base, MADV_SEQUENTIAL);
+            status = stream->write(stream, map + (offset - base), len);
+            munmap(map, st.st_size - base);
+            lseek(fd, offset + len - (status == 1 ? stream->unused : 0), SEEK_SET);
+            return status < 0 ? -1 : 0;
+        }
+    }
+
+    dsh_io_open(&src, fd);
+    while ((n = dsh_io_fill(&src)) > 0) {
+        status = stream->write(stream, src.buf + src.pos, n);
+        src.pos = src.len;
+        if (status != 0) {
+            break;
+        }
+    }
+    dsh_io_close(&src);
+    if (n < 0) {
+        fprintf(stderr, "dsh: %s: %s\n", name, strerror(errno));
+        dsh_status = 1;
+        return -1;
+    }
+    return status < 0 ? -1 : 0;
+}
+
+/* ---- cat ---- */
+
+static int dsh_cat_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    return stream->next->write(stream->next, buf, len);
+}
+
+static int dsh_pass_close(struct dsh_stream *stream) {
+    free(stream);
+    return 0;
+}
+
+struct dsh_stream *dsh_cat_stream(struct dsh_stream *next) {
+    struct dsh_stream *cat = dsh_xcalloc(1, sizeof(*cat));
+
+    cat->write = dsh_cat_write;
+    cat->close = dsh_pass_close;
+    cat->next = next;
+    return cat;
+}
+
+/*
+ * Copies in to out without the data coming up to us. Returns 0 when
+ * done, 1 if the kernel cannot do it for this pair (nothing was copied
+ * then), -1 on a real error.
+ */
+static int dsh_cat_kernel(int in, int out) {
+    struct stat st;
+    ssize_t n;
+    int copied = 0;
+
+    if (fstat(in, &st) != 0) {
+        return 1;
+    }
+    if (S_ISREG(st.st_mode)) {
+        // copy_file_range() between files, sendfile() to anything else
+        while ((n = copy_file_range(in, NULL, out, NULL, 1 << 30, 0)) > 0) {
+            copied = 1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (copied || (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EBADF &&
+                       errno != EOPNOTSUPP)) {
+            return -1;
+        }
+        while ((n = sendfile(out, in, NULL, 1 << 30)) > 0) {
+            copied = 1;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        return copied || (errno != EINVAL && errno != ENOSYS) ? -1 : 1;
+    }
+    if (S_ISFIFO(st.st_mode)) {
+        do {
+            n = splice(in, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE);
+            copied |= n > 0;
+        } while (n > 0 || (n < 0 && errno == EINTR));
+        if (n == 0) {
+            return 0;
+        }
+        return copied || errno != EINVAL ? -1 : 1;
+    }
+    return 1;
+}
+
+/* ---- head ---- */
+
+struct dsh_head_stream {
+    struct dsh_stream base;
+    long left;  // lines still to pass on
+};
+
+static int dsh_head_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_head_stream *head = (struct dsh_head_stream *) stream;
+    const char *p = buf, *end = buf + len;
+    int status;
+
+    while (head->left > 0 && p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        if (newline == NULL) {
+            p = end;
+            break;
+        }
+        p = newline + 1;
+        head->left--;
+    }
+    status = p > buf ? stream->next->write(stream->next, buf, p - buf) : 0;
+    stream->unused = end - p;
+    return status != 0 ? status : head->left == 0;
+}
+
+struct dsh_stream *dsh_head_stream(long lines, struct dsh_stream *next) {
+    struct dsh_head_stream *head = dsh_xcalloc(1, sizeof(*head));
+
+    head->base.write = dsh_head_write;
+    head->base.close = dsh_pass_close;
+    head->base.next = next;
+    head->left = lines;
+    return &head->base;
+}
+
+/* ---- tail ---- */
+
+struct dsh_tail_stream {
+    struct dsh_stream base;
+    long lines;
+    int from_start;  // tail -n +N: skip lines-1 lines, pass the rest
+    char *buf;       // otherwise: what has been seen, trimmed now and then
+    size_t len;
+    size_t cap;
+};
+
+// Where the last `lines` lines of buf start; a final newline does not start a line
+static size_t dsh_tail_start(const char *buf, size_t len, long lines) {
+    size_t end = len;
+
+    if (lines == 0) {
+        return len;  // nothing is kept, whether or not the last line ends
+    }
+    if (end > 0 && buf[end - 1] == '\n') {
+        end--;
+    }
+    while (lines > 0) {
+        const char *newline = memrchr(buf, '\n', end);
+        if (newline == NULL) {
+            return 0;
+        }
+        end = newline - buf;
+        lines--;
+    }
+    return end + 1;
+}
+
+static int dsh_tail_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_tail_stream *tail = (struct dsh_tail_stream *) stream;
+
+    if (tail->from_start) {
+        while (tail->lines > 1 && len > 0) {
+            const char *newline = memchr(buf, '\n', len);
+            if (newline == NULL) {
+                return 0;
+            }
+            len -= newline + 1 - buf;
+            buf = newline + 1;
+            tail->lines--;
+        }
+        return len ? stream->next->write(stream->next, buf, len) : 0;
+    }
+
+    if (tail->len + len > tail->cap) {
+        while (tail->len + len > tail->cap) {
+            tail->cap = tail->cap ? tail->cap * 2 : DSH_TEXT_OUT_BUFSIZE;
+        }
+        tail->buf = dsh_xrealloc(tail->buf, tail->cap);
+    }
+    memcpy(tail->buf + tail->len, buf, len);
+    tail->len += len;
+
+    // Keep memory bounded by what the last lines need
+    if (tail->len > DSH_TEXT_TAIL_KEEP) {
+        size_t start = dsh_tail_start(tail->buf, tail->len, tail->lines);
+        memmove(tail->buf, tail->buf + start, tail->len - start);
+        tail->len -= start;
+    }
+    return 0;
+}
+
+static int dsh_tail_close(struct dsh_stream *stream) {
+    struct dsh_tail_stream *tail = (struct dsh_tail_stream *) stream;
+    int status = 0;
+
+    if (!tail->from_start && tail->len > 0) {
+        size_t start = dsh_tail_start(tail->buf, tail->len, tail->lines);
+        status = stream->next->write(stream->next, tail->buf + start, tail->len - start) < 0 ? -1 : 0;
+    }
+    free(tail->buf);
+    free(tail);
+    return status;
+}
+
+struct dsh_stream *dsh_tail_stream(long lines, int from_start, struct dsh_stream *next) {
+    struct dsh_tail_stream *tail = dsh_xcalloc(1, sizeof(*tail));
+
+    tail->base.write = dsh_tail_write;
+    tail->base.close = dsh_tail_close;
+    tail->base.next = next;
+    tail->lines = lines;
+    tail->from_start = from_start;
+    return &tail->base;
+}
+
+/* ---- wc ---- */
+
+enum {
+    DSH_WC_LINES = 1,
+    DSH_WC_WORDS = 2,
+    DSH_WC_BYTES = 4
+};
+
+struct dsh_wc_counts {
+    unsigned long long lines;
+    unsigned long long words;
+    unsigned long long bytes;
+};
+
+struct dsh_wc_stream {
+    struct dsh_stream base;
+    int which;                      // DSH_WC_* to count and print
+    int in_word;                    // the last buffer ended inside a word
+    int width;                      // field width, 0 for none
+    const char *label;              // printed after the counts, or NULL
+    struct dsh_wc_counts counts;
+    struct dsh_wc_counts *total;    // also added here, if not NULL
+};
+
+static int dsh_wc_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static int dsh_wc_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    struct dsh_wc_stream *wc = (struct dsh_wc_stream *) stream;
+    size_t it;
+
+    wc->counts.bytes += len;
+    if (wc->which & DSH_WC_WORDS) {
+        int in_word = wc->in_word;
+        for (it = 0; it < len; it++) {
+            int space = dsh_wc_space(buf[it]);
+            wc->counts.words += in_word && space;
+            wc->counts.lines += buf[it] == '\n';
+            in_word = !space;
+        }
+        wc->in_word = in_word;
+    } else if (wc->which & DSH_WC_LINES) {
+        wc->counts.lines += dsh_text_count(buf, len, '\n');
+    }
+    return 0;
+}
+
+static int dsh_wc_print(struct dsh_stream *next, int which, int width, const struct dsh_wc_counts *counts,
+                        const char *label) {
+    char line[128];
+    int n = 0;
+
+#define DSH_WC_FIELD(flag, value) \
+    if (which & (flag)) { \
+        n += snprintf(line + n, sizeof(line) - n, "%s%*llu", n ? " " : "", width, value); \
+    }
+    DSH_WC_FIELD(DSH_WC_LINES, counts->lines)
+    DSH_WC_FIELD(DSH_WC_WORDS, counts->words)
+    DSH_WC_FIELD(DSH_WC_BYTES, counts->bytes)
+#undef DSH_WC_FIELD
+
+    if (label) {
+        int len = strlen(label);
+        if (next->write(next, line, n) != 0 || next->write(next, " ", 1) != 0 ||
+            next->write(next, label, len) != 0) {
+            return -1;
+        }
+        return next->write(next, "\n", 1) != 0 ? -1 : 0;
+    }
+    line[n++] = '\n';
+    return next->write(next, line, n) != 0 ? -1 : 0;
+}
+
+static int dsh_wc_close(struct dsh_stream *stream) {
+    struct dsh_wc_stream *wc = (struct dsh_wc_stream *) stream;
+    int status;
+
+    wc->counts.words += wc->in_word;
+    if (wc->total) {
+        wc->total->lines += wc->counts.lines;
+        wc->total->words += wc->counts.words;
+        wc->total->bytes += wc->counts.bytes;
+    }
+    status = dsh_wc_print(stream->next, wc->which, wc->width, &wc->counts, wc->label);
+    free(wc);
+    return status;
+}
+
+struct dsh_stream *dsh_wc_stream(int which, struct dsh_stream *next) {
+    struct dsh_wc_stream *wc = dsh_xcalloc(1, sizeof(*wc));
+
+    wc->base.write = dsh_wc_write;
+    wc->base.close = dsh_wc_close;
+    wc->base.next = next;
+    wc->which = which;
+    return &wc->base;
+}
+
+/* ---- the builtins ---- */
+
+// Runs the real program when a builtin meets an option it does not know
+static int dsh_text_external(char **args) {
+    return dsh_launch(args);
+}
+
+/*
+ * Opens operand `name` ("-" is stdin). Returns the descriptor, or -1
+ * after printing why not.
+ */
+static int dsh_text_open(const char *tool, const char *name) {
+    int fd;
+
+    if (strcmp(name, "-") == 0) {
+        return STDIN_FILENO;
+    }
+    fd = open(name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "dsh: %s: %s: %s\n", tool, name, strerror(errno));
+        dsh_status = 1;
+    }
+    return fd;
+}
+
+static void dsh_text_done(int fd) {
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+}
+
+// -n N, -nN or -N; +N (tail) sets *from_start. Returns the next operand, or -1
+static int dsh_text_lines_opt(char **args, long *lines, int *from_start) {
+    const char *value;
+    char *end;
+    int argi = 1;
+
+    if (args[1] == NULL || args[1][0] != '-' || args[1][1] == '\0') {
+        return 1;
+    }
+    if (strcmp(args[1], "--") == 0) {
+        return 2;
+    }
+    if (args[1][1] == 'n') {
+        value = args[1][2] ? args[1] + 2 : args[2];
+        argi = args[1][2] ? 2 : 3;
+    } else {
+        value = args[1] + 1;
+        argi = 2;
+    }
+    if (value == NULL) {
+        return -1;
+    }
+    if (*value == '+' && from_start) {
+        *from_start = 1;
+        value++;
+    }
+    if (*value < '0' || *value > '9') {
+        return -1;
+    }
+    *lines = strtol(value, &end, 10);
+    if (*end != '\0') {
+        return -1;
+    }
+    if (args[argi] != NULL && strcmp(args[argi], "--") == 0) {
+        argi++;
+    }
+    return argi;
+}
+
+/*
+ * Runs the operands through a fresh operator each, made by make_stage,
+ * with "==> name <==" headers when there is more than one.
+ */
+static int dsh_text_each(const char *tool, char **operands, struct dsh_stream *out,
+                         struct dsh_stream *(*make_stage)(void *ctx, struct dsh_stream *next), void *ctx) {
+    char *stdin_only[] = { "-", NULL };
+    int count, it;
+
+    if (operands[0] == NULL) {
+        operands = stdin_only;
+    }
+    for (count = 0; operands[count] != NULL; count++) {
+        ;
+    }
+
+    for (it = 0; it < count; it++) {
+        struct dsh_stream *stage;
+        int fd = dsh_text_open(tool, operands[it]);
+
+        if (fd < 0) {
+            continue;
+        }
+        if (count > 1) {
+            char header[4096];
+            int n = snprintf(header, sizeof(header), "%s==> %s <==\n", it ? "\n" : "",
+                             strcmp(operands[it], "-") ? operands[it] : "standard input");
+            out->write(out, header, n < (int) sizeof(header) ? n : (int) sizeof(header) - 1);
+        }
+        stage = make_stage(ctx, out);
+        dsh_stream_feed(stage, fd, operands[it]);
+        stage->close(stage);
+        dsh_text_done(fd);
+    }
+    return 1;
+}
+
+// cat takes no options at all. Returns the first operand, or -1
+static int dsh_cat_opt(char **args) {
+    int argi = args[1] != NULL && strcmp(args[1], "--") == 0 ? 2 : 1;
+    int it;
+
+    for (it = argi; args[it] != NULL; it++) {
+        if (args[it][0] == '-' && args[it][1] != '\0') {
+            return -1;
+        }
+    }
+    return argi;
+}
+
+int dsh_cat(char **args) {
+    char *stdin_only[] = { "-", NULL };
+    char **operands;
+    struct dsh_stream *out;
+    int argi = dsh_cat_opt(args);
+    int it, status;
+
+    if (argi < 0) {
+        return dsh_text_external(args);
+    }
+    operands = args + argi;
+    if (operands[0] == NULL) {
+        operands = stdin_only;
+    }
+
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    for (it = 0; operands[it] != NULL; it++) {
+        int fd = dsh_text_open("cat", operands[it]);
+        int direct;
+
+        if (fd < 0) {
+            continue;
+        }
+        direct = dsh_stream_direct_fd(out);
+        status = direct < 0 ? 1 : dsh_cat_kernel(fd, direct);
+        if (status > 0) {
+            struct dsh_stream *cat = dsh_cat_stream(out);
+            dsh_stream_feed(cat, fd, operands[it]);
+            cat->close(cat);
+        } else if (status < 0) {
+            fprintf(stderr, "dsh: cat: %s: %s\n", operands[it], strerror(errno));
+            dsh_status = 1;
+        }
+        dsh_text_done(fd);
+    }
+    out->close(out);
+    return 1;
+}
+
+static struct dsh_stream *dsh_head_make(void *ctx, struct dsh_stream *next) {
+    return dsh_head_stream(*(long *) ctx, next);
+}
+
+int dsh_head(char **args) {
+    struct dsh_stream *out;
+    long lines = 10;
+    int argi = dsh_text_lines_opt(args, &lines, NULL);
+
+    if (argi < 0) {
+        return dsh_text_external(args);
+    }
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    dsh_text_each("head", args + argi, out, dsh_head_make, &lines);
+    out->close(out);
+    return 1;
+}
+
+struct dsh_tail_opts {
+    long lines;
+    int from_start;
+};
+
+static struct dsh_stream *dsh_tail_make(void *ctx, struct dsh_stream *next) {
+    struct dsh_tail_opts *opts = ctx;
+    return dsh_tail_stream(opts->lines, opts->from_start, next);
+}
+
+/*
+ * tail of a regular file: map it and look back from the end, so only
+ * the pages holding the last lines are ever touched.
+ */
+static int dsh_tail_file(int fd, long lines, struct dsh_stream *out) {
+    struct stat st;
+    off_t offset;
+    size_t start;
+    char *map;
+    int status;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 1;
+    }
+    if (st.st_size == 0) {
+        return 1;  // empty, or a /proc file whose size is not known until read
+    }
+    if ((offset = lseek(fd, 0, SEEK_CUR)) < 0 || offset >= st.st_size) {
+        return 0;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+    // Nothing before the offset: a shared stdin may have been read that far
+    start = offset + dsh_tail_start(map + offset, st.st_size - offset, lines);
+    status = out->write(out, map + start, st.st_size - start);
+    munmap(map, st.st_size);
+    lseek(fd, 0, SEEK_END);
+    return status < 0 ? -1 : 0;
+}
+
+int dsh_tail(char **args) {
+    struct dsh_tail_opts opts = { 10, 0 };
+    struct dsh_stream *out;
+    int argi = dsh_text_lines_opt(args, &opts.lines, &opts.from_start);
+    int count;
+
+    if (argi < 0) {
+        return dsh_text_external(args);
+    }
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    for (count = 0; args[argi + count] != NULL; count++) {
+        ;
+    }
+
+    if (count == 1 && !opts.from_start && strcmp(args[argi], "-") != 0) {
+        // The common `tail -n N FILE`: straight from the end of the mapping
+        int fd = dsh_text_open("tail", args[argi]);
+        if (fd >= 0) {
+            if (dsh_tail_file(fd, opts.lines, out) > 0) {
+                struct dsh_stream *tail = dsh_tail_stream(opts.lines, 0, out);
+                dsh_stream_feed(tail, fd, args[argi]);
+                tail->close(tail);
+            }
+            dsh_text_done(fd);
+        }
+    } else {
+        dsh_text_each("tail", args + argi, out, dsh_tail_make, &opts);
+    }
+    out->close(out);
+    return 1;
+}
+
+// Decimal digits in n, at least 1
+static int dsh_wc_digits(unsigned long long n) {
+    int digits = 1;
+
+    while (n >= 10) {
+        n /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+// -l, -w, -c in any combination, all three by default. Returns the first operand, or -1
+static int dsh_wc_opt(char **args, int *which) {
+    int argi;
+
+    *which = 0;
+    for (argi = 1; args[argi] != NULL && args[argi][0] == '-' && args[argi][1] != '\0'; argi++) {
+        const char *flag;
+
+        if (strcmp(args[argi], "--") == 0) {
+            argi++;
+            break;
+        }
+        for (flag = args[argi] + 1; *flag; flag++) {
+            if (*flag == 'l') {
+                *which |= DSH_WC_LINES;
+            } else if (*flag == 'w') {
+                *which |= DSH_WC_WORDS;
+            } else if (*flag == 'c') {
+                *which |= DSH_WC_BYTES;
+            } else {
+                return -1;
+            }
+        }
+    }
+    if (*which == 0) {
+        *which = DSH_WC_LINES | DSH_WC_WORDS | DSH_WC_BYTES;
+    }
+    return argi;
+}
+
+/*
+ * Like coreutils: columns as wide as the biggest file's size, none for
+ * one number. stdin (count 0) is read through stdin_fd.
+ */
+static int dsh_wc_width(int which, char **operands, int count, int stdin_fd) {
+    unsigned long long biggest = 0;
+    struct stat st;
+    int it;
+
+    if ((which == DSH_WC_LINES || which == DSH_WC_WORDS || which == DSH_WC_BYTES) && count <= 1) {
+        return 0;
+    }
+    if (count == 0) {
+        // stdin: sized like a file if it is one, else room for seven digits
+        return fstat(stdin_fd, &st) == 0 && S_ISREG(st.st_mode) ? dsh_wc_digits(st.st_size) : 7;
+    }
+    for (it = 0; it < count; it++) {
+        if (stat(operands[it], &st) == 0 && S_ISREG(st.st_mode) && (unsigned long long) st.st_size > biggest) {
+            biggest = st.st_size;
+        }
+    }
+    return dsh_wc_digits(biggest);
+}
+
+int dsh_wc(char **args) {
+    struct dsh_wc_counts total = { 0, 0, 0 };
+    char *stdin_only[] = { NULL };
+    char **operands;
+    struct dsh_stream *out;
+    int which, width, count, it;
+    int argi = dsh_wc_opt(args, &which);
+
+    if (argi < 0) {
+        return dsh_text_external(args);
+    }
+    operands = args[argi] ? args + argi : stdin_only;
+    for (count = 0; operands[count] != NULL; count++) {
+        ;
+    }
+    width = dsh_wc_width(which, operands, count, STDIN_FILENO);
+
+    fflush(stdout);
+    out = dsh_stream_fd(STDOUT_FILENO);
+    for (it = 0; it < (count ? count : 1); it++) {
+        const char *name = count ? operands[it] : "-";
+        struct dsh_wc_stream *wc;
+        struct stat st;
+        off_t offset;
+        int fd = dsh_text_open("wc", name);
+
+        if (fd < 0) {
+            continue;
+        }
+        wc = (struct dsh_wc_stream *) dsh_wc_stream(which, out);
+        wc->width = width;
+        wc->label = count ? name : NULL;
+        wc->total = &total;
+        // A size of 0 may only mean the kernel makes it up as it is read (/proc)
+        if (which == DSH_WC_BYTES && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+            (offset = lseek(fd, 0, SEEK_CUR)) >= 0) {
+            // No need to read it, just to move past it
+            wc->counts.bytes = offset < st.st_size ? st.st_size - offset : 0;
+            lseek(fd, 0, SEEK_END);
+        } else {
+            dsh_stream_feed(&wc->base, fd, name);
+        }
+        wc->base.close(&wc->base);
+        dsh_text_done(fd);
+    }
+    if (count > 1) {
+        dsh_wc_print(out, which, width, &total, "total");
+    }
+    out->close(out);
+    return 1;
+}
+
+/*
+ * cat, head, tail or wc as one stage of a pipeline (pipeline.c), reading
+ * whatever the stage before it writes. Returns NULL when args need the
+ * external program; otherwise *operands is set to the file operands,
+ * which the pipeline feeds in itself when this is the first stage.
+ */
+struct dsh_stream *dsh_text_stage(char **args, char ***operands, struct dsh_stream *next) {
+    long lines = 10;
+    int from_start = 0, which, argi;
+
+    if (strcmp(args[0], "cat") == 0) {
+        if ((argi = dsh_cat_opt(args)) < 0) {
+            return NULL;
+        }
+        *operands = args + argi;
+        return dsh_cat_stream(next);
+    }
+    if (strcmp(args[0], "head") == 0 || strcmp(args[0], "tail") == 0) {
+        int head = args[0][0] == 'h';
+        if ((argi = dsh_text_lines_opt(args, &lines, head ? NULL : &from_start)) < 0) {
+            return NULL;
+        }
+        *operands = args + argi;
+        return head ? dsh_head_stream(lines, next) : dsh_tail_stream(lines, from_start, next);
+    }
+    if (strcmp(args[0], "wc") == 0 && (argi = dsh_wc_opt(args, &which)) >= 0) {
+        struct dsh_wc_stream *wc;
+        int count;
+
+        *operands = args + argi;
+        for (count = 0; args[argi + count] != NULL; count++) {
+            ;
+        }
+        wc = (struct dsh_wc_stream *) dsh_wc_stream(which, next);
+        // Only a first stage has operands, and then only one (see pipeline.c)
+        wc->width = dsh_wc_width(which, *operands, count, -1);
+        wc->label = count ? args[argi] : NULL;
+        return &wc->base;
+    }
+    return NULL;
+}
@@ -0,0 +1,220 @@
+#include <sys/resource.h>  // for getrusage(), struct rusage
+#include <time.h>    // for clock_gettime(), CLOCK_REALTIME
+#include <stdlib.h>  // for free(), qsort()
+#include <stdio.h>   // for printf(), snprintf(), fprintf()
+#include <string.h>  // for strcmp(), strchr(), memset()
+
+#include "dsh.h"
+
+/*
+ * Command timing.
+ *
+ * The loop already reads CLOCK_MONOTONIC around every command for
+ * dshstat; those reads come from the vDSO, so they cost no syscall.
+ * dsh_timing_record() keeps the last duration and a per-command-name
+ * total, kept by the name's id, shown by the `timings` builtin, and
+ * dsh_timing_var() serves the clock variables without anyone having to
+ * fork `date`:
+ *
+ *     $SECONDS         whole seconds since the shell started
+ *     $EPOCHSECONDS    seconds since the Unix epoch
+ *     $EPOCHREALTIME   the same with microseconds, e.g. 1760700000.123456
+ *     $CMD_DURATION    the last command's wall time in milliseconds
+ *
+ * `time CMD...` times one command, or a whole pipeline, the way bash
+ * does, and adds the context switches it cost.
+ */
+
+#define DSH_TIMING_TABLE_BUFSIZE 64  // starting size of the per-name table
+#define DSH_TIMING_MAX_NAMES 1024    // names timings will intern itself; the rest are "(other)"
+
+struct dsh_timing_entry {
+    unsigned long long count;
+    unsigned long long total_ns;
+    unsigned long long max_ns;
+};
+
+/*
+ * Indexed by the id of the command's name (intern.c). Builtins,
+ * functions and commands found on $PATH are interned already; any
+ * other name (./script, /bin/ls) takes one of DSH_TIMING_MAX_NAMES, so
+ * a script that runs a new path every line cannot grow the table, or
+ * the names, without end.
+ */
+static struct dsh_timing_entry *dsh_timing_table;
+static size_t dsh_timing_cap;
+static size_t dsh_timing_names;
+static struct dsh_timing_entry dsh_timing_other;
+
+static unsigned long long dsh_timing_start_ns;
+static unsigned long long dsh_timing_last_ns;
+
+void dsh_timing_init(void) {
+    dsh_timing_start_ns = dsh_now_ns();
+}
+
+static struct dsh_timing_entry *dsh_timing_find(const char *name) {
+    int id = dsh_intern_find(name);
+
+    if (id < 0 && dsh_timing_names < DSH_TIMING_MAX_NAMES) {
+        id = dsh_intern(name);
+        dsh_timing_names++;
+    }
+    if (id < 0) {
+        return &dsh_timing_other;
+    }
+    if ((size_t) id >= dsh_timing_cap) {
+        size_t cap = dsh_timing_cap ? dsh_timing_cap : DSH_TIMING_TABLE_BUFSIZE;
+        struct dsh_timing_entry *table;
+
+        while (cap <= (size_t) id) {
+            cap *= 2;
+        }
+        table = dsh_xrealloc(dsh_timing_table, cap * sizeof(*table));
+        memset(table + dsh_timing_cap, 0, (cap - dsh_timing_cap) * sizeof(*table));
+        dsh_timing_table = table;
+        dsh_timing_cap = cap;
+    }
+    return &dsh_timing_table[id];
+}
+
+/*
+ * Adds a line's time to its command name. Lines that only assign
+ * variables, or start with `(` or `{`, count towards $CMD_DURATION
+ * but have no name to go under.
+ */
+void dsh_timing_record(const char *name, unsigned long long ns) {
+    struct dsh_timing_entry *entry;
+
+    dsh_timing_last_ns = ns;
+    if (strchr(name, '=') || (name[0] != '\0' && name[1] == '\0' && strchr("|;(){}", name[0]))) {
+        return;
+    }
+    entry = dsh_timing_find(name);
+    entry->count++;
+    entry->total_ns += ns;
+    if (ns > entry->max_ns) {
+        entry->max_ns = ns;
+    }
+}
+
+/*
+ * Writes the value of one of the clock variables into buf.
+ * Returns buf, or NULL if name is not one of them.
+ */
+const char *dsh_timing_var(const char *name, char *buf, size_t size) {
+    struct timespec ts;
+
+    if (strcmp(name, "SECONDS") == 0) {
+        snprintf(buf, size, "%llu", (dsh_now_ns() - dsh_timing_start_ns) / 1000000000ULL);
+    } else if (strcmp(name, "EPOCHSECONDS") == 0) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        snprintf(buf, size, "%lld", (long long) ts.tv_sec);
+    } else if (strcmp(name, "EPOCHREALTIME") == 0) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        snprintf(buf, size, "%lld.%06ld", (long long) ts.tv_sec, ts.tv_nsec / 1000);
+    } else if (strcmp(name, "CMD_DURATION") == 0) {
+        snprintf(buf, size, "%llu.%03llu", dsh_timing_last_ns / 1000000ULL,
+                 dsh_timing_last_ns / 1000ULL % 1000ULL);
+    } else {
+        return NULL;
+    }
+    return buf;
+}
+
+static int dsh_timing_by_total(const void *a, const void *b) {
+    const struct dsh_timing_entry *x = *(const struct dsh_timing_entry * const *) a;
+    const struct dsh_timing_entry *y = *(const struct dsh_timing_entry * const *) b;
+    return x->total_ns < y->total_ns ? 1 : x->total_ns > y->total_ns ? -1 : 0;
+}
+
+static void dsh_timing_print(const char *name, const struct dsh_timing_entry *entry) {
+    printf("%-20s %8llu %12.3f %12.3f %12.3f\n", name, entry->count, entry->total_ns / 1e6,
+           entry->total_ns / 1e6 / entry->count, entry->max_ns / 1e6);
+}
+
+/*
+ * timings [-r]: every command name run so far, slowest total first.
+ * -r forgets them.
+ */
+int dsh_timings(char **args) {
+    struct dsh_timing_entry **sorted;
+    size_t it, n = 0;
+
+    if (args[1] != NULL && strcmp(args[1], "-r") == 0) {
+        // The names stay interned, so they do not count against the cap again
+        memset(dsh_timing_table, 0, dsh_timing_cap * sizeof(*dsh_timing_table));
+        memset(&dsh_timing_other, 0, sizeof(dsh_timing_other));
+        return 1;
+    } else if (args[1] != NULL) {
+        fprintf(stderr, "dsh: usage: timings [-r]\n");
+        dsh_status = 1;
+        return 1;
+    }
+
+    sorted = dsh_xrealloc(NULL, (dsh_timing_cap + 1) * sizeof(*sorted));
+    for (it = 0; it < dsh_timing_cap; it++) {
+        if (dsh_timing_table[it].count) {
+            sorted[n++] = &dsh_timing_table[it];
+        }
+    }
+    qsort(sorted, n, sizeof(*sorted), dsh_timing_by_total);
+
+    printf("%-20s %8s %12s %12s %12s\n", "command", "count", "total_ms", "avg_ms", "max_ms");
+    for (it = 0; it < n; it++) {
+        dsh_timing_print(dsh_intern_name(sorted[it] - dsh_timing_table), sorted[it]);
+    }
+    if (dsh_timing_other.count) {
+        dsh_timing_print("(other)", &dsh_timing_other);
+    }
+    printf("last command: %.3f ms\n", dsh_timing_last_ns / 1e6);
+    free(sorted);
+    return 1;
+}
+
+static double dsh_time_seconds(const struct timeval *before, const struct timeval *after) {
+    return (after->tv_sec - before->tv_sec) + (after->tv_usec - before->tv_usec) / 1e6;
+}
+
+static void dsh_time_print(const char *label, double seconds) {
+    int minutes = (int) (seconds / 60);
+
+    fprintf(stderr, "%s\t%dm%.3fs\n", label, minutes, seconds - minutes * 60);
+}
+
+/*
+ * time CMD...: runs CMD and prints its real, user and sys time to
+ * stderr, then the context switches: the shell's own (builtins, and
+ * pipelines fused into it, threads and all) plus those of the children
+ * it waited for. A pipeline between programs that switches a lot is
+ * one whose pipes are too small; see pipesize in pipeline.c.
+ */
+int dsh_time(char **args) {
+    struct rusage self_before, kids_before, self_after, kids_after;
+    unsigned long long start, ns;
+    long voluntary, involuntary;
+    int status = 1;
+
+    getrusage(RUSAGE_SELF, &self_before);
+    getrusage(RUSAGE_CHILDREN, &kids_before);
+    start = dsh_now_ns();
+    if (args[1] != NULL) {
+        status = dsh_execute(args + 1);
+    }
+    ns = dsh_now_ns() - start;
+    getrusage(RUSAGE_SELF, &self_after);
+    getrusage(RUSAGE_CHILDREN, &kids_after);
+
+    voluntary = (self_after.ru_nvcsw - self_before.ru_nvcsw) + (kids_after.ru_nvcsw - kids_before.ru_nvcsw);
+    involuntary = (self_after.ru_nivcsw - self_before.ru_nivcsw) + (kids_after.ru_nivcsw - kids_before.ru_nivcsw);
+
+    fflush(stdout);
+    fprintf(stderr, "\n");
+    dsh_time_print("real", ns / 1e9);
+    dsh_time_print("user", dsh_time_seconds(&self_before.ru_utime, &self_after.ru_utime) +
+                           dsh_time_seconds(&kids_before.ru_utime, &kids_after.ru_utime));
+    dsh_time_print("sys", dsh_time_seconds(&self_before.ru_stime, &self_after.ru_stime) +
+                          dsh_time_seconds(&kids_before.ru_stime, &kids_after.ru_stime));
+    fprintf(stderr, "csw\t%ld voluntary, %ld involuntary\n", voluntary, involuntary);
+    return status;
+}
@@ -0,0 +1,530 @@
+#include <stdlib.h>  // for free(), strtol(), getenv(), setenv(), unsetenv()
+#include <stdio.h>   // for fprintf(), printf()
+#include <string.h>  // for strlen(), strchr(), strcmp(), memcpy(), memset()
+
+#include "dsh.h"
+
+/*
+ * Shell variables and functions, and the scopes they live in.
+ *
+ * Every name has one entry, holding what the name means right now, at
+ * its id from intern.c, so a lookup is one probe however deep the shell
+ * is in function calls and subshells. Scopes are kept the other way round, as
+ * undo logs ("shallow binding"). A frame is pushed for every function
+ * call and every subshell, and costs nothing until something changes:
+ *
+ *   - `local NAME` saves NAME's binding in the function's frame, and
+ *     the function's return puts it back;
+ *   - in a subshell, the first change to a name (an assignment, unset,
+ *     a function definition) saves what it was in the subshell's frame,
+ *     and the end of the subshell puts it back.
+ *
+ * So a call never copies the table, and a recursive function with one
+ * local pays one save per level. Anything else a function assigns goes
+ * straight to the binding in view, as in other shells.
+ *
+ * An entry remembers the id of the frame that last saved it. Ids only
+ * grow, so an entry saved by an id at or above a frame's was saved by
+ * that frame or by one inside it that is still running; either way that
+ * frame has nothing more to save.
+ *
+ * Each frame also has a view of the positional parameters: the call's
+ * arguments, pointed into rather than copied (they stay put while the
+ * call runs), and narrowed by shift. A subshell starts from its
+ * caller's view.
+ *
+ * A name that was in the environment when the shell first touched it,
+ * or that was given to `export`, is exported: its entry starts with the
+ * inherited value, and every change to it (an assignment, unset, local,
+ * the end of a scope) is made to the environment too, so the commands
+ * the shell starts, and its own $PATH and $CDPATH lookups, see it. The
+ * environment holds no other names the shell has bound.
+ */
+
+#define DSH_VARS_BUFSIZE 64     // starting size of the entries, the frame stack and each log
+#define DSH_VARS_MAX_DEPTH 4096 // calls and subshells inside each other
+
+struct dsh_var {
+    char *value;             // NULL when unset
+    struct dsh_func *func;   // NULL when not a function
+    unsigned saved_in;       // the frame that last saved value...
+    unsigned func_saved_in;  // ... and func
+    int id;                  // of the name, for the environment
+    int exported;
+};
+
+struct dsh_var_save {
+    struct dsh_var *var;
+    int func;       // which binding: func, or value
+    void *old;
+    unsigned saved_in;
+    int exported;   // with a value, whether it was exported
+};
+
+struct dsh_var_frame {
+    unsigned id;
+    int kind;
+    size_t outer_function;  // the innermost frames of each kind before this one
+    size_t outer_subshell;
+    struct dsh_var_save *saves;  // kept with its capacity for the next push
+    size_t nsaves;
+    size_t capsaves;
+    char **argv;            // $1, $2, ...
+    int argc;
+};
+
+static struct dsh_var **dsh_vars;  // by id; NULL for a name never bound
+static size_t dsh_vars_cap;
+static int dsh_funcs_defined;      // whether any function ever was
+
+static struct dsh_var_frame *dsh_frames;  // [0] is the shell's own
+static size_t dsh_frames_len;
+static size_t dsh_frames_cap;
+static size_t dsh_function_frame;  // innermost of each kind; 0 for none
+static size_t dsh_subshell_frame;
+static unsigned dsh_frames_next_id = 1;
+
+
+// The entry for name; with create, a new unset one if there is none
+static struct dsh_var *dsh_var_find(const char *name, int create) {
+    int id = create ? dsh_intern(name) : dsh_intern_find(name);
+
+    if (id < 0 || ((size_t) id >= dsh_vars_cap && !create)) {
+        return NULL;
+    }
+    if ((size_t) id >= dsh_vars_cap) {
+        size_t cap = dsh_vars_cap ? dsh_vars_cap : DSH_VARS_BUFSIZE;
+
+        while (cap <= (size_t) id) {
+            cap *= 2;
+        }
+        dsh_vars = dsh_xrealloc(dsh_vars, cap * sizeof(*dsh_vars));
+        memset(dsh_vars + dsh_vars_cap, 0, (cap - dsh_vars_cap) * sizeof(*dsh_vars));
+        dsh_vars_cap = cap;
+    }
+    if (dsh_vars[id] == NULL && create) {
+        const char *env = getenv(name);
+
+        dsh_vars[id] = dsh_xrealloc(NULL, sizeof(struct dsh_var));
+        memset(dsh_vars[id], 0, sizeof(struct dsh_var));
+        dsh_vars[id]->id = id;
+        // Inherited: exported, and what the environment says until changed
+        if (env) {
+            dsh_vars[id]->value = dsh_xstrdup(env);
+            dsh_vars[id]->exported = 1;
+        }
+    }
+    return dsh_vars[id];
+}
+
+// Makes the environment agree with var, if it is exported or just stopped being
+static void dsh_var_sync(struct dsh_var *var, int was_exported) {
+    if (var->exported && var->value) {
+        setenv(dsh_intern_name(var->id), var->value, 1);
+    } else if (var->exported || was_exported) {
+        unsetenv(dsh_intern_name(var->id));
+    }
+}
+
+static void dsh_frames_init(void) {
+    if (dsh_frames_len == 0) {
+        dsh_frames_cap = DSH_VARS_BUFSIZE;
+        dsh_frames = dsh_xrealloc(NULL, dsh_frames_cap * sizeof(*dsh_frames));
+        memset(dsh_frames, 0, dsh_frames_cap * sizeof(*dsh_frames));
+        dsh_frames_len = 1;
+    }
+}
+
+/*
+ * Saves one binding of var in frame, unless the frame already has.
+ * Returns 1 when the binding was saved: the log owns it now.
+ */
+static int dsh_var_save(size_t frame_idx, struct dsh_var *var, int func) {
+    unsigned *saved_in = func ? &var->func_saved_in : &var->saved_in;
+    struct dsh_var_frame *frame;
+    struct dsh_var_save *save;
+
+    if (frame_idx == 0 || *saved_in >= dsh_frames[frame_idx].id) {
+        return 0;
+    }
+    frame = &dsh_frames[frame_idx];
+    if (frame->nsaves == frame->capsaves) {
+        frame->capsaves = frame->capsaves ? frame->capsaves * 2 : DSH_VARS_BUFSIZE;
+        frame->saves = dsh_xrealloc(frame->saves, frame->capsaves * sizeof(*frame->saves));
+    }
+    save = &frame->saves[frame->nsaves++];
+    save->var = var;
+    save->func = func;
+    save->old = func ? (void *) var->func : (void *) var->value;
+    save->exported = var->exported;
+    save->saved_in = *saved_in;
+    *saved_in = frame->id;
+    return 1;
+}
+
+void dsh_func_release(struct dsh_func *func) {
+    if (func && --func->refs == 0) {
+        free(func);
+    }
+}
+
+// Gives var a new value (owned), saving the old one if a subshell needs it
+static void dsh_var_bind(struct dsh_var *var, char *value) {
+    if (!dsh_var_save(dsh_subshell_frame, var, 0)) {
+        free(var->value);
+    }
+    var->value = value;
+    dsh_var_sync(var, 0);
+}
+
+// The same for var's function
+static void dsh_func_bind(struct dsh_var *var, struct dsh_func *func) {
+    if (!dsh_var_save(dsh_subshell_frame, var, 1)) {
+        dsh_func_release(var->func);
+    }
+    var->func = func;
+}
+
+const char *dsh_var_get(const char *name) {
+    struct dsh_var *var = dsh_var_find(name, 0);
+    return var ? var->value : NULL;
+}
+
+void dsh_var_set(const char *name, const char *value) {
+    dsh_frames_init();
+    dsh_var_bind(dsh_var_find(name, 1), value ? dsh_xstrdup(value) : NULL);
+}
+
+/*
+ * Marks var exported, and puts it in the environment. In a subshell the
+ * mark is undone with the value, so the old value is saved first.
+ */
+static void dsh_var_mark_exported(struct dsh_var *var) {
+    if (var->exported) {
+        return;
+    }
+    if (dsh_var_save(dsh_subshell_frame, var, 0)) {
+        var->value = var->value ? dsh_xstrdup(var->value) : NULL;
+    }
+    var->exported = 1;
+    dsh_var_sync(var, 0);
+}
+
+// dsh_var_set(), exporting name too; for what the shell itself keeps up to date, like $PWD
+void dsh_var_export(const char *name, const char *value) {
+    struct dsh_var *var;
+
+    dsh_frames_init();
+    var = dsh_var_find(name, 1);
+    dsh_var_mark_exported(var);
+    dsh_var_bind(var, value ? dsh_xstrdup(value) : NULL);
+}
+
+// The value of name as the shell sees it: its variable, or else the environment
+const char *dsh_var_lookup(const char *name) {
+    struct dsh_var *var = dsh_var_find(name, 0);
+    return var ? var->value : getenv(name);
+}
+
+// The end of the NAME at the start of word, or word itself if there is none
+static const char *dsh_var_name_end(const char *word) {
+    const char *p = word;
+
+    if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || *p == '_')) {
+        return word;
+    }
+    while ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9') || *p == '_') {
+        p++;
+    }
+    return p;
+}
+
+// Whether word is NAME=VALUE
+static int dsh_var_is_assignment(const char *word) {
+    const char *end = dsh_var_name_end(word);
+    return end != word && *end == '=';
+}
+
+// Whether word is a NAME and nothing else
+static int dsh_var_is_name(const char *word) {
+    const char *end = dsh_var_name_end(word);
+    return end != word && *end == '\0';
+}
+
+/*
+ * NAME=VALUE... as a command of its own sets shell variables. Returns
+ * 0 when args is not all assignments, so it is run as a command.
+ */
+int dsh_var_assign(char **args) {
+    int it;
+
+    for (it = 0; args[it] != NULL; it++) {
+        if (!dsh_var_is_assignment(args[it])) {
+            return 0;
+        }
+    }
+    for (it = 0; args[it] != NULL; it++) {
+        char *equals = strchr(args[it], '=');
+
+        *equals = '\0';
+        dsh_var_set(args[it], equals + 1);
+        *equals = '=';
+    }
+    return 1;
+}
+
+/*
+ * local NAME[=VALUE]...: NAME is the function's own until it returns.
+ * In a subshell inside the function, the subshell's end is soon enough.
+ */
+int dsh_local(char **args) {
+    size_t frame = dsh_function_frame > dsh_subshell_frame ? dsh_function_frame : dsh_subshell_frame;
+    int it;
+
+    if (dsh_function_frame == 0) {
+        fprintf(stderr, "dsh: local: can only be used in a function\n");
+        dsh_status = 1;
+        return 1;
+    }
+    for (it = 1; args[it] != NULL; it++) {
+        char *equals = strchr(args[it], '=');
+        struct dsh_var *var;
+
+        if (equals) {
+            *equals = '\0';
+        }
+        var = dsh_var_find(args[it], 1);
+        if (!dsh_var_save(frame, var, 0)) {
+            // Already the function's own: `local` again just assigns
+            free(var->value);
+        }
+        var->value = equals ? dsh_xstrdup(equals + 1) : NULL;
+        dsh_var_sync(var, 0);
+        if (equals) {
+            *equals = '=';
+        }
+    }
+    return 1;
+}
+
+/*
+ * export [NAME[=VALUE]...]: puts NAME in the environment of every
+ * command started from now on, and keeps it there as it changes.
+ * Without NAMEs, lists the environment.
+ */
+int dsh_export(char **args) {
+    extern char **environ;
+    int it;
+
+    if (args[1] == NULL) {
+        for (it = 0; environ[it] != NULL; it++) {
+            printf("export %s\n", environ[it]);
+        }
+        return 1;
+    }
+    dsh_frames_init();
+    for (it = 1; args[it] != NULL; it++) {
+        char *equals = strchr(args[it], '=');
+        struct dsh_var *var;
+
+        if (equals) {
+            *equals = '\0';
+        }
+        if (!dsh_var_is_name(args[it])) {
+            fprintf(stderr, "dsh: export: `%s': not a valid name\n", args[it]);
+            dsh_status = 1;
+        } else {
+            var = dsh_var_find(args[it], 1);
+            dsh_var_mark_exported(var);
+            if (equals) {
+                dsh_var_bind(var, dsh_xstrdup(equals + 1));
+            }
+        }
+        if (equals) {
+            *equals = '=';
+        }
+    }
+    return 1;
+}
+
+// unset [-f|-v] NAME...: forgets variables, or with -f functions
+int dsh_unset(char **args) {
+    int it = 1, funcs = 0;
+
+    if (args[1] && (strcmp(args[1], "-f") == 0 || strcmp(args[1], "-v") == 0)) {
+        funcs = args[1][1] == 'f';
+        it++;
+    }
+    for (; args[it] != NULL; it++) {
+        // One only inherited has no entry yet; making it picks up the environment's
+        struct dsh_var *var = dsh_var_find(args[it], !funcs && getenv(args[it]) != NULL);
+
+        if (var == NULL) {
+            continue;
+        }
+        if (funcs) {
+            dsh_func_bind(var, NULL);
+        } else {
+            dsh_var_bind(var, NULL);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Defines a function from words[0 .. len), copied into one block with
+ * the function, so the line they came from can go. A name with an = in
+ * it could never be called: the command would be an assignment.
+ */
+int dsh_func_define(const char *name, char **words, int len) {
+    struct dsh_func *func;
+    size_t size = sizeof(*func) + (len + 1) * sizeof(char *);
+    char *text;
+    int it;
+
+    if (strchr(name, '=') != NULL) {
+        fprintf(stderr, "dsh: `%s': not a valid function name\n", name);
+        return -1;
+    }
+    for (it = 0; it < len; it++) {
+        size += strlen(words[it]) + 1;
+    }
+    func = dsh_xrealloc(NULL, size);
+    func->refs = 1;
+    func->len = len;
+    func->words = (char **) (func + 1);
+    text = (char *) (func->words + len + 1);
+    for (it = 0; it < len; it++) {
+        size_t n = strlen(words[it]) + 1;
+        func->words[it] = memcpy(text, words[it], n);
+        text += n;
+    }
+    func->words[len] = NULL;
+
+    dsh_frames_init();
+    dsh_funcs_defined = 1;
+    dsh_func_bind(dsh_var_find(name, 1), func);
+    return 0;
+}
+
+struct dsh_func *dsh_func_find(const char *name) {
+    struct dsh_var *var;
+
+    // Most shells never define one: skip the hash
+    if (!dsh_funcs_defined || (var = dsh_var_find(name, 0)) == NULL) {
+        return NULL;
+    }
+    return var->func;
+}
+
+// dsh_func_find() for a name already interned, as dsh_dispatch() has it
+struct dsh_func *dsh_func_of(int id) {
+    if ((size_t) id >= dsh_vars_cap || dsh_vars[id] == NULL) {
+        return NULL;
+    }
+    return dsh_vars[id]->func;
+}
+
+/*
+ * Pushes a frame. A function's frame takes argv (without the function's
+ * name) as its positional parameters. Returns -1, having said so, when
+ * calls and subshells are nested too deep.
+ */
+int dsh_scope_push(int kind, char **argv) {
+    struct dsh_var_frame *frame;
+    size_t outer;
+
+    dsh_frames_init();
+    if (dsh_frames_len > DSH_VARS_MAX_DEPTH) {
+        fprintf(stderr, "dsh: more than %d function calls and subshells inside each other\n",
+                DSH_VARS_MAX_DEPTH);
+        return -1;
+    }
+    if (dsh_frames_len == dsh_frames_cap) {
+        dsh_frames_cap *= 2;
+        dsh_frames = dsh_xrealloc(dsh_frames, dsh_frames_cap * sizeof(*dsh_frames));
+        memset(dsh_frames + dsh_frames_len, 0, (dsh_frames_cap - dsh_frames_len) * sizeof(*dsh_frames));
+    }
+    outer = dsh_frames_len - 1;
+    frame = &dsh_frames[dsh_frames_len];
+    frame->id = dsh_frames_next_id++;
+    frame->kind = kind;
+    frame->outer_function = dsh_function_frame;
+    frame->outer_subshell = dsh_subshell_frame;
+    frame->nsaves = 0;
+    if (kind == DSH_SCOPE_FUNCTION) {
+        frame->argv = argv;
+        for (frame->argc = 0; argv[frame->argc] != NULL; frame->argc++) {
+            ;
+        }
+        dsh_function_frame = dsh_frames_len;
+    } else {
+        frame->argv = dsh_frames[outer].argv;
+        frame->argc = dsh_frames[outer].argc;
+        dsh_subshell_frame = dsh_frames_len;
+    }
+    dsh_frames_len++;
+    return 0;
+}
+
+// Pops the innermost frame, putting back everything it saved
+void dsh_scope_pop(void) {
+    struct dsh_var_frame *frame = &dsh_frames[--dsh_frames_len];
+
+    while (frame->nsaves > 0) {
+        struct dsh_var_save *save = &frame->saves[--frame->nsaves];
+        struct dsh_var *var = save->var;
+
+        if (save->func) {
+            dsh_func_release(var->func);
+            var->func = save->old;
+            var->func_saved_in = save->saved_in;
+        } else {
+            int was_exported = var->exported;
+
+            free(var->value);
+            var->value = save->old;
+            var->saved_in = save->saved_in;
+            var->exported = save->exported;
+            dsh_var_sync(var, was_exported);
+        }
+    }
+    dsh_function_frame = frame->outer_function;
+    dsh_subshell_frame = frame->outer_subshell;
+}
+
+// The positional parameters in view: $1 is the first
+char **dsh_scope_args(int *argc) {
+    if (dsh_frames_len == 0) {
+        *argc = 0;
+        return NULL;
+    }
+    *argc = dsh_frames[dsh_frames_len - 1].argc;
+    return dsh_frames[dsh_frames_len - 1].argv;
+}
+
+// shift [N]: drops the first N (1) positional parameters
+int dsh_shift(char **args) {
+    struct dsh_var_frame *frame;
+    long n = 1;
+
+    dsh_frames_init();
+    frame = &dsh_frames[dsh_frames_len - 1];
+    if (args[1] != NULL) {
+        char *end;
+        n = strtol(args[1], &end, 10);
+        if (*end != '\0' || end == args[1] || n < 0) {
+            fprintf(stderr, "dsh: shift: %s: numeric argument required\n", args[1]);
+            dsh_status = 1;
+            return 1;
+        }
+    }
+    if (n > frame->argc) {
+        fprintf(stderr, "dsh: shift: %ld: shift count out of range\n", n);
+        dsh_status = 1;
+        return 1;
+    }
+    frame->argv += n;
+    frame->argc -= n;
+    return 1;
+}
@@ -0,0 +1,511 @@
+#define _GNU_SOURCE            // for getdents64(), struct dirent64, strerror_r()
+#include <sys/types.h>         // for pid_t
+#include <sys/stat.h>          // for fstatat(), struct stat
+#include <sys/wait.h>          // for waitpid()
+#include <dirent.h>            // for getdents64(), DT_*
+#include <fcntl.h>             // for openat(), O_DIRECTORY
+#include <fnmatch.h>           // for fnmatch()
+#include <pthread.h>           // for pthread_create(), pthread_mutex_*, pthread_cond_*
+#include <sched.h>             // for sched_yield()
+#include <stdatomic.h>         // for atomic_long, atomic_int
+#include <unistd.h>            // for close(), sysconf()
+#include <time.h>              // for time(), nanosleep()
+#include <errno.h>             // for errno
+#include <stdlib.h>            // for free(), strtol()
+#include <stdio.h>             // for fprintf()
+#include <string.h>            // for strcmp(), strlen(), memcpy()
+
+#include "dsh.h"
+
+/*
+ * walk: a parallel find.
+ *
+ *     walk [-0] [-j N] [DIR...] [-name GLOB] [-type f|d|l]
+ *          [-mtime [+-]DAYS] [-maxdepth N] [-- CMD [ARG...]]
+ *
+ * Prints every path under the DIRs (default .) that passes all the
+ * predicates, which mean what they mean to find(1); -0 ends paths with
+ * a NUL instead of a newline. After --, CMD ARG... PATH runs for each
+ * path instead, up to N at a time, while the walk goes on.
+ *
+ * N threads (default: one per online CPU) read directories. A worker
+ * reads one directory with getdents64() into a big buffer, takes the
+ * entry types from d_type (only mtime tests, or a file system that
+ * does not fill d_type, need an fstatat()), and pushes the
+ * subdirectories on the back of its own deque. It takes its next
+ * directory from the back too, so each worker goes depth first through
+ * what it found itself; a worker with nothing left steals from the
+ * front of another's, where the biggest untouched subtrees are.
+ *
+ * Paths are gathered per worker and written out in blocks, so the order
+ * is not find's. Symbolic links are listed, not followed.
+ */
+
+#define DSH_WALK_DENTS 65536   // getdents64() buffer
+#define DSH_WALK_OUT 65536     // a worker writes its paths out in blocks this big
+
+struct dsh_walk_dir {
+    char *path;
+    int depth;
+};
+
+// A worker's directories: the owner uses the back, thieves the front
+struct dsh_walk_deque {
+    pthread_mutex_t lock;
+    struct dsh_walk_dir *items;
+    size_t head, tail, cap;
+};
+
+struct dsh_walk;
+
+struct dsh_walk_worker {
+    struct dsh_walk *walk;
+    pthread_t thread;
+    struct dsh_walk_deque deque;
+    char *dents;
+    char *out;
+    size_t out_len;
+    unsigned seed;  // picks whom to steal from
+};
+
+struct dsh_walk {
+    // the predicates
+    const char *name;
+    char type;        // 'f', 'd', 'l' or 0 for any
+    char mtime_cmp;   // '+', '-', '=' or 0 for none
+    long mtime_days;
+    long maxdepth;    // -1: no limit
+    time_t now;
+    char end;         // '\n' or '\0'
+
+    struct dsh_walk_worker *workers;
+    int nworkers;
+    atomic_long pending;  // directories queued or being read
+    atomic_int failed;    // something could not be read: $? is 1, as with find
+
+    // output, or paths for the command
+    pthread_mutex_t out_lock;
+    pthread_cond_t out_ready;
+    char **cmd;
+    char **paths;
+    size_t npaths, cappaths;
+    int live;         // workers still running
+};
+
+static char *dsh_walk_join(const char *dir, const char *name, size_t name_len) {
+    size_t dir_len = strlen(dir);
+    int slash = name_len > 0 && dir_len > 0 && dir[dir_len - 1] != '/';
+    char *path = dsh_xrealloc(NULL, dir_len + slash + name_len + 1);
+
+    memcpy(path, dir, dir_len);
+    if (slash) {
+        path[dir_len] = '/';
+    }
+    memcpy(path + dir_len + slash, name, name_len);
+    path[dir_len + slash + name_len] = '\0';
+    return path;
+}
+
+static void dsh_walk_error(struct dsh_walk *walk, const char *path) {
+    char buf[128];
+
+    atomic_store(&walk->failed, 1);
+    fprintf(stderr, "dsh: walk: %s: %s\n", path, strerror_r(errno, buf, sizeof(buf)));
+}
+
+static void dsh_walk_push(struct dsh_walk_worker *worker, char *path, int depth) {
+    struct dsh_walk_deque *deque = &worker->deque;
+
+    atomic_fetch_add(&worker->walk->pending, 1);
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->cap) {
+        if (deque->head > 0) {
+            memmove(deque->items, deque->items + deque->head, (deque->tail - deque->head) * sizeof(*deque->items));
+            deque->tail -= deque->head;
+            deque->head = 0;
+        } else {
+            deque->cap = deque->cap ? deque->cap * 2 : 64;
+            deque->items = dsh_xrealloc(deque->items, deque->cap * sizeof(*deque->items));
+        }
+    }
+    deque->items[deque->tail].path = path;
+    deque->items[deque->tail].depth = depth;
+    deque->tail++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// From the back of our own deque, or the front of someone else's
+static int dsh_walk_take(struct dsh_walk_worker *worker, struct dsh_walk_dir *dir) {
+    struct dsh_walk *walk = worker->walk;
+    int it, found = 0;
+
+    pthread_mutex_lock(&worker->deque.lock);
+    if (worker->deque.tail > worker->deque.head) {
+        *dir = worker->deque.items[--worker->deque.tail];
+        found = 1;
+    }
+    pthread_mutex_unlock(&worker->deque.lock);
+
+    worker->seed = worker->seed * 1103515245 + 12345;
+    for (it = 0; !found && it < walk->nworkers; it++) {
+        struct dsh_walk_deque *victim = &walk->workers[(worker->seed + it) % walk->nworkers].deque;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head) {
+            *dir = victim->items[victim->head++];
+            found = 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+    return found;
+}
+
+static void dsh_walk_flush(struct dsh_walk_worker *worker) {
+    if (worker->out_len > 0) {
+        pthread_mutex_lock(&worker->walk->out_lock);
+        dsh_io_write_all(STDOUT_FILENO, worker->out, worker->out_len);
+        pthread_mutex_unlock(&worker->walk->out_lock);
+        worker->out_len = 0;
+    }
+}
+
+static void dsh_walk_emit(struct dsh_walk_worker *worker, const char *path) {
+    struct dsh_walk *walk = worker->walk;
+    size_t len = strlen(path);
+
+    if (walk->cmd) {
+        // Handed to the main thread, which runs the command
+        pthread_mutex_lock(&walk->out_lock);
+        if (walk->npaths == walk->cappaths) {
+            walk->cappaths = walk->cappaths ? walk->cappaths * 2 : 64;
+            walk->paths = dsh_xrealloc(walk->paths, walk->cappaths * sizeof(char *));
+        }
+        walk->paths[walk->npaths++] = dsh_walk_join(path, "", 0);
+        pthread_cond_signal(&walk->out_ready);
+        pthread_mutex_unlock(&walk->out_lock);
+        return;
+    }
+    if (worker->out_len + len + 1 > DSH_WALK_OUT) {
+        dsh_walk_flush(worker);
+    }
+    if (len + 1 > DSH_WALK_OUT) {
+        pthread_mutex_lock(&walk->out_lock);
+        dsh_io_write_all(STDOUT_FILENO, path, len);
+        dsh_io_write_all(STDOUT_FILENO, &walk->end, 1);
+        pthread_mutex_unlock(&walk->out_lock);
+        return;
+    }
+    memcpy(worker->out + worker->out_len, path, len);
+    worker->out[worker->out_len + len] = walk->end;
+    worker->out_len += len + 1;
+}
+
+static char dsh_walk_type(mode_t mode) {
+    return S_ISDIR(mode) ? 'd' : S_ISREG(mode) ? 'f' : S_ISLNK(mode) ? 'l' : '?';
+}
+
+// The predicates; st is only looked at for -mtime
+static int dsh_walk_match(struct dsh_walk *walk, const char *name, char type, const struct stat *st) {
+    if (walk->type && walk->type != type) {
+        return 0;
+    }
+    if (walk->name && fnmatch(walk->name, name, 0) != 0) {
+        return 0;
+    }
+    if (walk->mtime_cmp) {
+        long days = (walk->now - st->st_mtime) / 86400;
+        if ((walk->mtime_cmp == '+' && days <= walk->mtime_days) ||
+            (walk->mtime_cmp == '-' && days >= walk->mtime_days) ||
+            (walk->mtime_cmp == '=' && days != walk->mtime_days)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void dsh_walk_read(struct dsh_walk_worker *worker, struct dsh_walk_dir *dir) {
+    struct dsh_walk *walk = worker->walk;
+    int descend = walk->maxdepth < 0 || dir->depth + 1 < walk->maxdepth;
+    int fd = openat(AT_FDCWD, dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    ssize_t n;
+
+    if (fd < 0) {
+        dsh_walk_error(worker->walk, dir->path);
+        return;
+    }
+    while ((n = getdents64(fd, worker->dents, DSH_WALK_DENTS)) > 0) {
+        ssize_t pos = 0;
+
+        while (pos < n) {
+            struct dirent64 *dent = (struct dirent64 *) (worker->dents + pos);
+            const char *name = dent->d_name;
+            struct stat st;
+            char type;
+            int match;
+
+            pos += dent->d_reclen;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            type = dent->d_type == DT_DIR ? 'd' : dent->d_type == DT_REG ? 'f' : dent->d_type == DT_LNK ? 'l' : '?';
+            if (dent->d_type == DT_UNKNOWN || walk->mtime_cmp) {
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;  // gone since getdents64()
+                }
+                type = dsh_walk_type(st.st_mode);
+            }
+
+            match = dsh_walk_match(walk, name, type, &st);
+            if (match || (type == 'd' && descend)) {
+                char *path = dsh_walk_join(dir->path, name, strlen(name));
+
+                if (match) {
+                    dsh_walk_emit(worker, path);
+                }
+                if (type == 'd' && descend) {
+                    dsh_walk_push(worker, path, dir->depth + 1);
+                } else {
+                    free(path);
+                }
+            }
+        }
+    }
+    if (n < 0) {
+        dsh_walk_error(worker->walk, dir->path);
+    }
+    close(fd);
+}
+
+static void *dsh_walk_worker(void *arg) {
+    struct dsh_walk_worker *worker = arg;
+    struct dsh_walk *walk = worker->walk;
+    struct dsh_walk_dir dir;
+    int idle = 0;
+
+    for (;;) {
+        if (dsh_walk_take(worker, &dir)) {
+            dsh_walk_read(worker, &dir);
+            free(dir.path);
+            atomic_fetch_sub(&walk->pending, 1);
+            idle = 0;
+        } else if (atomic_load(&walk->pending) == 0) {
+            break;  // nothing queued and nobody reading: nothing more will come
+        } else if (++idle < 64) {
+            sched_yield();
+        } else {
+            struct timespec nap = { 0, 50000 };
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    dsh_walk_flush(worker);
+    pthread_mutex_lock(&walk->out_lock);
+    walk->live--;
+    pthread_cond_signal(&walk->out_ready);
+    pthread_mutex_unlock(&walk->out_lock);
+    return NULL;
+}
+
+/*
+ * The main thread's side of `-- CMD`: takes paths as the workers find
+ * them and runs CMD ARG... PATH for each, up to jobs at once. Builtins
+ * run here, one after the other.
+ */
+static void dsh_walk_run(struct dsh_walk *walk, long jobs) {
+    size_t cmd_len = 0;
+    long running = 0;
+    char **args;
+
+    while (walk->cmd[cmd_len] != NULL) {
+        cmd_len++;
+    }
+    args = dsh_xrealloc(NULL, (cmd_len + 2) * sizeof(char *));
+    memcpy(args, walk->cmd, cmd_len * sizeof(char *));
+    args[cmd_len + 1] = NULL;
+
+    pthread_mutex_lock(&walk->out_lock);
+    for (;;) {
+        char **paths;
+        size_t npaths, it;
+
+        while (walk->npaths == 0 && walk->live > 0) {
+            pthread_cond_wait(&walk->out_ready, &walk->out_lock);
+        }
+        if (walk->npaths == 0) {
+            break;
+        }
+        paths = walk->paths;
+        npaths = walk->npaths;
+        walk->paths = NULL;
+        walk->npaths = walk->cappaths = 0;
+        pthread_mutex_unlock(&walk->out_lock);
+
+        for (it = 0; it < npaths; it++) {
+            args[cmd_len] = paths[it];
+            if (dsh_is_builtin(args[0])) {
+                dsh_dispatch(args);
+            } else {
+                while (running >= jobs && waitpid(-1, NULL, 0) > 0) {
+                    running--;
+                }
+                if (dsh_spawn(args) > 0) {
+                    running++;
+                }
+            }
+            free(paths[it]);
+        }
+        free(paths);
+        pthread_mutex_lock(&walk->out_lock);
+    }
+    pthread_mutex_unlock(&walk->out_lock);
+
+    while (running > 0 && waitpid(-1, NULL, 0) > 0) {
+        running--;
+    }
+    free(args);
+}
+
+static int dsh_walk_usage(void) {
+    fprintf(stderr, "usage: walk [-0] [-j N] [DIR...] [-name GLOB] [-type f|d|l] [-mtime [+-]DAYS] "
+                    "[-maxdepth N] [-- CMD [ARG...]]\n");
+    dsh_status = 1;
+    return 1;
+}
+
+int dsh_walk(char **args) {
+    char *dot[] = { ".", NULL };
+    struct dsh_walk walk;
+    char **roots;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int argi = 1, nroots = 0, it;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.maxdepth = -1;
+    walk.end = '\n';
+    walk.now = time(NULL);
+
+    for (; args[argi] != NULL; argi++) {
+        if (strcmp(args[argi], "-0") == 0) {
+            walk.end = '\0';
+        } else if (strcmp(args[argi], "-j") == 0 && args[argi + 1] != NULL) {
+            char *end;
+            jobs = strtol(args[++argi], &end, 10);
+            if (*end != '\0' || jobs < 1) {
+                fprintf(stderr, "dsh: walk: -j expects a positive number\n");
+                dsh_status = 1;
+                return 1;
+            }
+        } else {
+            break;
+        }
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+
+    roots = args + argi;
+    while (args[argi] != NULL && (args[argi][0] != '-' || args[argi][1] == '\0')) {
+        argi++;
+        nroots++;
+    }
+
+    for (; args[argi] != NULL; argi++) {
+        const char *opt = args[argi], *value = args[argi + 1];
+        char *end;
+
+        if (strcmp(opt, "--") == 0) {
+            if (args[argi + 1] == NULL) {
+                return dsh_walk_usage();
+            }
+            walk.cmd = args + argi + 1;
+            break;
+        }
+        if (value == NULL) {
+            return dsh_walk_usage();
+        }
+        argi++;
+        if (strcmp(opt, "-name") == 0) {
+            walk.name = value;
+        } else if (strcmp(opt, "-type") == 0 && value[0] && !value[1] && strchr("fdl", value[0])) {
+            walk.type = value[0];
+        } else if (strcmp(opt, "-mtime") == 0) {
+            walk.mtime_cmp = value[0] == '+' || value[0] == '-' ? value[0] : '=';
+            walk.mtime_days = strtol(value + (walk.mtime_cmp != '='), &end, 10);
+            if (*end != '\0' || walk.mtime_days < 0) {
+                return dsh_walk_usage();
+            }
+        } else if (strcmp(opt, "-maxdepth") == 0) {
+            walk.maxdepth = strtol(value, &end, 10);
+            if (*end != '\0' || walk.maxdepth < 0) {
+                return dsh_walk_usage();
+            }
+        } else {
+            return dsh_walk_usage();
+        }
+    }
+    if (nroots == 0) {
+        roots = dot;
+        nroots = 1;
+    }
+
+    walk.nworkers = jobs;
+    walk.workers = dsh_xcalloc(walk.nworkers, sizeof(*walk.workers));
+    pthread_mutex_init(&walk.out_lock, NULL);
+    pthread_cond_init(&walk.out_ready, NULL);
+    for (it = 0; it < walk.nworkers; it++) {
+        struct dsh_walk_worker *worker = &walk.workers[it];
+        worker->walk = &walk;
+        worker->seed = it;
+        worker->dents = dsh_xrealloc(NULL, DSH_WALK_DENTS);
+        worker->out = dsh_xrealloc(NULL, DSH_WALK_OUT);
+        pthread_mutex_init(&worker->deque.lock, NULL);
+    }
+
+    // The roots are tested like everything else, then go to worker 0
+    fflush(stdout);
+    for (it = 0; it < nroots; it++) {
+        const char *base = strrchr(roots[it], '/');
+        struct stat st;
+
+        if (fstatat(AT_FDCWD, roots[it], &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            dsh_walk_error(&walk, roots[it]);
+            continue;
+        }
+        base = base && base[1] ? base + 1 : roots[it];
+        if (dsh_walk_match(&walk, base, dsh_walk_type(st.st_mode), &st)) {
+            dsh_walk_emit(&walk.workers[0], roots[it]);
+        }
+        if (S_ISDIR(st.st_mode) && walk.maxdepth != 0) {
+            dsh_walk_push(&walk.workers[0], dsh_walk_join(roots[it], "", 0), 0);
+        }
+    }
+
+    walk.live = walk.nworkers;
+    for (it = 0; it < walk.nworkers; it++) {
+        if (pthread_create(&walk.workers[it].thread, NULL, dsh_walk_worker, &walk.workers[it]) != 0) {
+            fprintf(stderr, "dsh: walk: could not start a thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (walk.cmd) {
+        dsh_walk_run(&walk, jobs);
+    }
+    for (it = 0; it < walk.nworkers; it++) {
+        pthread_join(walk.workers[it].thread, NULL);
+    }
+    if (atomic_load(&walk.failed)) {
+        dsh_status = 1;
+    }
+
+    for (it = 0; it < walk.nworkers; it++) {
+        free(walk.workers[it].dents);
+        free(walk.workers[it].out);
+        free(walk.workers[it].deque.items);
+        pthread_mutex_destroy(&walk.workers[it].deque.lock);
+    }
+    free(walk.workers);
+    pthread_mutex_destroy(&walk.out_lock);
+    pthread_cond_destroy(&walk.out_ready);
+    return 1;
+}
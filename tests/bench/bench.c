@@ -0,0 +1,590 @@
+#include <sys/types.h>  // for pid_t
+#include <sys/stat.h>   // for mkdir()
+#include <sys/wait.h>   // for waitpid(), WIFEXITED, WEXITSTATUS
+#include <fcntl.h>      // for open()
+#include <pthread.h>    // for pthread_create(), pthread_join()
+#include <time.h>       // for clock_gettime(), CLOCK_MONOTONIC
+#include <unistd.h>     // for fork(), execvp(), dup2(), lseek()
+#include <stdlib.h>     // for malloc(), free(), exit(), mkdtemp(), system()
+#include <stdio.h>      // for printf(), fopen()
+#include <string.h>     // for memcpy(), strcmp(), strrchr()
+
+#include "../../src/dsh.h"
+
+/*
+ * dsh_bench: performance numbers for the shell's hot paths.
+ *
+ *     dsh_bench [-q] DSH [OTHER_SHELL...]
+ *
+ * Micro benchmarks call dsh_read_line(), dsh_split_line() and
+ * dsh_execute() directly (this program is linked against the shell
+ * sources built with -DDSH_NO_MAIN); memo_replay, the text builtins
+ * (wc, head, tail, grep) and walk are the I/O-heavy ones. Macro
+ * benchmarks run DSH, and every OTHER_SHELL that can be found, on the
+ * same generated scripts:
+ * one running many /bin/true commands (spawn cost per command; the
+ * full path keeps shells that have `true` as a builtin honest) and one
+ * that exits straight away (time to first prompt).
+ *
+ * Each micro benchmark runs in DSH_BENCH_ROUNDS rounds and reports the
+ * fastest; a round can only be slowed down by the rest of the machine,
+ * so the minimum is the steadiest number to compare over time.
+ *
+ * Every result is one tab-separated line, lower is always better:
+ *
+ *     <name>\t<value>\t<unit>
+ *
+ * -q divides every iteration count by ten, for a quick smoke run.
+ */
+
+#define DSH_BENCH_SCRIPT "/tmp/dsh_bench_script"
+#define DSH_BENCH_ROUNDS 5
+
+static int dsh_bench_scale = 1;
+
+static double dsh_bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void dsh_bench_report(const char *name, double value, const char *unit) {
+    printf("%s\t%.3f\t%s\n", name, value, unit);
+    fflush(stdout);
+}
+
+static void dsh_bench_write_script(const char *path, const char *line, int count) {
+    FILE *fp = fopen(path, "w");
+    int it;
+
+    if (!fp) {
+        perror("dsh_bench");
+        exit(EXIT_FAILURE);
+    }
+    for (it = 0; it < count; it++) {
+        fputs(line, fp);
+    }
+    fputs("exit\n", fp);
+    fclose(fp);
+}
+
+/*
+ * dsh_read_line() reads dsh_input, so it is pointed at a file of
+ * identical lines, rewound every round, and the lines are read back
+ * one by one. The shell reads a script file the same way, so with
+ * IO_URING=1 this also covers the read-ahead.
+ */
+static void dsh_bench_read_line(const char *name, const char *line, int count) {
+    double start, elapsed, best = 0;
+    int it, round, fd;
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    dsh_bench_write_script(DSH_BENCH_SCRIPT, line, count);
+    fd = open(DSH_BENCH_SCRIPT, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("dsh_bench");
+        exit(EXIT_FAILURE);
+    }
+
+    for (round = 0; round < DSH_BENCH_ROUNDS; round++) {
+        lseek(fd, 0, SEEK_SET);
+        dsh_io_open(&dsh_input, fd);
+        start = dsh_bench_now();
+        for (it = 0; it < count; it++) {
+            free(dsh_read_line());
+        }
+        elapsed = dsh_bench_now() - start;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    dsh_io_close(&dsh_input);
+    close(fd);
+    dsh_bench_report(name, best / count, "ns/op");
+}
+
+/*
+ * Times a builtin with its stdout sent to /dev/null, in rounds like the
+ * rest. Returns the fastest round's time per call in nanoseconds.
+ */
+static double dsh_bench_builtin(char **args, int count) {
+    double start, elapsed, best = 0;
+    int saved, devnull, it, round;
+
+    fflush(stdout);
+    saved = dup(STDOUT_FILENO);
+    devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+
+    for (round = 0; round < DSH_BENCH_ROUNDS; round++) {
+        start = dsh_bench_now();
+        for (it = 0; it < count; it++) {
+            dsh_execute(args);
+        }
+        elapsed = dsh_bench_now() - start;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    close(devnull);
+    return best / count;
+}
+
+/*
+ * `memo` hits on an entry of size bytes, replayed to /dev/null: the
+ * shell reading a file and writing it out again, with nothing forked.
+ */
+static void dsh_bench_memo_replay(const char *name, int size, int count) {
+    char dir[] = "/tmp/dsh_bench_memo.XXXXXX";
+    char bytes[32], cmd[64];
+    char *args[] = { "memo", "head", "-c", bytes, "/dev/zero", NULL };
+    double per_op;
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    if (count < 1) {
+        count = 1;
+    }
+    if (!mkdtemp(dir)) {
+        perror("dsh_bench");
+        exit(EXIT_FAILURE);
+    }
+    setenv("DSH_MEMO_DIR", dir, 1);
+    snprintf(bytes, sizeof(bytes), "%d", size);
+
+    dsh_bench_builtin(args, 1);  // the miss that fills the entry
+    per_op = dsh_bench_builtin(args, count);
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "dsh_bench: could not remove %s\n", dir);
+    }
+    dsh_bench_report(name, per_op / 1e3, "us/op");
+}
+
+/*
+ * The text builtins on a file of lines numbered 1..lines: `wc -l` reads
+ * all of it, `head` and `tail` only its ends, so they show the fixed
+ * cost of a builtin against the fork+exec it replaces. The two greps
+ * read all of it too, one through memmem() and one through the DFA,
+ * and so does the pipeline, which runs as one chain of streams.
+ */
+static void dsh_bench_text(int lines, int count) {
+    char *wc[] = { "wc", "-l", DSH_BENCH_SCRIPT, NULL };
+    char *head[] = { "head", "-n", "10", DSH_BENCH_SCRIPT, NULL };
+    char *tail[] = { "tail", "-n", "10", DSH_BENCH_SCRIPT, NULL };
+    char *grep_literal[] = { "grep", "-c", "99999", DSH_BENCH_SCRIPT, NULL };
+    char *grep_regex[] = { "grep", "-c", "-E", "^[1-3]+7?$", DSH_BENCH_SCRIPT, NULL };
+    char *pipeline[] = { "cat", DSH_BENCH_SCRIPT, "|", "grep", "99", "|", "wc", "-l", NULL };
+    FILE *fp = fopen(DSH_BENCH_SCRIPT, "w");
+    int it;
+
+    if (!fp) {
+        perror("dsh_bench");
+        exit(EXIT_FAILURE);
+    }
+    for (it = 1; it <= lines; it++) {
+        fprintf(fp, "%d\n", it);
+    }
+    fclose(fp);
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    dsh_bench_report("micro.wc_l_1m", dsh_bench_builtin(wc, count) / 1e3, "us/op");
+    dsh_bench_report("micro.head_10", dsh_bench_builtin(head, count) / 1e3, "us/op");
+    dsh_bench_report("micro.tail_10", dsh_bench_builtin(tail, count) / 1e3, "us/op");
+    dsh_bench_report("micro.grep_literal_1m", dsh_bench_builtin(grep_literal, count) / 1e3, "us/op");
+    dsh_bench_report("micro.grep_regex_1m", dsh_bench_builtin(grep_regex, count) / 1e3, "us/op");
+    dsh_bench_report("micro.pipeline_fused_1m", dsh_bench_builtin(pipeline, count) / 1e3, "us/op");
+}
+
+/*
+ * sort on lines of a pseudo-random number each, in memory and with a
+ * 1M cap that spills runs to disk and merges them back.
+ */
+static void dsh_bench_sort(int lines, int count) {
+    char *sort[] = { "sort", DSH_BENCH_SCRIPT, NULL };
+    char *spill[] = { "sort", "-S", "1M", DSH_BENCH_SCRIPT, NULL };
+    FILE *fp = fopen(DSH_BENCH_SCRIPT, "w");
+    unsigned long state = 1;
+    int it;
+
+    if (!fp) {
+        perror("dsh_bench");
+        exit(EXIT_FAILURE);
+    }
+    for (it = 0; it < lines; it++) {
+        state = state * 6364136223846793005UL + 1442695040888963407UL;
+        fprintf(fp, "%lu\n", state >> 20);
+    }
+    fclose(fp);
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    if (count < 1) {
+        count = 1;
+    }
+    dsh_bench_report("micro.sort_200k", dsh_bench_builtin(sort, count) / 1e3, "us/op");
+    dsh_bench_report("micro.sort_spill_200k", dsh_bench_builtin(spill, count) / 1e3, "us/op");
+}
+
+static int dsh_bench_sink_write(struct dsh_stream *stream, const char *buf, size_t len) {
+    return 0;
+}
+
+static struct dsh_stream dsh_bench_sink = { dsh_bench_sink_write, NULL, NULL };
+
+static void *dsh_bench_pipe_reader(void *arg) {
+    static char buf[65536];
+    int fd = *(int *) arg;
+
+    while (read(fd, buf, sizeof(buf)) > 0) {
+        ;
+    }
+    return NULL;
+}
+
+/*
+ * megabytes in 64 KB writes to a reader thread, through a ring
+ * (ring.c) and through a pipe: what a threaded pipeline stage saves
+ * over the kernel's way of doing the same.
+ */
+static void dsh_bench_ring(int megabytes, int count) {
+    static char block[65536];
+    double start, ring_best = 0, pipe_best = 0, elapsed;
+    int round, it, n;
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    if (count < 1) {
+        count = 1;
+    }
+    for (round = 0; round < DSH_BENCH_ROUNDS; round++) {
+        start = dsh_bench_now();
+        for (it = 0; it < count; it++) {
+            struct dsh_stream *ring = dsh_ring_stream(&dsh_bench_sink);
+            for (n = 0; n < megabytes * 16; n++) {
+                ring->write(ring, block, sizeof(block));
+            }
+            ring->close(ring);
+        }
+        elapsed = dsh_bench_now() - start;
+        if (round == 0 || elapsed < ring_best) {
+            ring_best = elapsed;
+        }
+
+        start = dsh_bench_now();
+        for (it = 0; it < count; it++) {
+            pthread_t reader;
+            int fds[2];
+
+            if (pipe(fds) != 0 || pthread_create(&reader, NULL, dsh_bench_pipe_reader, &fds[0]) != 0) {
+                perror("dsh_bench");
+                exit(EXIT_FAILURE);
+            }
+            for (n = 0; n < megabytes * 16; n++) {
+                dsh_io_write_all(fds[1], block, sizeof(block));
+            }
+            close(fds[1]);
+            pthread_join(reader, NULL);
+            close(fds[0]);
+        }
+        elapsed = dsh_bench_now() - start;
+        if (round == 0 || elapsed < pipe_best) {
+            pipe_best = elapsed;
+        }
+    }
+    dsh_bench_report("micro.ring_256m", ring_best / count / 1e3, "us/op");
+    // Only a yardstick for the ring: no shell code runs, so it is not gated
+    dsh_bench_report("ref.pipe_256m", pipe_best / count / 1e3, "us/op");
+}
+
+/*
+ * walk over a tree of fanout^3 directories with files in each
+ * (10 and 20: 1110 directories, 20000 files), with no predicate
+ * but -type f, so every entry is looked at and most are printed.
+ */
+static void dsh_bench_walk(const char *name, int fanout, int files, int count) {
+    char dir[] = "/tmp/dsh_bench_walk.XXXXXX";
+    char path[256], cmd[64];
+    char *args[] = { "walk", dir, "-type", "f", NULL };
+    int a, b, c, f;
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    if (count < 1) {
+        count = 1;
+    }
+    if (!mkdtemp(dir)) {
+        perror("dsh_bench");
+        exit(EXIT_FAILURE);
+    }
+    for (a = 0; a < fanout; a++) {
+        for (b = 0; b < fanout; b++) {
+            for (c = 0; c < fanout; c++) {
+                snprintf(path, sizeof(path), "%s/%d", dir, a);
+                mkdir(path, 0755);
+                snprintf(path, sizeof(path), "%s/%d/%d", dir, a, b);
+                mkdir(path, 0755);
+                snprintf(path, sizeof(path), "%s/%d/%d/%d", dir, a, b, c);
+                mkdir(path, 0755);
+                for (f = 0; f < files; f++) {
+                    int fd;
+                    snprintf(path, sizeof(path), "%s/%d/%d/%d/file%d", dir, a, b, c, f);
+                    fd = open(path, O_WRONLY | O_CREAT, 0644);
+                    if (fd >= 0) {
+                        close(fd);
+                    }
+                }
+            }
+        }
+    }
+
+    dsh_bench_builtin(args, 1);  // warm the dentry cache
+    dsh_bench_report(name, dsh_bench_builtin(args, count) / 1e3, "us/op");
+
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    if (system(cmd) != 0) {
+        fprintf(stderr, "dsh_bench: could not remove %s\n", dir);
+    }
+}
+
+// The tokenizer writes into the line, so every round starts from a fresh copy
+static void dsh_bench_split_line(const char *name, const char *line, int count) {
+    size_t len = strlen(line) + 1;
+    char *copy = malloc(len);
+    double start, elapsed, best = 0;
+    int it, round;
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    for (round = 0; round < DSH_BENCH_ROUNDS; round++) {
+        start = dsh_bench_now();
+        for (it = 0; it < count; it++) {
+            memcpy(copy, line, len);
+            free(dsh_split_line(copy));
+        }
+        elapsed = dsh_bench_now() - start;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    free(copy);
+    dsh_bench_report(name, best / count, "ns/op");
+}
+
+/*
+ * Expands a command with four words to fill in (a shell variable, from
+ * the environment, twice in one word) and two to leave alone, the way
+ * dsh_execute does: mark the arena, expand, release.
+ */
+static void dsh_bench_expand(int count) {
+    char line[] = "echo $HOME/bin ${x}y a$x$x plain --opt=$x";
+    char **words = dsh_split_line(line);
+    struct dsh_expand_mark mark;
+    double start, elapsed, best = 0;
+    volatile char sink = 0;
+    int it, round;
+
+    dsh_var_set("x", "value");
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    for (round = 0; round < DSH_BENCH_ROUNDS; round++) {
+        start = dsh_bench_now();
+        for (it = 0; it < count; it++) {
+            dsh_expand_mark(&mark);
+            sink += dsh_expand(words)[1][0];
+            dsh_expand_release(&mark);
+        }
+        elapsed = dsh_bench_now() - start;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    free(words);
+    dsh_var_set("x", NULL);
+    dsh_bench_report("micro.expand_words", best / count, "ns/op");
+}
+
+/*
+ * "exit" only returns 0 and "unset" with no names does nothing, so this
+ * times the builtin lookup itself; "unset" is near the end of the table.
+ */
+static void dsh_bench_dispatch(const char *name, char *builtin, int count) {
+    char *args[] = { builtin, NULL };
+    double start, elapsed, best = 0;
+    volatile int sink = 0;
+    int it, round;
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    for (round = 0; round < DSH_BENCH_ROUNDS; round++) {
+        start = dsh_bench_now();
+        for (it = 0; it < count; it++) {
+            sink += dsh_execute(args);
+        }
+        elapsed = dsh_bench_now() - start;
+        if (round == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    dsh_bench_report(name, best / count, "ns/op");
+}
+
+/*
+ * A function that calls itself depth deep, every level with a local, a
+ * read of a global and an assignment: frames, saves and lookups in
+ * vars.c, with nothing forked. Each level passes the rest of the words
+ * on with $@, and the last one finds none left.
+ */
+static void dsh_bench_func(int depth, int count) {
+    char define[] = "down ( ) { local n=$1 ; shift ; seen=$top$n ; $@ ; }";
+    char **args = dsh_split_line(define);
+    char *line = malloc(depth * 16 + 1);
+    size_t len = 0;
+    int it;
+
+    dsh_execute(args);
+    free(args);
+    dsh_var_set("top", "x");
+    for (it = 0; it < depth; it++) {
+        len += sprintf(line + len, "down %d ", it);
+    }
+    args = dsh_split_line(line);
+
+    count /= dsh_bench_scale * DSH_BENCH_ROUNDS;
+    if (count < 1) {
+        count = 1;
+    }
+    dsh_bench_report("micro.func_depth_1000", dsh_bench_builtin(args, count) / 1e3, "us/op");
+    free(args);
+    free(line);
+}
+
+/*
+ * Runs `shell < script` with its output thrown away.
+ * Returns the wall time in nanoseconds, or -1 if the shell is missing.
+ */
+static double dsh_bench_run_shell(const char *shell, const char *script) {
+    double start = dsh_bench_now();
+    pid_t pid = fork();
+    int status;
+
+    if (pid == 0) {
+        char *args[] = { (char *) shell, NULL };
+        int in = open(script, O_RDONLY);
+        int out = open("/dev/null", O_WRONLY);
+
+        dup2(in, STDIN_FILENO);
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        execvp(shell, args);
+        exit(127);
+    } else if (pid < 0) {
+        perror("dsh_bench");
+        exit(EXIT_FAILURE);
+    }
+
+    waitpid(pid, &status, 0);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        return -1;
+    }
+    return dsh_bench_now() - start;
+}
+
+// The report name uses the shell's basename: macro.spawn.dsh, macro.spawn.bash, ...
+static const char *dsh_bench_shell_name(const char *shell) {
+    const char *slash = strrchr(shell, '/');
+    return slash ? slash + 1 : shell;
+}
+
+static void dsh_bench_spawn(const char *shell, int count) {
+    char name[256];
+    double elapsed;
+
+    count /= dsh_bench_scale;
+    dsh_bench_write_script(DSH_BENCH_SCRIPT, "/bin/true\n", count);
+    elapsed = dsh_bench_run_shell(shell, DSH_BENCH_SCRIPT);
+    if (elapsed < 0) {
+        return;
+    }
+    snprintf(name, sizeof(name), "macro.spawn.%s", dsh_bench_shell_name(shell));
+    dsh_bench_report(name, elapsed / count / 1e3, "us/cmd");
+}
+
+// A subshell that changes directory: a fork() in other shells, not in dsh
+static void dsh_bench_subshell(const char *shell, int count) {
+    char name[256];
+    double elapsed;
+
+    count /= dsh_bench_scale;
+    dsh_bench_write_script(DSH_BENCH_SCRIPT, "(cd /tmp; cd /)\n", count);
+    elapsed = dsh_bench_run_shell(shell, DSH_BENCH_SCRIPT);
+    if (elapsed < 0) {
+        return;
+    }
+    snprintf(name, sizeof(name), "macro.subshell.%s", dsh_bench_shell_name(shell));
+    dsh_bench_report(name, elapsed / count / 1e3, "us/cmd");
+}
+
+static void dsh_bench_startup(const char *shell, int count) {
+    char name[256];
+    double elapsed, total = 0;
+    int it;
+
+    count /= dsh_bench_scale;
+    dsh_bench_write_script(DSH_BENCH_SCRIPT, "", 0);
+    for (it = 0; it < count; it++) {
+        elapsed = dsh_bench_run_shell(shell, DSH_BENCH_SCRIPT);
+        if (elapsed < 0) {
+            return;
+        }
+        total += elapsed;
+    }
+    snprintf(name, sizeof(name), "macro.startup.%s", dsh_bench_shell_name(shell));
+    dsh_bench_report(name, total / count / 1e3, "us");
+}
+
+int main(int argc, char **argv) {
+    static char long_line[16384];
+    int argi = 1;
+    int it;
+
+    if (argi < argc && strcmp(argv[argi], "-q") == 0) {
+        dsh_bench_scale = 10;
+        argi++;
+    }
+    if (argi >= argc) {
+        fprintf(stderr, "usage: dsh_bench [-q] DSH [OTHER_SHELL...]\n");
+        return EXIT_FAILURE;
+    }
+
+    // A thousand short words: the tokenizer's growth path
+    for (it = 0; it < 1000; it++) {
+        memcpy(long_line + it * 4, "ab  ", 4);
+    }
+    long_line[4000] = '\n';
+
+    dsh_bench_read_line("micro.read_line_short", "ls -l --color=auto /usr/local/bin\n", 200000);
+    dsh_bench_read_line("micro.read_line_4k", long_line, 20000);
+    long_line[4000] = '\0';
+    dsh_bench_split_line("micro.split_line_short", "ls -l --color=auto /usr/local/bin /tmp", 1000000);
+    dsh_bench_split_line("micro.split_line_1000", long_line, 20000);
+    dsh_bench_expand(2000000);
+    dsh_bench_dispatch("micro.dispatch_builtin", "exit", 10000000);
+    dsh_bench_dispatch("micro.dispatch_unset", "unset", 10000000);
+    dsh_bench_func(1000, 500);
+    dsh_bench_memo_replay("micro.memo_replay_4m", 4 << 20, 500);
+    dsh_bench_text(1000000, 500);
+    dsh_bench_sort(200000, 50);
+    dsh_bench_ring(256, 50);
+    dsh_bench_walk("micro.walk_20k", 10, 20, 100);
+
+    for (it = argi; it < argc; it++) {
+        dsh_bench_spawn(argv[it], 2000);
+        dsh_bench_subshell(argv[it], 2000);
+        dsh_bench_startup(argv[it], 200);
+    }
+
+    unlink(DSH_BENCH_SCRIPT);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,134 @@
+#!/bin/sh
+#
+# check.sh: compare the shell's benchmarks against a stored baseline.
+#
+#     check.sh [--update] BENCH DSH [BASELINE]
+#
+# Runs `BENCH DSH` $BENCH_RUNS times (default 5) and, for every dsh
+# metric, takes the median and a distribution-free ~95% confidence
+# interval for it (order statistics around the median). A metric fails
+# when its median is more than its threshold above the baseline median
+# AND the whole interval sits above the baseline, so one noisy run is
+# not enough to fail the gate. A baseline metric with no result at all
+# fails too.
+#
+# The baseline (default: baseline.tsv next to this script) has one line
+# per metric:  name <TAB> median <TAB> unit <TAB> threshold
+# --update rewrites it from this run instead of comparing. New
+# thresholds come from $BENCH_THRESHOLD (micro benchmarks, default 0.15)
+# and $BENCH_MACRO_THRESHOLD (process-level ones, default 0.30).
+#
+# Only the dsh metrics are gated; the other shells, and ref.* rows that
+# run no shell code, are there to compare.
+
+set -u
+
+update=0
+if [ "${1:-}" = "--update" ]; then
+    update=1
+    shift
+fi
+if [ $# -lt 2 ]; then
+    echo "usage: check.sh [--update] BENCH DSH [BASELINE]" >&2
+    exit 2
+fi
+
+bench=$1
+dsh=$2
+baseline=${3:-$(dirname "$0")/baseline.tsv}
+runs=${BENCH_RUNS:-5}
+results=$(mktemp "${TMPDIR:-/tmp}/dsh_bench.XXXXXX") || exit 2
+trap 'rm -f "$results"' EXIT
+
+i=0
+while [ "$i" -lt "$runs" ]; do
+    i=$((i + 1))
+    echo "check.sh: run $i of $runs" >&2
+    "$bench" "$dsh" >> "$results" || exit 2
+done
+
+# name -> sorted samples -> median and interval, one line per metric
+summary=$(awk -F '\t' '
+    $1 ~ /^micro\./ || $1 ~ /\.dsh$/ {
+        n[$1]++
+        v[$1, n[$1]] = $2
+        unit[$1] = $3
+    }
+    END {
+        for (name in n) {
+            m = n[name]
+            # insertion sort; there are only a handful of runs
+            for (i = 2; i <= m; i++) {
+                x = v[name, i]
+                for (j = i - 1; j >= 1 && v[name, j] > x; j--) {
+                    v[name, j + 1] = v[name, j]
+                }
+                v[name, j + 1] = x
+            }
+            if (m % 2) {
+                med = v[name, (m + 1) / 2]
+            } else {
+                med = (v[name, m / 2] + v[name, m / 2 + 1]) / 2
+            }
+            k = int((m - 1.96 * sqrt(m)) / 2)
+            if (k < 1) {
+                k = 1
+            }
+            printf "%s\t%f\t%f\t%f\t%s\n", name, med, v[name, k], v[name, m + 1 - k], unit[name]
+        }
+    }' "$results" | sort)
+
+if [ "$update" -eq 1 ]; then
+    echo "$summary" | awk -F '\t' -v micro="${BENCH_THRESHOLD:-0.15}" -v macro="${BENCH_MACRO_THRESHOLD:-0.30}" '
+        { printf "%s\t%s\t%s\t%s\n", $1, $2, $5, ($1 ~ /^micro\./ ? micro : macro) }' > "$baseline"
+    echo "check.sh: wrote $baseline" >&2
+    exit 0
+fi
+
+if [ ! -f "$baseline" ]; then
+    echo "check.sh: no baseline at $baseline (run with --update first)" >&2
+    exit 2
+fi
+
+echo "$summary" | awk -F '\t' -v baseline="$baseline" '
+    BEGIN {
+        while ((getline line < baseline) > 0) {
+            split(line, f, "\t")
+            base[f[1]] = f[2]
+            limit[f[1]] = f[4]
+        }
+        printf "%-28s %12s %12s %25s %8s\n", "benchmark", "baseline", "median", "95% interval", "change"
+    }
+    {
+        name = $1; med = $2; lo = $3; hi = $4
+        seen[name] = 1
+        if (!(name in base)) {
+            printf "%-28s %12s %12.3f %12.3f..%-12.3f %8s  new\n", name, "-", med, lo, hi, "-"
+            next
+        }
+        change = base[name] > 0 ? (med - base[name]) / base[name] : 0
+        status = "ok"
+        if (change > limit[name] && lo > base[name]) {
+            status = "REGRESSED"
+            failed++
+        }
+        printf "%-28s %12.3f %12.3f %12.3f..%-12.3f %+7.1f%%  %s\n", name, base[name], med, lo, hi, change * 100, status
+    }
+    END {
+        # A benchmark that was renamed, removed or crashed is not a pass
+        for (name in base) {
+            if (!(name in seen)) {
+                printf "%-28s %12.3f %12s %25s %8s  MISSING\n", name, base[name], "-", "-", "-"
+                missing++
+            }
+        }
+        if (missing) {
+            printf "check.sh: %d baseline benchmark(s) produced no result\n", missing > "/dev/stderr"
+        }
+        if (failed) {
+            printf "check.sh: %d benchmark(s) regressed beyond their threshold\n", failed > "/dev/stderr"
+        }
+        if (failed || missing) {
+            exit 1
+        }
+    }'
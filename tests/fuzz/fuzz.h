@@ -0,0 +1,15 @@
+#ifndef DSH_FUZZ_H
+#define DSH_FUZZ_H
+
+#include <stddef.h>  // for size_t
+
+/*
+ * What a fuzz target gives fuzz_main.c: its name, for messages, and the
+ * check of one input. line is a NUL-terminated copy of the input that
+ * the target may write into, size its length; the check abort()s on
+ * anything the code under test promises not to do.
+ */
+extern const char *dsh_fuzz_name;
+void dsh_fuzz_one(char *line, size_t size);
+
+#endif
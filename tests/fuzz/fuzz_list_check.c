@@ -0,0 +1,59 @@
+#include <stdlib.h>  // for free(), abort()
+
+#include "../../src/dsh.h"
+#include "fuzz.h"
+
+/*
+ * Fuzz target for the list parser, dsh_list_check() in subshell.c: the
+ * check of ; | ( ) { } and `name ( )` that a whole line passes before
+ * any of it runs. The driver is fuzz_main.c, the corpus
+ * tests/fuzz/corpus/list_check.
+ */
+
+#define DSH_FUZZ_DEPTH 64  // must match DSH_LIST_DEPTH in subshell.c
+
+const char *dsh_fuzz_name = "fuzz_list_check";
+
+static int dsh_fuzz_is(const char *word, char op) {
+    return word[0] == op && word[1] == '\0';
+}
+
+/*
+ * What a line that passes promises to dsh_list_each(): every ( and {
+ * is closed by its own kind, no deeper than DSH_LIST_DEPTH, and no |
+ * is left hanging at the end or next to another one.
+ */
+void dsh_fuzz_one(char *line, size_t size) {
+    char **tokens = dsh_split_line(line);
+    char open[DSH_FUZZ_DEPTH];
+    int depth = 0, it, status;
+
+    (void) size;
+    status = dsh_list_check(tokens);
+    if (status != 0 && status != -1) {
+        abort();
+    }
+    if (status == 0) {
+        for (it = 0; tokens[it] != NULL; it++) {
+            const char *word = tokens[it];
+
+            if (dsh_fuzz_is(word, '(') || dsh_fuzz_is(word, '{')) {
+                if (depth == DSH_FUZZ_DEPTH) {
+                    abort();
+                }
+                open[depth++] = word[0];
+            } else if (dsh_fuzz_is(word, ')') || dsh_fuzz_is(word, '}')) {
+                if (depth == 0 || open[--depth] != (word[0] == ')' ? '(' : '{')) {
+                    abort();
+                }
+            } else if (dsh_fuzz_is(word, '|') &&
+                       (tokens[it + 1] == NULL || dsh_fuzz_is(tokens[it + 1], '|'))) {
+                abort();
+            }
+        }
+        if (depth != 0) {
+            abort();
+        }
+    }
+    free(tokens);
+}
@@ -0,0 +1,202 @@
+#include <stdint.h>  // for uint8_t
+#include <math.h>    // for log2(), exp2()
+#include <time.h>    // for clock_gettime(), CLOCK_MONOTONIC
+#include <fcntl.h>   // for open()
+#include <unistd.h>  // for dup(), dup2(), close()
+#include <stdlib.h>  // for malloc(), realloc(), free()
+#include <stdio.h>   // for fopen(), fread(), fdopen(), printf()
+#include <string.h>  // for memcpy(), strlen(), strcmp()
+
+#include "fuzz.h"
+
+/*
+ * The driver every fuzz target links with (fuzz_split_line.c,
+ * fuzz_list_check.c, ...).
+ *
+ * Built with -fsanitize=fuzzer (make fuzz) this is only the libFuzzer
+ * entry point. Built without it (make fuzz-check, or for AFL) the main()
+ * below runs inputs given as files, or stdin when there are none, so
+ * `afl-fuzz -i tests/fuzz/corpus/split_line -o out -- build/fuzz_split_line @@`
+ * works.
+ *
+ * With -t the driver also reports throughput for every input and checks
+ * how its time scales: each input is repeated to 1x, 2x, ... 16x a
+ * minimum size, and if doubling the input more than DSH_FUZZ_MAX_SLOPE
+ * times the time (a power-law fit over the runs) the input is flagged
+ * as superlinear and the driver exits non-zero.
+ */
+
+#define DSH_FUZZ_MIN_BYTES (64 * 1024)  // smallest input timed for scaling
+#define DSH_FUZZ_STEPS 5                // 1x, 2x, 4x, 8x, 16x
+#define DSH_FUZZ_MAX_SLOPE 1.3          // 1.0 is linear, 2.0 quadratic
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    // The shell works on C strings and writes into them
+    char *line = malloc(size + 1);
+
+    if (!line) {
+        return 0;
+    }
+    memcpy(line, data, size);
+    line[size] = '\0';
+    dsh_fuzz_one(line, size);
+    free(line);
+    return 0;
+}
+
+#ifndef DSH_FUZZ_LIBFUZZER
+
+static FILE *dsh_fuzz_report;  // the driver's own stderr
+
+static double dsh_fuzz_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *dsh_fuzz_read(FILE *fp, size_t *size) {
+    size_t cap = 4096, len = 0, n;
+    char *buf = malloc(cap);
+
+    while (buf && (n = fread(buf + len, 1, cap - len, fp)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+    }
+    if (!buf) {
+        fprintf(dsh_fuzz_report, "%s: allocation error\n", dsh_fuzz_name);
+        exit(EXIT_FAILURE);
+    }
+    *size = len;
+    return buf;
+}
+
+// Best of a few runs: the noise in timing is all on the slow side
+static double dsh_fuzz_time(const char *input, size_t size) {
+    char *copy = malloc(size + 1);
+    double best = 0;
+    int round;
+
+    for (round = 0; round < 3; round++) {
+        double start;
+
+        memcpy(copy, input, size);
+        copy[size] = '\0';
+        start = dsh_fuzz_now();
+        dsh_fuzz_one(copy, size);
+        start = dsh_fuzz_now() - start;
+        if (round == 0 || start < best) {
+            best = start;
+        }
+    }
+    free(copy);
+    return best;
+}
+
+/*
+ * Times the input repeated to growing sizes and fits log(time) against
+ * log(size); the slope is the exponent of the growth. Embedded NULs
+ * would cut the line short, so inputs are treated as C strings.
+ */
+static int dsh_fuzz_scaling(const char *name, const char *input) {
+    double xs[DSH_FUZZ_STEPS], ys[DSH_FUZZ_STEPS];
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, slope, mbps;
+    size_t len = strlen(input), reps, big, it;
+    char *buf;
+    int step;
+
+    if (len == 0) {
+        return 0;
+    }
+    reps = (DSH_FUZZ_MIN_BYTES + len - 1) / len;
+    buf = malloc(reps * len * (1 << (DSH_FUZZ_STEPS - 1)));
+    if (!buf) {
+        fprintf(dsh_fuzz_report, "%s: allocation error\n", dsh_fuzz_name);
+        exit(EXIT_FAILURE);
+    }
+
+    for (step = 0; step < DSH_FUZZ_STEPS; step++) {
+        big = reps << step;
+        for (it = 0; it < big; it++) {
+            memcpy(buf + it * len, input, len);
+        }
+        xs[step] = log2((double) (big * len));
+        ys[step] = log2(dsh_fuzz_time(buf, big * len) + 1e-9);
+    }
+    mbps = reps * len / 1e6 / exp2(ys[0]);
+    free(buf);
+
+    for (step = 0; step < DSH_FUZZ_STEPS; step++) {
+        sx += xs[step];
+        sy += ys[step];
+        sxx += xs[step] * xs[step];
+        sxy += xs[step] * ys[step];
+    }
+    slope = (DSH_FUZZ_STEPS * sxy - sx * sy) / (DSH_FUZZ_STEPS * sxx - sx * sx);
+
+    printf("%s\t%.1f\tMB/s\t%.2f\t%s\n", name, mbps, slope,
+           slope > DSH_FUZZ_MAX_SLOPE ? "SUPERLINEAR" : "ok");
+    return slope > DSH_FUZZ_MAX_SLOPE;
+}
+
+int main(int argc, char **argv) {
+    int timing = 0, flagged = 0;
+    int argi = 1;
+    size_t size;
+    char *data;
+
+    if (argi < argc && strcmp(argv[argi], "-t") == 0) {
+        timing = 1;
+        argi++;
+    }
+
+    /*
+     * The shell reports bad input on stderr, which is its job, not a
+     * finding: that goes to /dev/null, and the driver keeps a copy of
+     * the real stderr for itself.
+     */
+    dsh_fuzz_report = fdopen(dup(STDERR_FILENO), "w");
+    if (!dsh_fuzz_report) {
+        perror(dsh_fuzz_name);
+        return EXIT_FAILURE;
+    }
+    setvbuf(dsh_fuzz_report, NULL, _IONBF, 0);
+    dup2(open("/dev/null", O_WRONLY | O_CLOEXEC), STDERR_FILENO);
+
+    if (argi >= argc) {
+        data = dsh_fuzz_read(stdin, &size);
+        LLVMFuzzerTestOneInput((const uint8_t *) data, size);
+        free(data);
+        return 0;
+    }
+
+    for (; argi < argc; argi++) {
+        FILE *fp = fopen(argv[argi], "rb");
+
+        if (!fp) {
+            fprintf(dsh_fuzz_report, "%s: %s: cannot open\n", dsh_fuzz_name, argv[argi]);
+            return EXIT_FAILURE;
+        }
+        data = dsh_fuzz_read(fp, &size);
+        fclose(fp);
+
+        LLVMFuzzerTestOneInput((const uint8_t *) data, size);
+        if (timing) {
+            // NUL-terminate for the scaling runs; the buffer has room or grows
+            data = realloc(data, size + 1);
+            data[size] = '\0';
+            flagged += dsh_fuzz_scaling(argv[argi], data);
+        }
+        free(data);
+    }
+
+    if (flagged) {
+        fprintf(dsh_fuzz_report, "%s: %d input(s) take superlinear time\n", dsh_fuzz_name, flagged);
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,41 @@
+#include <stdlib.h>  // for free(), abort()
+#include <string.h>  // for strchr()
+
+#include "../../src/dsh.h"
+#include "fuzz.h"
+
+/*
+ * Fuzz target for the tokenizer, dsh_split_line(); the driver is
+ * fuzz_main.c, the corpus tests/fuzz/corpus/split_line.
+ */
+
+#define DSH_FUZZ_DELIM " \t\r\n\a"  // must match DSH_TOK_DELIM in main.c
+#define DSH_FUZZ_OPS "|;()"          // must match DSH_TOK_OPS in main.c
+
+const char *dsh_fuzz_name = "fuzz_split_line";
+
+/*
+ * Everything the tokenizer promises: a NULL-terminated array of
+ * non-empty tokens, none containing a delimiter. A token is a word
+ * inside the line with no operator in it, or an operator on its own.
+ */
+void dsh_fuzz_one(char *line, size_t size) {
+    char **tokens = dsh_split_line(line);
+    size_t it;
+
+    for (it = 0; tokens[it] != NULL; it++) {
+        const char *tok = tokens[it];
+        if (*tok != '\0' && strchr(DSH_FUZZ_OPS, *tok) && tok[1] == '\0') {
+            continue;
+        }
+        if (tok < line || tok >= line + size || *tok == '\0') {
+            abort();
+        }
+        for (; *tok; tok++) {
+            if (strchr(DSH_FUZZ_DELIM DSH_FUZZ_OPS, *tok)) {
+                abort();
+            }
+        }
+    }
+    free(tokens);
+}